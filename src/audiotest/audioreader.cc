@@ -1,6 +1,8 @@
+#include <getopt.h>
 #include <unistd.h>
 #include <cstdio>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
 
@@ -9,36 +11,79 @@
 
 #include "file_descriptor.hh"
 #include "audio.hh"
+#include "audio_file.hh"
 
 using namespace std;
 
 #define BUFSIZE 1024
 
+void usage( const char * argv0 )
+{
+  cerr << "usage: " << argv0 << " device-name | --file FILE [--free-running]" << endl;
+}
+
 int main( int argc, char * argv[] )
 {
-  if ( argc != 2 ) {
-    cerr << "usage: " << argv[ 0 ] << " device-name" << endl;
+  string filename;
+  AudioPacing pacing = AudioPacing::RealTime;
+
+  constexpr option options[] = {
+    { "file",         required_argument, NULL, 'f' },
+    { "free-running", no_argument,       NULL, 'r' },
+    { 0, 0, 0, 0 }
+  };
+
+  while ( true ) {
+    const int opt = getopt_long( argc, argv, "", options, NULL );
+
+    if ( opt == -1 ) {
+      break;
+    }
+
+    switch ( opt ) {
+    case 'f': filename = optarg; break;
+    case 'r': pacing = AudioPacing::FreeRunning; break;
+
+    default:
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( filename.empty() != ( optind == argc - 1 ) or optind < argc - 1 ) {
+    usage( argv[ 0 ] );
     return EXIT_FAILURE;
   }
 
+  /* raw files and devices are read as 44.1 kHz stereo; WAV files in the format of their header */
   pa_sample_spec ss;
   ss.format = PA_SAMPLE_S16LE;
   ss.rate = 44100;
   ss.channels = 2;
 
+  if ( not filename.empty() ) {
+    ss = AudioFileReader::file_sample_spec( filename, ss );
+    cerr << filename << ": " << ss.rate << " Hz, " << int( ss.channels ) << " channels" << endl;
+  }
+
   pa_buffer_attr ba;
   ba.maxlength = 1 << 16;
   ba.fragsize = 128;
 
-  AudioReader ar { argv[ 1 ], ss, ba };
+  unique_ptr<AudioSource> ar;
+  if ( filename.empty() ) {
+    ar.reset( new AudioReader( argv[ optind ], ss, ba ) );
+  } else {
+    ar.reset( new AudioFileReader( filename, ss, pacing ) );
+  }
+
   FileDescriptor stdout_fd { STDOUT_FILENO };
 
-  while ( true ) {
-    string data = ar.read( BUFSIZE );
+  uint8_t buffer[ BUFSIZE ];
 
-    if ( data.length() > 0 ) {
-      stdout_fd.write( data, true );
-    }
+  while ( true ) {
+    ar->read( buffer, BUFSIZE );
+    stdout_fd.write( Chunk( buffer, BUFSIZE ) );
   }
 
   return 0;
@@ -1,6 +1,8 @@
+#include <getopt.h>
 #include <unistd.h>
 #include <cstdio>
 #include <iostream>
+#include <memory>
 #include <stdexcept>
 #include <string>
 
@@ -9,29 +11,79 @@
 
 #include "file_descriptor.hh"
 #include "audio.hh"
+#include "audio_file.hh"
 
 using namespace std;
 
 #define DEVNAME "alsa_output.pci-0000_00_1b.0.analog-stereo"
 #define BUFSIZE 1024
 
-int main( int, char * [] )
+void usage( const char * argv0 )
 {
+  cerr << "usage: " << argv0 << " [--rate HZ] [--channels N] [device-name | --file FILE [--free-running]]" << endl;
+}
+
+int main( int argc, char * argv[] )
+{
+  string filename;
+  AudioPacing pacing = AudioPacing::RealTime;
+
+  /* the format of the samples on stdin, which a WAV file's header records */
   pa_sample_spec ss;
   ss.format = PA_SAMPLE_S16LE;
   ss.rate = 44100;
   ss.channels = 2;
 
+  constexpr option options[] = {
+    { "file",         required_argument, NULL, 'f' },
+    { "free-running", no_argument,       NULL, 'r' },
+    { "rate",         required_argument, NULL, 'R' },
+    { "channels",     required_argument, NULL, 'c' },
+    { 0, 0, 0, 0 }
+  };
+
+  while ( true ) {
+    const int opt = getopt_long( argc, argv, "", options, NULL );
+
+    if ( opt == -1 ) {
+      break;
+    }
+
+    switch ( opt ) {
+    case 'f': filename = optarg; break;
+    case 'r': pacing = AudioPacing::FreeRunning; break;
+    case 'R': ss.rate = stoul( optarg ); break;
+    case 'c': ss.channels = stoul( optarg ); break;
+
+    default:
+      usage( argv[ 0 ] );
+      return EXIT_FAILURE;
+    }
+  }
+
+  if ( optind < argc - 1 or ( not filename.empty() and optind < argc ) ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
   pa_buffer_attr ba;
   ba.maxlength = 1 << 24;
   ba.prebuf = 1024;
 
-  AudioWriter aw { DEVNAME, ss, ba };
+  unique_ptr<AudioSink> aw;
+  if ( filename.empty() ) {
+    aw.reset( new AudioWriter( optind < argc ? argv[ optind ] : DEVNAME, ss, ba ) );
+  } else {
+    aw.reset( new AudioFileWriter( filename, ss, pacing ) );
+  }
+
   FileDescriptor stdin_fd { STDIN_FILENO };
 
-  while ( true ) {
+  while ( not stdin_fd.eof() ) {
     string data = stdin_fd.read( BUFSIZE );
-    aw.write( data );
+    if ( not data.empty() ) {
+      aw->write( Chunk( data ) );
+    }
   }
 
   return 0;
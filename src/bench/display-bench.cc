@@ -0,0 +1,229 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* drives a headless VideoDisplay at several resolutions, reports the
+   upload and shade time per frame (CPU, and GPU from timer queries), and
+   checks the rendered image against the CPU Y'CbCr->RGB reference, for
+   a scene that changes everywhere and one where only the tiles under a
+   moving square do; then does the same for a VideoCompositor grid where
+   only some of the streams have a new frame each time */
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "display.hh"
+#include "compositor.hh"
+#include "color_convert.hh"
+
+using namespace std;
+
+/* gradients plus a moving checkerboard, so every frame is a real upload */
+void fill( BaseRaster & raster, const unsigned int frame )
+{
+  for ( unsigned int row = 0; row < raster.Y().height(); row++ ) {
+    for ( unsigned int col = 0; col < raster.Y().width(); col++ ) {
+      const bool check = ( ( col + frame ) / 16 + row / 16 ) % 2;
+      raster.Y().at( col, row ) = 16 + ( col * 219 / raster.Y().width() + ( check ? 40 : 0 ) ) % 220;
+    }
+  }
+
+  for ( unsigned int row = 0; row < raster.U().height(); row++ ) {
+    for ( unsigned int col = 0; col < raster.U().width(); col++ ) {
+      raster.U().at( col, row ) = 16 + ( row * 224 / raster.U().height() + frame ) % 225;
+      raster.V().at( col, row ) = 240 - ( col * 224 / raster.V().width() + 3 * frame ) % 225;
+    }
+  }
+}
+
+/* a mostly static scene: one small square moves over the first frame */
+void move_square( BaseRaster & raster, const unsigned int frame )
+{
+  const unsigned int size = 96;
+  const unsigned int left = ( frame * 37 ) % ( raster.Y().width() - size ) & ~1u;
+  const unsigned int top = ( frame * 23 ) % ( raster.Y().height() - size ) & ~1u;
+
+  for ( unsigned int row = top; row < top + size; row++ ) {
+    for ( unsigned int col = left; col < left + size; col++ ) {
+      raster.Y().at( col, row ) = 16 + ( frame * 13 + col ) % 220;
+    }
+  }
+
+  for ( unsigned int row = top / 2; row < ( top + size ) / 2; row++ ) {
+    for ( unsigned int col = left / 2; col < ( left + size ) / 2; col++ ) {
+      raster.U().at( col, row ) = 16 + ( frame * 5 ) % 225;
+      raster.V().at( col, row ) = 240 - ( frame * 11 + row ) % 225;
+    }
+  }
+}
+
+/* largest per-channel difference and the number of pixels beyond `tolerance` */
+pair<unsigned int, size_t> compare( const vector<uint8_t> & rendered, const vector<uint8_t> & reference,
+                                    const unsigned int tolerance )
+{
+  unsigned int max_error = 0;
+  size_t bad_pixels = 0;
+
+  for ( size_t pixel = 0; pixel < reference.size(); pixel += 4 ) {
+    unsigned int pixel_error = 0;
+    for ( size_t channel = 0; channel < 3; channel++ ) {
+      const int diff = int( rendered[ pixel + channel ] ) - int( reference[ pixel + channel ] );
+      pixel_error = max( pixel_error, unsigned( abs( diff ) ) );
+    }
+
+    max_error = max( max_error, pixel_error );
+    bad_pixels += pixel_error > tolerance;
+  }
+
+  return make_pair( max_error, bad_pixels );
+}
+
+int main( int argc, char * argv[] )
+{
+  if ( argc > 2 ) {
+    cerr << "usage: " << argv[ 0 ] << " [FRAMES]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const unsigned int frames = argc > 1 ? stoul( argv[ 1 ] ) : 200;
+
+  /* texture filtering is done in fixed point by most GPUs */
+  const unsigned int tolerance = 2;
+
+  const vector<pair<uint16_t, uint16_t>> resolutions = {
+    { 640, 360 }, { 1280, 720 }, { 1920, 1080 }, { 3840, 2160 }
+  };
+
+  bool all_valid = true;
+
+  cout << setw( 12 ) << "resolution" << setw( 8 ) << "scene"
+       << setw( 14 ) << "upload (ms)" << setw( 14 ) << "shade (ms)"
+       << setw( 12 ) << "gpu (ms)" << setw( 12 ) << "KiB/frame" << setw( 10 ) << "hit rate"
+       << setw( 12 ) << "max error" << setw( 12 ) << "bad pixels" << endl;
+
+  for ( const auto & resolution : resolutions ) {
+    for ( const bool moving : { true, false } ) {
+      BaseRaster raster { resolution.first, resolution.second, resolution.first, resolution.second };
+      VideoDisplay display { raster, VideoDisplay::Headless() };
+
+      double upload_time = 0, shade_time = 0, gpu_time = 0;
+      unsigned int gpu_frames = 0;
+      uint64_t uploaded_bytes = 0;
+      FrameTiming timing;
+
+      fill( raster, 0 );
+
+      for ( unsigned int frame = 0; frame < frames; frame++ ) {
+        if ( moving ) {
+          fill( raster, frame );
+        } else if ( frame > 0 ) {
+          move_square( raster, frame );
+        }
+
+        display.draw( raster );
+
+        upload_time += display.last_upload_time().count();
+        shade_time += display.last_draw_time().count();
+        uploaded_bytes += display.last_uploaded_bytes();
+
+        while ( display.pop_timing( timing ) ) {
+          if ( timing.gpu_time >= 0 ) {
+            gpu_time += timing.gpu_time;
+            gpu_frames++;
+          }
+        }
+      }
+
+      vector<uint8_t> rendered, reference;
+      display.read_pixels( rendered );
+      ycbcr_to_rgba_reference( raster, reference );
+
+      const auto errors = compare( rendered, reference, tolerance );
+      all_valid = all_valid and errors.second == 0;
+
+      cout << setw( 12 ) << ( to_string( resolution.first ) + "x" + to_string( resolution.second ) )
+           << setw( 8 ) << ( moving ? "moving" : "static" )
+           << fixed << setprecision( 3 )
+           << setw( 14 ) << upload_time * 1000 / frames
+           << setw( 14 ) << shade_time * 1000 / frames
+           << setw( 12 ) << ( gpu_frames ? gpu_time * 1000 / gpu_frames : -1 )
+           << setw( 12 ) << setprecision( 1 ) << uploaded_bytes / 1024.0 / frames
+           << setw( 9 ) << 100 * display.tile_map().hit_rate() << "%"
+           << setw( 12 ) << errors.first
+           << setw( 12 ) << errors.second << endl;
+    }
+  }
+
+  /* compositor: stream i gets a new frame every i+1 draws */
+  const unsigned int streams = 5;
+  BaseRaster raster { 640, 360, 640, 360 };
+  VideoCompositor compositor { raster, streams, VideoDisplay::Headless() };
+
+  /* rasters share their planes when copied, so each stream gets its own */
+  vector<unique_ptr<BaseRaster>> stream_frames;
+  for ( unsigned int stream = 0; stream < streams; stream++ ) {
+    stream_frames.emplace_back( new BaseRaster { 640, 360, 640, 360 } );
+  }
+
+  double upload_time = 0, shade_time = 0;
+
+  for ( unsigned int frame = 0; frame < frames; frame++ ) {
+    vector<const BaseRaster *> new_frames( streams, nullptr );
+
+    for ( unsigned int stream = 0; stream < streams; stream++ ) {
+      if ( frame % ( stream + 1 ) == 0 ) {
+        fill( *stream_frames[ stream ], frame + 7 * stream );
+        new_frames[ stream ] = stream_frames[ stream ].get();
+      }
+    }
+
+    compositor.draw( new_frames );
+    upload_time += compositor.last_upload_time().count();
+    shade_time += compositor.last_draw_time().count();
+  }
+
+  vector<uint8_t> rendered;
+  compositor.read_pixels( rendered );
+
+  const size_t grid_width = compositor.columns() * raster.display_width();
+  unsigned int max_error = 0;
+  size_t bad_pixels = 0;
+
+  for ( unsigned int stream = 0; stream < streams; stream++ ) {
+    vector<uint8_t> reference, cell;
+    ycbcr_to_rgba_reference( *stream_frames[ stream ], reference );
+
+    const size_t left = ( stream % compositor.columns() ) * raster.display_width();
+    const size_t top = ( stream / compositor.columns() ) * raster.display_height();
+
+    for ( size_t row = 0; row < raster.display_height(); row++ ) {
+      const auto start = rendered.begin() + 4 * ( ( top + row ) * grid_width + left );
+      cell.insert( cell.end(), start, start + 4 * raster.display_width() );
+    }
+
+    const auto errors = compare( cell, reference, tolerance );
+    max_error = max( max_error, errors.first );
+    bad_pixels += errors.second;
+  }
+
+  all_valid = all_valid and bad_pixels == 0;
+
+  cout << endl << setw( 12 ) << "streams" << setw( 14 ) << "upload (ms)" << setw( 14 ) << "shade (ms)"
+       << setw( 12 ) << "uploaded" << setw( 12 ) << "skipped"
+       << setw( 12 ) << "max error" << setw( 12 ) << "bad pixels" << endl;
+
+  cout << setw( 12 ) << ( to_string( streams ) + " (" + to_string( compositor.columns() )
+                          + "x" + to_string( compositor.rows() ) + ")" )
+       << fixed << setprecision( 3 )
+       << setw( 14 ) << upload_time * 1000 / frames
+       << setw( 14 ) << shade_time * 1000 / frames
+       << setw( 12 ) << compositor.uploaded_frames()
+       << setw( 12 ) << compositor.skipped_frames()
+       << setw( 12 ) << max_error
+       << setw( 12 ) << bad_pixels << endl;
+
+  return all_valid ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,138 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* hands rasters from one thread to another through the lock-free
+   BaseRasterQueue and through a mutex + condition variable ring like the
+   one my-camera used before, and reports the cost per hand-off */
+
+#include <chrono>
+#include <condition_variable>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "raster.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+/* the previous design: a ring guarded by one mutex and one condition variable */
+class MutexRasterQueue
+{
+private:
+  vector<BaseRaster> slots_ {};
+  size_t front_ { 0 }, occupancy_ { 0 };
+  mutex mutex_ {};
+  condition_variable cv_ {};
+
+public:
+  MutexRasterQueue( const size_t capacity, const uint16_t width, const uint16_t height )
+  {
+    for ( size_t i = 0; i < capacity; i++ ) {
+      slots_.emplace_back( width, height, width, height );
+    }
+  }
+
+  BaseRaster & acquire_write()
+  {
+    unique_lock<mutex> lock { mutex_ };
+    cv_.wait( lock, [&]() { return occupancy_ < slots_.size(); } );
+    return slots_[ ( front_ + occupancy_ ) % slots_.size() ];
+  }
+
+  void commit_write()
+  {
+    { lock_guard<mutex> lock { mutex_ }; occupancy_++; }
+    cv_.notify_all();
+  }
+
+  BaseRaster & acquire_read( const size_t min_occupancy = 1 )
+  {
+    unique_lock<mutex> lock { mutex_ };
+    cv_.wait( lock, [&]() { return occupancy_ >= min_occupancy; } );
+    return slots_[ front_ ];
+  }
+
+  void release_read()
+  {
+    { lock_guard<mutex> lock { mutex_ }; front_ = ( front_ + 1 ) % slots_.size(); occupancy_--; }
+    cv_.notify_all();
+  }
+};
+
+/* stamps the sequence number at both ends of the frame, so a torn read shows up */
+void stamp( BaseRaster & raster, const uint32_t sequence )
+{
+  memcpy( &raster.Y().at( 0, 0 ), &sequence, sizeof( sequence ) );
+  memcpy( &raster.V().at( 0, raster.V().height() - 1 ), &sequence, sizeof( sequence ) );
+}
+
+bool check( const BaseRaster & raster, const uint32_t sequence )
+{
+  uint32_t first, last;
+  memcpy( &first, &raster.Y().at( 0, 0 ), sizeof( first ) );
+  memcpy( &last, &raster.V().at( 0, raster.V().height() - 1 ), sizeof( last ) );
+  return first == sequence and last == sequence;
+}
+
+template <class Queue>
+void run( const string & name, Queue & queue, const uint32_t iterations )
+{
+  size_t errors = 0;
+  const auto start = steady_clock::now();
+
+  thread producer {
+    [&]()
+    {
+      for ( uint32_t i = 0; i < iterations; i++ ) {
+        BaseRaster & r = queue.acquire_write();
+        stamp( r, i );
+        queue.commit_write();
+      }
+    } };
+
+  for ( uint32_t i = 0; i < iterations; i++ ) {
+    errors += not check( queue.acquire_read(), i );
+    queue.release_read();
+  }
+
+  producer.join();
+
+  const double elapsed = duration_cast<duration<double>>( steady_clock::now() - start ).count();
+
+  cout << setw( 8 ) << name
+       << fixed << setprecision( 1 ) << setw( 12 ) << elapsed * 1e9 / iterations << " ns/frame"
+       << setw( 14 ) << iterations / elapsed << " frames/s"
+       << "  errors: " << errors << endl;
+}
+
+int main( int argc, char * argv[] )
+{
+  if ( argc > 5 ) {
+    cerr << "usage: " << argv[ 0 ] << " [ITERATIONS] [CAPACITY] [WIDTH] [HEIGHT]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const uint32_t iterations = argc > 1 ? stoul( argv[ 1 ] ) : 1000000;
+  const size_t capacity = argc > 2 ? stoul( argv[ 2 ] ) : 4;
+  const uint16_t width = argc > 3 ? stoul( argv[ 3 ] ) : 64;
+  const uint16_t height = argc > 4 ? stoul( argv[ 4 ] ) : 64;
+
+  cout << iterations << " frames of " << width << "x" << height
+       << " through a queue of " << capacity << endl;
+
+  {
+    MutexRasterQueue queue { capacity, width, height };
+    run( "mutex", queue, iterations );
+  }
+
+  {
+    BaseRasterQueue queue { capacity, width, height, width, height };
+    run( "spsc", queue, iterations );
+  }
+
+  return EXIT_SUCCESS;
+}
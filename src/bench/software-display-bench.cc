@@ -0,0 +1,100 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* drives XCBDisplay with a moving test pattern and reports the I420->BGRX
+   conversion time (single-threaded kernel vs. the worker pool) and the
+   present latency, from request to the server's completion event.
+
+   Headless: Xvfb :1 -screen 0 1920x1080x24 -fakescreenfps 60 &
+             DISPLAY=:1 software-display-bench */
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "xcb_display.hh"
+#include "color_convert.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+void fill( BaseRaster & raster, const unsigned int frame )
+{
+  for ( unsigned int row = 0; row < raster.Y().height(); row++ ) {
+    for ( unsigned int col = 0; col < raster.Y().width(); col++ ) {
+      const bool check = ( ( col + frame ) / 16 + row / 16 ) % 2;
+      raster.Y().at( col, row ) = 16 + ( col * 219 / raster.Y().width() + ( check ? 40 : 0 ) ) % 220;
+    }
+  }
+
+  for ( unsigned int row = 0; row < raster.U().height(); row++ ) {
+    for ( unsigned int col = 0; col < raster.U().width(); col++ ) {
+      raster.U().at( col, row ) = 16 + ( row * 224 / raster.U().height() + frame ) % 225;
+      raster.V().at( col, row ) = 240 - ( col * 224 / raster.V().width() + 3 * frame ) % 225;
+    }
+  }
+}
+
+void report( const string & name, vector<double> & samples )
+{
+  sort( samples.begin(), samples.end() );
+
+  double sum = 0;
+  for ( const double sample : samples ) {
+    sum += sample;
+  }
+
+  cout << setw( 20 ) << name << fixed << setprecision( 3 )
+       << setw( 10 ) << sum * 1000 / samples.size()
+       << setw( 10 ) << samples[ samples.size() / 2 ] * 1000
+       << setw( 10 ) << samples[ samples.size() * 99 / 100 ] * 1000
+       << setw( 10 ) << samples.back() * 1000 << endl;
+}
+
+int main( int argc, char * argv[] )
+{
+  if ( argc > 5 ) {
+    cerr << "usage: " << argv[ 0 ] << " [FRAMES] [WIDTH] [HEIGHT] [THREADS]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const unsigned int frames = argc > 1 ? stoul( argv[ 1 ] ) : 300;
+  const uint16_t width = argc > 2 ? stoul( argv[ 2 ] ) : 1280;
+  const uint16_t height = argc > 3 ? stoul( argv[ 3 ] ) : 720;
+  const size_t threads = argc > 4 ? stoul( argv[ 4 ] ) : thread::hardware_concurrency();
+
+  BaseRaster raster { width, height, width, height };
+  vector<uint8_t> bgrx( 4 * size_t( width ) * height );
+
+  vector<double> single_thread, conversion, present;
+
+  XCBDisplay display { raster, threads };
+
+  for ( unsigned int frame = 0; frame < frames; frame++ ) {
+    fill( raster, frame );
+
+    const auto start = steady_clock::now();
+    i420_to_bgrx( raster, bgrx.data(), 4 * width, 0, height );
+    single_thread.push_back( duration<double>( steady_clock::now() - start ).count() );
+
+    display.draw( raster );
+    conversion.push_back( display.last_upload_time().count() );
+    present.push_back( display.last_draw_time().count() );
+  }
+
+  cout << frames << " frames of " << width << "x" << height << ", "
+       << threads << " conversion threads, "
+       << display.skipped() << " presents skipped" << endl;
+
+  cout << setw( 20 ) << "(ms)" << setw( 10 ) << "mean" << setw( 10 ) << "p50"
+       << setw( 10 ) << "p99" << setw( 10 ) << "max" << endl;
+
+  report( "convert, 1 thread", single_thread );
+  report( "convert, pool", conversion );
+  report( "present", present );
+
+  return EXIT_SUCCESS;
+}
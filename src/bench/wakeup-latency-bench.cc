@@ -0,0 +1,138 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+/* a two-stage pipeline like my-camera's: a source paced by a 1 ms timer
+   feeds a sink through an Edge, and the sink fills a freshly allocated
+   buffer with each item, as a codec does. Busy threads compete for the
+   CPU. It runs three times: as is, with both stages pinned and in
+   SCHED_FIFO, and with memory locked as well; and reports each thread's
+   wakeup latency and the sink's page faults per item. */
+
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+
+#include "pipeline.hh"
+#include "realtime.hh"
+#include "latency_histogram.hh"
+#include "timerfd.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+static constexpr int64_t INTERVAL_US = 1000;
+static constexpr size_t BUFFER_SIZE = 1 << 20;
+
+static long minor_faults( void )
+{
+  rusage usage;
+  SystemCall( "getrusage", getrusage( RUSAGE_THREAD, &usage ) );
+  return usage.ru_minflt;
+}
+
+void run( const string & name, const double seconds, const unsigned int load,
+          const int cpu, const int priority )
+{
+  Edge<int64_t> edge { "items", OverflowPolicy::Block, 4 };
+  LatencyHistogram timer_wakeups;
+  atomic<bool> running { true };
+  atomic<long> faults { 0 };
+
+  vector<thread> busy;
+  for ( unsigned int i = 0; i < load; i++ ) {
+    busy.emplace_back( [&]() { for ( volatile uint64_t spin = 0; running; spin++ ) {} } );
+    if ( cpu >= 0 ) {
+      pin_thread( busy.back(), cpu );
+    }
+  }
+
+  Stage sink {
+    "sink",
+    [&]( Stage & stage )
+    {
+      const long faults_before = minor_faults();
+
+      while ( int64_t * item = edge.wait_read() ) {
+        {
+          Stage::ServiceTimer timer { stage };
+          vector<uint8_t> buffer( BUFFER_SIZE, uint8_t( *item ) );
+        }
+        edge.release_read();
+      }
+
+      faults = minor_faults() - faults_before;
+    },
+    cpu
+  };
+
+  Stage source {
+    "source",
+    [&]( Stage & stage )
+    {
+      TimerFD timer;
+      const int64_t start = monotonic_timestamp_us();
+      timer.arm_periodic( INTERVAL_US );
+
+      for ( uint64_t expirations = 0; running; ) {
+        expirations += timer.read_expirations();
+        timer_wakeups.record( monotonic_timestamp_us() - ( start + int64_t( expirations ) * INTERVAL_US ) );
+
+        Stage::ServiceTimer service { stage };
+        if ( int64_t * item = edge.acquire_write() ) {
+          *item = expirations;
+          edge.commit_write();
+        }
+      }
+      edge.close();
+    },
+    cpu
+  };
+
+  bool fifo = priority > 0;
+  if ( fifo ) {
+    fifo = source.set_fifo_priority( priority ) and sink.set_fifo_priority( priority );
+  }
+
+  this_thread::sleep_for( chrono::duration<double>( seconds ) );
+  running = false;
+  source.join();
+  sink.join();
+  for ( auto & thread : busy ) {
+    thread.join();
+  }
+
+  cout << name << ( priority > 0 and not fifo ? " (SCHED_FIFO not permitted)" : "" ) << endl
+       << "  source (timer):\t" << timer_wakeups.report() << endl
+       << "  sink (edge):\t\t" << edge.wakeup_latency().report() << endl
+       << "  sink page faults:\t" << fixed << setprecision( 1 )
+       << double( faults ) / max<uint64_t>( sink.items(), 1 ) << "/item" << endl;
+}
+
+int main( int argc, char * argv[] )
+{
+  if ( argc > 5 ) {
+    cerr << "usage: " << argv[ 0 ] << " [SECONDS] [BUSY-THREADS] [CPU] [PRIORITY]" << endl;
+    return EXIT_FAILURE;
+  }
+
+  const double seconds = argc > 1 ? stod( argv[ 1 ] ) : 5;
+  const unsigned int load = argc > 2 ? stoul( argv[ 2 ] ) : thread::hardware_concurrency();
+  const int cpu = argc > 3 ? stoi( argv[ 3 ] ) : 0;
+  const int priority = argc > 4 ? stoi( argv[ 4 ] ) : 50;
+
+  cout << seconds << " s per run, " << load << " busy threads, wakeup latency in us" << endl;
+
+  run( "default", seconds, load, -1, 0 );
+  run( "pinned to CPU " + to_string( cpu ) + ", SCHED_FIFO " + to_string( priority ),
+       seconds, load, cpu, priority );
+
+  /* last, since it cannot be undone */
+  const bool locked = lock_memory();
+  run( string( "and memory " ) + ( locked ? "locked" : "not locked (not permitted)" ),
+       seconds, load, cpu, priority );
+
+  return EXIT_SUCCESS;
+}
@@ -0,0 +1,63 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include "encode_cache.hh"
+#include "exception.hh"
+
+using namespace std;
+
+EncodeCache::EncodeCache( const string & directory )
+  : directory_( directory )
+{
+  if ( mkdir( directory_.c_str(), 0755 ) < 0 and errno != EEXIST ) {
+    throw unix_error( "mkdir " + directory_ );
+  }
+}
+
+string EncodeCache::path( const size_t raster_hash, const string & parameters ) const
+{
+  ostringstream name;
+  name << directory_ << "/" << hex << raster_hash << "-" << parameters;
+  return name.str();
+}
+
+Optional<EncodeResult> EncodeCache::get( const size_t raster_hash, const string & parameters ) const
+{
+  ifstream in { path( raster_hash, parameters ) };
+  EncodeResult result;
+
+  if ( not ( in >> result.bytes >> result.psnr >> result.ssim ) ) {
+    return {};
+  }
+
+  return result;
+}
+
+void EncodeCache::put( const size_t raster_hash, const string & parameters,
+                       const EncodeResult & result )
+{
+  const string final_path = path( raster_hash, parameters );
+
+  /* write under a private name and rename, so concurrent sweeps never see a partial entry */
+  ostringstream temp_path;
+  temp_path << final_path << ".tmp." << this_thread::get_id();
+
+  {
+    ofstream out { temp_path.str() };
+    out.precision( 17 );
+    out << result.bytes << " " << result.psnr << " " << result.ssim << "\n";
+
+    if ( not out ) {
+      throw runtime_error( "could not write cache entry " + temp_path.str() );
+    }
+  }
+
+  SystemCall( "rename", rename( temp_path.str().c_str(), final_path.c_str() ) );
+}
@@ -0,0 +1,33 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef ENCODE_CACHE_HH
+#define ENCODE_CACHE_HH
+
+#include <string>
+
+#include "optional.hh"
+
+/* outcome of encoding one frame at one set of codec parameters */
+struct EncodeResult
+{
+  size_t bytes;
+  double psnr;
+  double ssim;
+};
+
+/* on-disk cache of encode results, one small file per (raster, parameters) cell */
+class EncodeCache
+{
+private:
+  std::string directory_;
+
+  std::string path( const size_t raster_hash, const std::string & parameters ) const;
+
+public:
+  EncodeCache( const std::string & directory );
+
+  Optional<EncodeResult> get( const size_t raster_hash, const std::string & parameters ) const;
+  void put( const size_t raster_hash, const std::string & parameters, const EncodeResult & result );
+};
+
+#endif /* ENCODE_CACHE_HH */
@@ -4,6 +4,7 @@
 #include <vector>
 #include <mutex>
 #include <chrono>
+#include <stdexcept>
 #include "h264_degrader.hh"
 #include "raster.hh"
 
@@ -18,6 +19,7 @@ extern "C" {
 #include "libavutil/imgutils.h"
 #include "libavutil/common.h"
 #include "libavutil/mathematics.h"
+#include "libavutil/pixdesc.h"
 }
 
 void H264_degrader::bgra2yuv422p(uint8_t* input, AVFrame* outputFrame, size_t width, size_t height){
@@ -51,7 +53,9 @@ H264_degrader::H264_degrader(size_t _width, size_t _height, size_t _bitrate, siz
     height(_height),
     bitrate(_bitrate),
     frame_count(0),
-    quantization(quantization)
+    quantization(quantization),
+    previous_input_(_width, _height, _width, _height),
+    previous_output_(_width, _height, _width, _height)
 {
 
     avcodec_register_all();
@@ -95,8 +99,8 @@ H264_degrader::H264_degrader(size_t _width, size_t _height, size_t _bitrate, siz
     encoder_context->qmin = quantization;
     encoder_context->qmax = quantization;
     encoder_context->qcompress = 0.5;
-    av_opt_set(encoder_context->priv_data, "tune", "zerolatency", 0); // forces no frame buffer delay (https://stackoverflow.com/questions/10155099/c-ffmpeg-h264-creating-zero-delay-stream)
-    av_opt_set(encoder_context->priv_data, "preset", "veryfast", 0);
+    av_opt_set(encoder_context->priv_data, "tune", tune.c_str(), 0); // forces no frame buffer delay (https://stackoverflow.com/questions/10155099/c-ffmpeg-h264-creating-zero-delay-stream)
+    av_opt_set(encoder_context->priv_data, "preset", preset.c_str(), 0);
 
     // decoder context parameter
     decoder_context->pix_fmt = pix_fmt;
@@ -142,6 +146,12 @@ H264_degrader::H264_degrader(size_t _width, size_t _height, size_t _bitrate, siz
         throw;
     }
 
+    alias_frame = av_frame_alloc();
+    if(alias_frame == NULL) {
+        std::cout << "AVFrame not allocated: alias" << "\n";
+        throw;
+    }
+
     encoder_frame->width = width;
     encoder_frame->height = height;
     encoder_frame->format = pix_fmt;
@@ -212,6 +222,7 @@ H264_degrader::~H264_degrader(){
 
     av_frame_free(&decoder_frame);
     av_frame_free(&encoder_frame);
+    av_frame_free(&alias_frame);
 
     av_packet_free(&decoder_packet);
     av_packet_free(&encoder_packet);
@@ -341,9 +352,9 @@ void H264_degrader::degrade(AVFrame *inputFrame, AVFrame *outputFrame){
     av_packet_unref(decoder_packet);
 
     if(!output_set){
-        std::memset(outputFrame->data[0], 255, width*height);
-        std::memset(outputFrame->data[1], 128, width*height/2);
-        std::memset(outputFrame->data[2], 128, width*height/2);
+        std::memset(outputFrame->data[0], 255, outputFrame->linesize[0]*height);
+        std::memset(outputFrame->data[1], 128, outputFrame->linesize[1]*height/2);
+        std::memset(outputFrame->data[2], 128, outputFrame->linesize[2]*height/2);
 
         // make white if output not set
         /*std::memset(output[0], 255, width*height);
@@ -352,9 +363,90 @@ void H264_degrader::degrade(AVFrame *inputFrame, AVFrame *outputFrame){
 	*/
     }
 
+    last_frame_size_ = buffer_size;
     frame_count += 1;
 }
 
+/* the raster owns the memory; the AVBufferRef only makes the frame refcounted */
+static void release_nothing(void *, uint8_t *) {}
+
+void H264_degrader::alias_raster(const BaseRaster &raster, AVFrame *frame)
+{
+    av_frame_unref(frame);
+
+    frame->width = width;
+    frame->height = height;
+    frame->format = pix_fmt;
+
+    const TwoD<uint8_t> *planes[3] = { &raster.Y(), &raster.U(), &raster.V() };
+
+    for(size_t i = 0; i < 3; i++){
+        /* the encoder only reads its input, so dropping const is safe */
+        uint8_t *data = const_cast<uint8_t *>(&planes[i]->at(0, 0));
+
+        frame->data[i] = data;
+        frame->linesize[i] = planes[i]->stride();
+        frame->buf[i] = av_buffer_create(data, planes[i]->stride() * planes[i]->height(),
+                                         release_nothing, NULL, 0);
+
+        if(frame->buf[i] == NULL){
+            throw std::runtime_error("could not wrap raster plane in an AVBuffer");
+        }
+    }
+}
+
+static void copy_plane(const uint8_t *src, int linesize, TwoD<uint8_t> &plane, size_t rows)
+{
+    for(size_t row = 0; row < rows; row++){
+        std::memcpy(&plane.at(0, row), src + row*linesize, plane.width());
+    }
+}
+
+size_t H264_degrader::degrade(const BaseRaster &input, BaseRaster &output){
+    if(input.width() != width || input.height() != height ||
+       output.width() != width || output.height() != height){
+        throw std::runtime_error("raster dimensions do not match degrader");
+    }
+
+    total_frames_ += 1;
+
+    /* read before anything is written, since input and output may be the same raster */
+    const int64_t capture_timestamp = input.capture_timestamp();
+
+    if(static_skip_ && have_previous_ && input.sad(previous_input_, static_threshold_) <= static_threshold_){
+        static_frames_ += 1;
+        output.copy_from(previous_output_);
+        output.set_capture_timestamp(capture_timestamp);
+        last_frame_size_ = 0;
+        return 0;
+    }
+
+    previous_input_.copy_from(input);
+
+    alias_raster(input, alias_frame);
+
+    degrade(alias_frame, decoder_frame);
+    av_frame_unref(alias_frame);
+
+    copy_plane(decoder_frame->data[0], decoder_frame->linesize[0], output.Y(), height);
+    copy_plane(decoder_frame->data[1], decoder_frame->linesize[1], output.U(), height/2);
+    copy_plane(decoder_frame->data[2], decoder_frame->linesize[2], output.V(), height/2);
+    output.set_capture_timestamp(capture_timestamp);
+
+    previous_output_.copy_from(output);
+    have_previous_ = true;
+
+    return last_frame_size_;
+}
+
+std::string H264_degrader::parameter_string() const
+{
+    return std::string(avcodec_get_name(codec_id)) + "-" + av_get_pix_fmt_name(pix_fmt)
+        + "-" + std::to_string(width) + "x" + std::to_string(height)
+        + "-" + preset + "-" + tune
+        + "-b" + std::to_string(bitrate) + "-q" + std::to_string(quantization);
+}
+
 MJPEGDecoder::MJPEGDecoder( const size_t width, const size_t height )
   : width( width ), height( height )
 {
@@ -8,7 +8,9 @@ extern "C" {
 #include "libavutil/frame.h"
 }
 
+#include <atomic>
 #include <mutex>
+#include <string>
 #include "raster.hh"
 
 class H264_degrader{
@@ -28,11 +30,34 @@ public:
 
     void degrade(AVFrame *inputFrame, AVFrame *outputFrame);
 
+    /* encodes and decodes `input` into `output` (which may be the same raster);
+       returns the encoded frame size in bytes */
+    size_t degrade(const BaseRaster &input, BaseRaster &output);
+
+    size_t last_frame_size() const { return last_frame_size_; }
+
+    /* Inputs within this SAD of the last encoded input skip the codec and
+       reuse its decoded output. The encoder is intra-only, so skipping a
+       frame leaves no codec state behind; 0 only matches identical frames.
+       Disabled until a threshold is set. */
+    void set_static_threshold(uint64_t sad_threshold) { static_skip_ = true; static_threshold_ = sad_threshold; }
+    size_t static_frames() const { return static_frames_.load( std::memory_order_relaxed ); }
+    size_t total_frames() const { return total_frames_.load( std::memory_order_relaxed ); }
+
+    /* everything besides the input that determines the encoded output */
+    std::string parameter_string() const;
+
 private:
+    /* points `frame` at the raster's planes (strides become linesizes), without copying */
+    void alias_raster(const BaseRaster &raster, AVFrame *frame);
+    AVFrame *alias_frame;
+
     std::mutex degrader_mutex;
 
     const AVCodecID codec_id = AV_CODEC_ID_H264;
-    const AVPixelFormat pix_fmt = AV_PIX_FMT_YUV422P;
+    const AVPixelFormat pix_fmt = AV_PIX_FMT_YUV420P;
+    const std::string preset = "veryfast";
+    const std::string tune = "zerolatency";
 
     const size_t width;
     const size_t height;
@@ -40,6 +65,16 @@ private:
     const size_t quantization;
 
     size_t frame_count;
+    size_t last_frame_size_ = 0;
+
+    BaseRaster previous_input_;
+    BaseRaster previous_output_;
+    bool have_previous_ = false;
+    bool static_skip_ = false;
+    uint64_t static_threshold_ = 0;
+    /* read by the stats thread */
+    std::atomic<size_t> static_frames_ { 0 };
+    std::atomic<size_t> total_frames_ { 0 };
 
     AVCodec *encoder_codec;
     AVCodec *decoder_codec;
@@ -0,0 +1,184 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+
+#include "opus_degrader.hh"
+#include "exception.hh"
+
+using namespace std;
+
+/* the most one Opus packet (up to 60 ms) can need, per the libopus documentation */
+static constexpr size_t MAX_PACKET_SIZE = 4000;
+
+static size_t checked_frame_samples( const OpusDegrader::Parameters & parameters )
+{
+  for ( const double allowed : { 2.5, 5.0, 10.0, 20.0, 40.0, 60.0 } ) {
+    if ( abs( parameters.frame_ms - allowed ) < 1e-6 ) {
+      return parameters.sample_rate * allowed / 1000;
+    }
+  }
+
+  throw Invalid( "Opus frames are 2.5, 5, 10, 20, 40 or 60 ms" );
+}
+
+static size_t gcd( size_t a, size_t b )
+{
+  while ( b ) {
+    const size_t r = a % b;
+    a = b;
+    b = r;
+  }
+  return a;
+}
+
+static uint64_t thread_cpu_ns( void )
+{
+  timespec ts;
+  SystemCall( "clock_gettime", clock_gettime( CLOCK_THREAD_CPUTIME_ID, &ts ) );
+  return uint64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
+}
+
+static void check_opus( const string & what, const int ret )
+{
+  if ( ret < 0 ) {
+    throw runtime_error( what + ": " + opus_strerror( ret ) );
+  }
+}
+
+/* a period of k samples has produced floor(k / F) whole frames; priming
+   with F - gcd(period, F) samples of silence covers the largest shortfall */
+OpusDegrader::OpusDegrader( const Parameters & parameters, const size_t period_samples )
+  : parameters_( parameters ),
+    frame_samples_( checked_frame_samples( parameters ) ),
+    period_samples_( period_samples ),
+    sample_size_( parameters.channels * sizeof( int16_t ) ),
+    input_frame_( frame_samples_ * parameters.channels ),
+    packet_( MAX_PACKET_SIZE ),
+    output_frame_( frame_samples_ * parameters.channels ),
+    output_( ( 2 * frame_samples_ + period_samples ) * sample_size_ ),
+    priming_samples_( frame_samples_ - gcd( period_samples, frame_samples_ ) )
+{
+  if ( period_samples == 0 ) {
+    throw Invalid( "Opus degrader needs a non-empty period" );
+  }
+
+  if ( parameters.complexity > 10 ) {
+    throw Invalid( "Opus complexity is between 0 and 10" );
+  }
+
+  int error = OPUS_OK;
+
+  encoder_ = opus_encoder_create( parameters.sample_rate, parameters.channels,
+                                  OPUS_APPLICATION_VOIP, &error );
+  check_opus( "opus_encoder_create (rates are 8, 12, 16, 24 or 48 kHz)", error );
+
+  decoder_ = opus_decoder_create( parameters.sample_rate, parameters.channels, &error );
+  if ( error != OPUS_OK ) {
+    opus_encoder_destroy( encoder_ );
+  }
+  check_opus( "opus_decoder_create", error );
+
+  try {
+    check_opus( "OPUS_SET_BITRATE", opus_encoder_ctl( encoder_, OPUS_SET_BITRATE( parameters.bitrate ) ) );
+    check_opus( "OPUS_SET_COMPLEXITY", opus_encoder_ctl( encoder_, OPUS_SET_COMPLEXITY( parameters.complexity ) ) );
+    check_opus( "OPUS_GET_LOOKAHEAD", opus_encoder_ctl( encoder_, OPUS_GET_LOOKAHEAD( &lookahead_samples_ ) ) );
+  } catch ( ... ) {
+    opus_decoder_destroy( decoder_ );
+    opus_encoder_destroy( encoder_ );
+    throw;
+  }
+
+  /* the priming silence, so the first periods have something to return */
+  fill( output_frame_.begin(), output_frame_.end(), 0 );
+  output_.try_write( reinterpret_cast<const uint8_t *>( output_frame_.data() ),
+                     priming_samples_ * sample_size_ );
+}
+
+OpusDegrader::~OpusDegrader()
+{
+  opus_decoder_destroy( decoder_ );
+  opus_encoder_destroy( encoder_ );
+}
+
+void OpusDegrader::process_frame( void )
+{
+  const uint64_t start = thread_cpu_ns();
+
+  const opus_int32 size = opus_encode( encoder_, input_frame_.data(), frame_samples_,
+                                       packet_.data(), packet_.size() );
+  check_opus( "opus_encode", size );
+
+  const int decoded = opus_decode( decoder_, packet_.data(), size,
+                                   output_frame_.data(), frame_samples_, 0 );
+  check_opus( "opus_decode", decoded );
+
+  const uint64_t cpu = thread_cpu_ns() - start;
+
+  output_.try_write( reinterpret_cast<const uint8_t *>( output_frame_.data() ),
+                     decoded * sample_size_ );
+
+  frames_.fetch_add( 1, memory_order_relaxed );
+  encoded_bytes_.fetch_add( size, memory_order_relaxed );
+  cpu_ns_.fetch_add( cpu, memory_order_relaxed );
+  last_cpu_ns_.store( cpu, memory_order_relaxed );
+  last_frame_size_.store( size, memory_order_relaxed );
+
+  if ( cpu > max_cpu_ns_.load( memory_order_relaxed ) ) {
+    max_cpu_ns_.store( cpu, memory_order_relaxed );
+  }
+}
+
+void OpusDegrader::degrade( const uint8_t * input, uint8_t * output, const size_t size )
+{
+  if ( size != period_samples_ * sample_size_ ) {
+    throw Invalid( "Opus degrader got a partial period" );
+  }
+
+  size_t offset = 0;
+  while ( offset < size ) {
+    const size_t space = ( frame_samples_ - input_samples_ ) * sample_size_;
+    const size_t amount = min( space, size - offset );
+
+    memcpy( reinterpret_cast<uint8_t *>( input_frame_.data() ) + input_samples_ * sample_size_,
+            input + offset, amount );
+    input_samples_ += amount / sample_size_;
+    offset += amount;
+
+    if ( input_samples_ == frame_samples_ ) {
+      process_frame();
+      input_samples_ = 0;
+    }
+  }
+
+  if ( output_.try_read( output, size ) != size ) {
+    throw runtime_error( "Opus degrader ran out of decoded audio" );
+  }
+}
+
+uint64_t OpusDegrader::latency( void ) const
+{
+  return ( priming_samples_ + lookahead_samples_ ) * 1000000 / parameters_.sample_rate;
+}
+
+double OpusDegrader::mean_cpu_ns( void ) const
+{
+  const uint64_t count = frames();
+  return count ? double( cpu_ns_.load( memory_order_relaxed ) ) / count : 0;
+}
+
+double OpusDegrader::encoded_bitrate( void ) const
+{
+  const uint64_t count = frames();
+  return count ? 8.0 * encoded_bytes_.load( memory_order_relaxed ) * parameters_.sample_rate
+                 / ( double( count ) * frame_samples_ ) : 0;
+}
+
+string OpusDegrader::parameter_string( void ) const
+{
+  return "opus-" + to_string( parameters_.sample_rate ) + "x" + to_string( parameters_.channels )
+    + "-b" + to_string( parameters_.bitrate ) + "-f" + to_string( frame_samples_ )
+    + "-c" + to_string( parameters_.complexity );
+}
@@ -0,0 +1,103 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef OPUS_DEGRADER_HH
+#define OPUS_DEGRADER_HH
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <opus.h>
+
+#include "byte_ring.hh"
+
+/* The audio counterpart of H264_degrader: interleaved 16-bit PCM goes
+   through a real Opus encode and decode, so what is played carries the
+   codec's artifacts and delay.
+
+   The caller's periods and the Opus frame size are independent. Input
+   collects into one Opus frame; every completed frame is encoded,
+   decoded and queued for output, and the output starts primed with just
+   enough silence that every period can be answered in full. Everything
+   is allocated in the constructor, so degrade() can run on a real-time
+   audio thread. */
+class OpusDegrader
+{
+public:
+  struct Parameters
+  {
+    unsigned int sample_rate { 48000 };
+    unsigned int channels { 2 };
+    unsigned int bitrate { 64000 };
+
+    /* 2.5, 5, 10, 20, 40 or 60 ms */
+    double frame_ms { 20 };
+
+    /* 0 (fastest) to 10 (best) */
+    unsigned int complexity { 10 };
+  };
+
+private:
+  Parameters parameters_;
+  size_t frame_samples_;
+  size_t period_samples_;
+  size_t sample_size_;
+
+  OpusEncoder * encoder_ { nullptr };
+  OpusDecoder * decoder_ { nullptr };
+
+  /* one Opus frame: what has been collected so far, and its encoding */
+  std::vector<int16_t> input_frame_;
+  size_t input_samples_ { 0 };
+  std::vector<uint8_t> packet_;
+  std::vector<int16_t> output_frame_;
+
+  /* decoded audio waiting to be returned */
+  ByteRing output_;
+
+  size_t priming_samples_;
+  opus_int32 lookahead_samples_ { 0 };
+
+  std::atomic<uint64_t> frames_ { 0 };
+  std::atomic<uint64_t> encoded_bytes_ { 0 };
+  std::atomic<uint64_t> cpu_ns_ { 0 };
+  std::atomic<uint64_t> max_cpu_ns_ { 0 };
+  std::atomic<uint64_t> last_cpu_ns_ { 0 };
+  std::atomic<uint64_t> last_frame_size_ { 0 };
+
+  void process_frame( void );
+
+public:
+  /* `period_samples` is the number of samples (per channel) in each degrade() call */
+  OpusDegrader( const Parameters & parameters, const size_t period_samples );
+  ~OpusDegrader();
+
+  /* encodes and decodes one period; `input` and `output` may be the same buffer */
+  void degrade( const uint8_t * input, uint8_t * output, const size_t size );
+
+  /* microseconds from a sample entering degrade() to it leaving: the
+     priming silence plus the encoder's lookahead */
+  uint64_t latency( void ) const;
+
+  const Parameters & parameters( void ) const { return parameters_; }
+  size_t frame_samples( void ) const { return frame_samples_; }
+
+  /* per Opus frame, safe to read from other threads */
+  uint64_t frames( void ) const { return frames_.load( std::memory_order_relaxed ); }
+  uint64_t last_frame_size( void ) const { return last_frame_size_.load( std::memory_order_relaxed ); }
+  uint64_t last_cpu_ns( void ) const { return last_cpu_ns_.load( std::memory_order_relaxed ); }
+  uint64_t max_cpu_ns( void ) const { return max_cpu_ns_.load( std::memory_order_relaxed ); }
+  double mean_cpu_ns( void ) const;
+
+  /* bits per second actually produced so far */
+  double encoded_bitrate( void ) const;
+
+  /* everything besides the input that determines the decoded output */
+  std::string parameter_string( void ) const;
+
+  OpusDegrader( const OpusDegrader & other ) = delete;
+  OpusDegrader & operator=( const OpusDegrader & other ) = delete;
+};
+
+#endif /* OPUS_DEGRADER_HH */
@@ -0,0 +1,257 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#include "compositor.hh"
+#include "exception.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+static unsigned int grid_columns( const unsigned int streams )
+{
+  if ( streams == 0 ) {
+    throw Invalid( "compositor needs at least one stream" );
+  }
+
+  return ceil( sqrt( streams ) );
+}
+
+static size_t staging_size( const BaseRaster & raster, const unsigned int streams )
+{
+  return streams * ( size_t( raster.Y().stride() ) * raster.Y().height()
+                     + size_t( raster.U().stride() ) * raster.U().height()
+                     + size_t( raster.V().stride() ) * raster.V().height() );
+}
+
+/* two triangles per cell from gl_VertexID, one cell per instance; the
+   stream's layer is the instance number */
+const string VideoCompositor::shader_source_grid
+= R"( #version 140
+
+      uniform uvec2 grid_size;
+      uniform vec2 cell_size;
+
+      out vec2 position;
+      flat out int layer;
+
+      void main()
+      {
+        vec2 corner = vec2( gl_VertexID & 1, gl_VertexID >> 1 );
+        vec2 cell = vec2( gl_InstanceID % int( grid_size.x ), gl_InstanceID / int( grid_size.x ) );
+        vec2 grid_position = ( cell + corner ) / vec2( grid_size );
+
+        gl_Position = vec4( 2 * grid_position.x - 1.0, 1.0 - 2 * grid_position.y, 0.0, 1.0 );
+        position = corner * cell_size;
+        layer = gl_InstanceID;
+      }
+    )";
+
+/* same chroma siting as VideoDisplay: a quarter luma pixel to the right */
+string VideoCompositor::shader_source_ycbcr_array( void )
+{
+  return R"( #version 140
+
+      precision mediump float;
+
+      uniform sampler2DArray yTex;
+      uniform sampler2DArray uTex;
+      uniform sampler2DArray vTex;
+
+      uniform vec2 luma_size;
+      uniform vec2 chroma_size;
+
+      in vec2 position;
+      flat in int layer;
+      out vec4 outColor;
+    )" + VideoDisplay::shader_source_ycbcr_to_rgb + R"(
+      void main()
+      {
+        vec3 luma = vec3( position / luma_size, layer );
+        vec3 chroma = vec3( vec2( position.x / 2 + 0.25, position.y / 2 ) / chroma_size, layer );
+
+        outColor = ycbcr_to_rgb( texture(yTex, luma).x,
+                                 texture(uTex, chroma).x,
+                                 texture(vTex, chroma).x );
+      }
+    )";
+}
+
+VideoCompositor::VideoCompositor( const BaseRaster & raster, const unsigned int streams,
+                                  const bool fullscreen )
+  : streams_( streams ),
+    columns_( grid_columns( streams ) ),
+    rows_( ( streams + columns_ - 1 ) / columns_ ),
+    display_width_( raster.display_width() ),
+    display_height_( raster.display_height() ),
+    current_context_( columns_ * display_width_, rows_ * display_height_,
+                      "Video Compositor", fullscreen ),
+    Y_( raster.Y().width(), raster.Y().height(), streams ),
+    U_( raster.U().width(), raster.U().height(), streams ),
+    V_( raster.V().width(), raster.V().height(), streams ),
+    unpack_ring_( staging_size( raster, streams ) )
+{
+  initialize( raster );
+}
+
+VideoCompositor::VideoCompositor( const BaseRaster & raster, const unsigned int streams,
+                                  const VideoDisplay::Headless )
+  : streams_( streams ),
+    columns_( grid_columns( streams ) ),
+    rows_( ( streams + columns_ - 1 ) / columns_ ),
+    display_width_( raster.display_width() ),
+    display_height_( raster.display_height() ),
+    current_context_( columns_ * display_width_, rows_ * display_height_ ),
+    Y_( raster.Y().width(), raster.Y().height(), streams ),
+    U_( raster.U().width(), raster.U().height(), streams ),
+    V_( raster.V().width(), raster.V().height(), streams ),
+    unpack_ring_( staging_size( raster, streams ) )
+{
+  initialize( raster );
+}
+
+void VideoCompositor::initialize( const BaseRaster & raster )
+{
+  staged_.reserve( 3 * streams_ );
+
+  program_.attach( grid_shader_ );
+  program_.attach( ycbcr_shader_ );
+  program_.link();
+  glCheck( "after linking compositor program" );
+
+  /* streams that have not sent anything yet show black */
+  glActiveTexture( GL_TEXTURE4 );
+  Y_.fill( 16 );
+  U_.fill( 128 );
+  V_.fill( 128 );
+
+  Y_.bind( GL_TEXTURE0 );
+  U_.bind( GL_TEXTURE1 );
+  V_.bind( GL_TEXTURE2 );
+
+  program_.use();
+  glUniform1i( program_.uniform_location( "yTex" ), 0 );
+  glUniform1i( program_.uniform_location( "uTex" ), 1 );
+  glUniform1i( program_.uniform_location( "vTex" ), 2 );
+  glUniform2ui( program_.uniform_location( "grid_size" ), columns_, rows_ );
+  glUniform2f( program_.uniform_location( "cell_size" ), display_width_, display_height_ );
+  glUniform2f( program_.uniform_location( "luma_size" ), raster.Y().width(), raster.Y().height() );
+  glUniform2f( program_.uniform_location( "chroma_size" ), raster.U().width(), raster.U().height() );
+
+  resize( current_context_.size() );
+
+  glCheck( "" );
+}
+
+void VideoCompositor::resize( const pair<unsigned int, unsigned int> & target_size )
+{
+  /* cells scale with the window; the grid always covers all of it */
+  glViewport( 0, 0, target_size.first, target_size.second );
+}
+
+const Window & VideoCompositor::window( void ) const
+{
+  if ( not current_context_.window_ ) {
+    throw runtime_error( "headless compositor has no window" );
+  }
+
+  return *current_context_.window_;
+}
+
+/* stages every new frame in one unpack slot, then loads the layers from it */
+void VideoCompositor::upload( const vector<const BaseRaster *> & frames )
+{
+  /* TextureArray::load*() binds on the active unit, so keep that off the units the shader samples */
+  glActiveTexture( GL_TEXTURE4 );
+
+  staged_.clear();
+  uint8_t * staging = nullptr;
+  size_t offset = 0;
+
+  for ( unsigned int stream = 0; stream < streams_; stream++ ) {
+    const BaseRaster * frame = frames[ stream ];
+
+    if ( frame == nullptr ) {
+      skipped_frames_++;
+      continue;
+    }
+
+    if ( frame->Y().width() != Y_.size().first or frame->Y().height() != Y_.size().second ) {
+      throw Invalid( "inconsistent raster dimensions." );
+    }
+
+    if ( staging == nullptr ) {
+      staging = unpack_ring_.acquire();
+    }
+
+    for ( auto plane : { make_pair( &Y_, &frame->Y() ),
+                         make_pair( &U_, &frame->U() ),
+                         make_pair( &V_, &frame->V() ) } ) {
+      const size_t length = plane.second->stride() * plane.second->height();
+      memcpy( staging + offset, &plane.second->at( 0, 0 ), length );
+      staged_.push_back( { plane.first, stream, offset, plane.second->stride() } );
+      offset += length;
+    }
+
+    uploaded_frames_++;
+  }
+
+  if ( staging == nullptr ) {
+    return;
+  }
+
+  unpack_ring_.commit();
+
+  for ( const auto & plane : staged_ ) {
+    plane.texture->load_layer_from_unpack_buffer( plane.layer, plane.offset, plane.stride );
+  }
+
+  unpack_ring_.fence();
+}
+
+void VideoCompositor::draw( const vector<const BaseRaster *> & frames )
+{
+  if ( frames.size() != streams_ ) {
+    throw Invalid( "compositor needs one entry per stream" );
+  }
+
+  const auto upload_start = steady_clock::now();
+  upload( frames );
+
+  const auto draw_start = steady_clock::now();
+  repaint();
+  const auto draw_end = steady_clock::now();
+
+  last_upload_time_ = draw_start - upload_start;
+  last_draw_time_ = draw_end - draw_start;
+}
+
+void VideoCompositor::paint( void )
+{
+  if ( rows_ * columns_ > streams_ ) {
+    /* the unused cells at the end of the last row */
+    glClearColor( 0, 0, 0, 1 );
+    glClear( GL_COLOR_BUFFER_BIT );
+  }
+
+  program_.use();
+  vertex_array_object_.bind();
+  glDrawArraysInstanced( GL_TRIANGLE_STRIP, 0, 4, streams_ );
+}
+
+void VideoCompositor::repaint( void )
+{
+  paint();
+  current_context_.present();
+}
+
+void VideoCompositor::read_pixels( vector<uint8_t> & rgba ) const
+{
+  if ( not current_context_.framebuffer_ ) {
+    throw runtime_error( "read_pixels needs a headless compositor" );
+  }
+
+  current_context_.framebuffer_->read_pixels( rgba );
+}
@@ -0,0 +1,100 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef COMPOSITOR_HH
+#define COMPOSITOR_HH
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "raster.hh"
+#include "gl_objects.hh"
+#include "display.hh"
+
+/* Shows N same-sized video streams side by side in one window, laid
+   out in a grid as close to square as possible. Each plane of every
+   stream is one layer of a texture array, so a frame of the whole grid
+   is one instanced draw and one swap, however many streams there are.
+   Streams without a new frame keep their layer as it was and cost no
+   upload. */
+class VideoCompositor
+{
+private:
+  static const std::string shader_source_grid;
+  static std::string shader_source_ycbcr_array( void );
+
+  unsigned int streams_, columns_, rows_;
+  unsigned int display_width_, display_height_;
+
+  RenderContext current_context_;
+
+  VertexShader grid_shader_ = { shader_source_grid };
+  FragmentShader ycbcr_shader_ = { shader_source_ycbcr_array() };
+  Program program_ = {};
+
+  TextureArray Y_, U_, V_;
+
+  PixelUnpackRing unpack_ring_;
+
+  /* where each plane of this frame's uploads was staged; a member, reserved
+     for every plane of every stream, so that uploading allocates nothing */
+  struct Staged
+  {
+    TextureArray * texture;
+    unsigned int layer;
+    size_t offset;
+    unsigned int stride;
+  };
+
+  std::vector<Staged> staged_ {};
+
+  /* the grid is generated from gl_VertexID and gl_InstanceID, so no vertex data */
+  VertexArrayObject vertex_array_object_ = {};
+
+  uint64_t uploaded_frames_ { 0 };
+  uint64_t skipped_frames_ { 0 };
+
+  std::chrono::duration<double> last_upload_time_ {};
+  std::chrono::duration<double> last_draw_time_ {};
+
+  void initialize( const BaseRaster & raster );
+  void upload( const std::vector<const BaseRaster *> & frames );
+  void paint( void );
+
+public:
+  /* `raster` gives the dimensions shared by all the streams */
+  VideoCompositor( const BaseRaster & raster, const unsigned int streams,
+                   const bool fullscreen = false );
+  VideoCompositor( const BaseRaster & raster, const unsigned int streams,
+                   const VideoDisplay::Headless );
+
+  VideoCompositor( const VideoCompositor & other ) = delete;
+  VideoCompositor & operator=( const VideoCompositor & other ) = delete;
+
+  /* one entry per stream; nullptr means the stream has no new frame and
+     keeps showing its last one */
+  void draw( const std::vector<const BaseRaster *> & frames );
+  void repaint( void );
+  void resize( const std::pair<unsigned int, unsigned int> & target_size );
+
+  unsigned int streams( void ) const { return streams_; }
+  unsigned int columns( void ) const { return columns_; }
+  unsigned int rows( void ) const { return rows_; }
+
+  bool headless( void ) const { return current_context_.framebuffer_ != nullptr; }
+  const Window & window( void ) const;
+
+  /* headless only: the last repainted image as RGBA rows, top row first */
+  void read_pixels( std::vector<uint8_t> & rgba ) const;
+
+  /* stream frames uploaded, and stream frames skipped for having nothing new */
+  uint64_t uploaded_frames( void ) const { return uploaded_frames_; }
+  uint64_t skipped_frames( void ) const { return skipped_frames_; }
+
+  /* CPU time of the last draw call: staging and issuing the uploads, then repainting */
+  std::chrono::duration<double> last_upload_time( void ) const { return last_upload_time_; }
+  std::chrono::duration<double> last_draw_time( void ) const { return last_draw_time_; }
+};
+
+#endif /* COMPOSITOR_HH */
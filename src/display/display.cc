@@ -1,15 +1,28 @@
 /* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
 
+#include <cmath>
+#include <tuple>
+
 #include "exception.hh"
+#include "timestamp.hh"
 #include "display.hh"
 
 using namespace std;
+using namespace std::chrono;
+
+/* staging for the largest layout (4:2:2 chroma is as big as luma), rows at full stride */
+static size_t staging_size( const BaseRaster & raster )
+{
+  return 2 * raster.Y().stride() * raster.Y().height();
+}
 
 const string VideoDisplay::shader_source_scale_from_pixel_coordinates
 = R"( #version 130
 
       uniform uvec2 window_size;
 
+      uniform float chroma_vertical_scale;
+
       in vec2 position;
       in vec2 chroma_texcoord;
       out vec2 raw_position;
@@ -20,7 +33,7 @@ const string VideoDisplay::shader_source_scale_from_pixel_coordinates
         gl_Position = vec4( 2 * position.x / window_size.x - 1.0,
                             1.0 - 2 * position.y / window_size.y, 0.0, 1.0 );
         raw_position = vec2( position.x, position.y );
-        uv_texcoord = vec2( chroma_texcoord.x, chroma_texcoord.y );
+        uv_texcoord = vec2( chroma_texcoord.x, chroma_texcoord.y * chroma_vertical_scale );
       }
     )";
 
@@ -37,90 +50,170 @@ ans =
       1.16438356164384  -0.00105499970680283      1.59567019581339
 */
 
-const string VideoDisplay::shader_source_ycbcr
+const string VideoDisplay::shader_source_ycbcr_to_rgb
+= R"(
+      vec4 ycbcr_to_rgb( float fY, float fCb, float fCr )
+      {
+        return vec4(
+          max(0, min(1.0, 1.16438356164384 * (fY - 0.06274509803921568627) + 1.59567019581339  * (fCr - 0.50196078431372549019))),
+          max(0, min(1.0, 1.16438356164384 * (fY - 0.06274509803921568627) - 0.391260370716072 * (fCb - 0.50196078431372549019) - 0.813004933873461 * (fCr - 0.50196078431372549019))),
+          max(0, min(1.0, 1.16438356164384 * (fY - 0.06274509803921568627) + 2.01741475897078  * (fCb - 0.50196078431372549019))),
+          1.0
+        );
+      }
+    )";
+
+static const string shader_source_ycbcr_header
 = R"( #version 130
       #extension GL_ARB_texture_rectangle : enable
 
       precision mediump float;
 
       uniform sampler2DRect yTex;
-      uniform sampler2DRect uTex;
-      uniform sampler2DRect vTex;
 
       in vec2 uv_texcoord;
       in vec2 raw_position;
       out vec4 outColor;
+    )" + VideoDisplay::shader_source_ycbcr_to_rgb;
+
+/* planar chroma (4:2:0 or 4:2:2, depending on chroma_vertical_scale) */
+const string VideoDisplay::shader_source_ycbcr
+= shader_source_ycbcr_header + R"(
+      uniform sampler2DRect uTex;
+      uniform sampler2DRect vTex;
 
       void main()
       {
-        float fY = texture(yTex, raw_position).x;
-        float fCb = texture(uTex, uv_texcoord).x;
-        float fCr = texture(vTex, uv_texcoord).x;
+        outColor = ycbcr_to_rgb( texture(yTex, raw_position).x,
+                                 texture(uTex, uv_texcoord).x,
+                                 texture(vTex, uv_texcoord).x );
+      }
+    )";
 
-        outColor = vec4(
-          max(0, min(1.0, 1.16438356164384 * (fY - 0.06274509803921568627) + 1.59567019581339  * (fCr - 0.50196078431372549019))),
-          max(0, min(1.0, 1.16438356164384 * (fY - 0.06274509803921568627) - 0.391260370716072 * (fCb - 0.50196078431372549019) - 0.813004933873461 * (fCr - 0.50196078431372549019))),
-          max(0, min(1.0, 1.16438356164384 * (fY - 0.06274509803921568627) + 2.01741475897078  * (fCb - 0.50196078431372549019))),
-          1.0
-        );
+/* NV12: Cb and Cr interleaved in one two-channel texture */
+const string VideoDisplay::shader_source_ycbcr_nv12
+= shader_source_ycbcr_header + R"(
+      uniform sampler2DRect uvTex;
+
+      void main()
+      {
+        vec2 fCbCr = texture(uvTex, uv_texcoord).xy;
+        outColor = ycbcr_to_rgb( texture(yTex, raw_position).x, fCbCr.x, fCbCr.y );
       }
     )";
 
-VideoDisplay::CurrentContextWindow::CurrentContextWindow( const unsigned int width,
-  const unsigned int height, const string & title, const bool fullscreen )
-  : window_( width, height, title, fullscreen )
+VideoDisplay::VideoDisplay( const BaseRaster & raster, const bool fullscreen )
+  : display_width_( raster.display_width() ),
+    display_height_( raster.display_height() ),
+    width_( raster.width() ),
+    height_( raster.height() ),
+    current_context_( display_width_, display_height_, "VP8 Player", fullscreen ),
+    Y_ ( width_, height_),
+    U_ ( width_ / 2, height_ / 2 ),
+    V_ ( width_ / 2, height_ / 2 ),
+    UV_ ( width_ / 2, height_ / 2, GL_RG8 ),
+    unpack_ring_( staging_size( raster ) ),
+    tile_map_( width_, height_ )
 {
-  window_.make_context_current( true );
+  initialize();
 }
 
-VideoDisplay::VideoDisplay( const BaseRaster & raster, const bool fullscreen )
+VideoDisplay::VideoDisplay( const BaseRaster & raster, const Headless )
   : display_width_( raster.display_width() ),
     display_height_( raster.display_height() ),
     width_( raster.width() ),
     height_( raster.height() ),
-    current_context_window_( display_width_, display_height_, "VP8 Player", fullscreen ),
+    current_context_( display_width_, display_height_ ),
     Y_ ( width_, height_),
     U_ ( width_ / 2, height_ / 2 ),
-    V_ ( width_ / 2, height_ / 2 )
+    V_ ( width_ / 2, height_ / 2 ),
+    UV_ ( width_ / 2, height_ / 2, GL_RG8 ),
+    unpack_ring_( staging_size( raster ) ),
+    tile_map_( width_, height_ )
 {
-  texture_shader_program_.attach( scale_from_pixel_coordinates_ );
+  initialize();
+}
+
+void VideoDisplay::initialize( void )
+{
+  /* both programs share the vertex shader, so pin its inputs to the same slots */
+  for ( Program * program : { &texture_shader_program_, &nv12_shader_program_ } ) {
+    program->attach( scale_from_pixel_coordinates_ );
+    program->bind_attribute_location( 0, "position" );
+    program->bind_attribute_location( 1, "chroma_texcoord" );
+  }
+
   texture_shader_program_.attach( ycbcr_shader_ );
   texture_shader_program_.link();
-  glCheck( "after linking texture shader program" );
+  nv12_shader_program_.attach( ycbcr_nv12_shader_ );
+  nv12_shader_program_.link();
+  glCheck( "after linking texture shader programs" );
 
   texture_shader_array_object_.bind();
   ArrayBuffer::bind( screen_corners_ );
-  glVertexAttribPointer( texture_shader_program_.attribute_location( "position" ),
-    2, GL_FLOAT, GL_FALSE, sizeof( VertexObject ), 0 );
-  glEnableVertexAttribArray( texture_shader_program_.attribute_location( "position" ) );
+  glVertexAttribPointer( 0, 2, GL_FLOAT, GL_FALSE, sizeof( VertexObject ), 0 );
+  glEnableVertexAttribArray( 0 );
 
-  glVertexAttribPointer( texture_shader_program_.attribute_location( "chroma_texcoord" ),
-    2, GL_FLOAT, GL_FALSE, sizeof( VertexObject ), (const void *)( 2 * sizeof( float ) ) );
-  glEnableVertexAttribArray( texture_shader_program_.attribute_location( "chroma_texcoord" ) );
+  glVertexAttribPointer( 1, 2, GL_FLOAT, GL_FALSE, sizeof( VertexObject ),
+                         (const void *)( 2 * sizeof( float ) ) );
+  glEnableVertexAttribArray( 1 );
 
-  glfwSwapInterval(1);
+  planes_.reserve( 3 );
+  staged_offsets_.reserve( 3 );
+  staged_regions_.reserve( 3 * tile_map_.tile_count() );
 
   Y_.bind( GL_TEXTURE0 );
   U_.bind( GL_TEXTURE1 );
   V_.bind( GL_TEXTURE2 );
+  UV_.bind( GL_TEXTURE3 );
+
+  resize( current_context_.size() );
+
+  /* GPU time is the difference of two GL_TIMESTAMP queries rather than a
+     GL_TIME_ELAPSED query, which some drivers (llvmpipe) get wrong; both
+     come with ARB_timer_query, core in 3.3 */
+  timer_queries_ = GLEW_ARB_timer_query;
 
-  const pair<unsigned int, unsigned int> window_size = window().size();
-  resize( window_size );
+  if ( current_context_.window_ ) {
+    refresh_interval_ = current_context_.window_->refresh_interval();
+
+    try {
+      present_monitor_.reset( new PresentMonitor( x11_window( current_context_.window_->handle() ) ) );
+    } catch ( const exception & ) {
+      /* not on X, or no Present: time presents by the swap returning */
+    }
+  }
 
   glCheck( "" );
 }
 
+VideoDisplay::~VideoDisplay()
+{
+  if ( not queries_.empty() ) {
+    glDeleteQueries( queries_.size(), queries_.data() );
+  }
+}
+
 void VideoDisplay::resize( const pair<unsigned int, unsigned int> & target_size )
 {
   glViewport( 0, 0, target_size.first, target_size.second );
 
+  for ( Program * program : { &texture_shader_program_, &nv12_shader_program_ } ) {
+    program->use();
+    glUniform2ui( program->uniform_location( "window_size" ),
+                  target_size.first, target_size.second );
+    glUniform1i( program->uniform_location( "yTex" ), 0 );
+  }
+
   texture_shader_program_.use();
-  glUniform2ui( texture_shader_program_.uniform_location( "window_size" ),
-                target_size.first, target_size.second );
+  glUniform1i( texture_shader_program_.uniform_location( "uTex" ), 1 );
+  glUniform1i( texture_shader_program_.uniform_location( "vTex" ), 2 );
+  glUniform1f( texture_shader_program_.uniform_location( "chroma_vertical_scale" ),
+               layout_ == ChromaLayout::I422 ? 2.0 : 1.0 );
 
-  glUniform1i( texture_shader_program_.uniform_location( "yTex" ), 0);
-  glUniform1i( texture_shader_program_.uniform_location( "uTex" ), 1);
-  glUniform1i( texture_shader_program_.uniform_location( "vTex" ), 2);
+  nv12_shader_program_.use();
+  glUniform1i( nv12_shader_program_.uniform_location( "uvTex" ), 3 );
+  glUniform1f( nv12_shader_program_.uniform_location( "chroma_vertical_scale" ), 1.0 );
 
   const float xoffset = 0.25;
 
@@ -141,22 +234,205 @@ void VideoDisplay::resize( const pair<unsigned int, unsigned int> & target_size
   glCheck( "after resizing ");
 }
 
+Program & VideoDisplay::active_program( void )
+{
+  return layout_ == ChromaLayout::NV12 ? nv12_shader_program_ : texture_shader_program_;
+}
+
+void VideoDisplay::set_layout( const ChromaLayout layout )
+{
+  if ( layout == layout_ ) {
+    return;
+  }
+
+  const unsigned int chroma_height = layout == ChromaLayout::I422 ? height_ : height_ / 2;
+
+  if ( layout != ChromaLayout::NV12 and U_.size().second != chroma_height ) {
+    glActiveTexture( GL_TEXTURE1 );
+    U_.resize( width_ / 2, chroma_height );
+    glActiveTexture( GL_TEXTURE2 );
+    V_.resize( width_ / 2, chroma_height );
+  }
+
+  layout_ = layout;
+
+  texture_shader_program_.use();
+  glUniform1f( texture_shader_program_.uniform_location( "chroma_vertical_scale" ),
+               layout_ == ChromaLayout::I422 ? 2.0 : 1.0 );
+}
+
+/* the part of a plane covering a luma region; chroma planes are half size */
+static TileChangeMap::Region plane_region( const TileChangeMap::Region & luma, const TwoD<uint8_t> & plane,
+                                           const bool subsampled )
+{
+  if ( not subsampled ) {
+    return luma;
+  }
+
+  const unsigned int x = luma.x / 2, y = luma.y / 2;
+  return { x, y,
+           min( ( luma.x + luma.width + 1 ) / 2, plane.width() ) - x,
+           min( ( luma.y + luma.height + 1 ) / 2, plane.height() ) - y };
+}
+
+/* Stages planes_ (or just the given regions of them) in the unpack
+   ring and uploads them, or uploads directly if they don't fit. Returns
+   the bytes of sample data uploaded, not counting row padding, whichever
+   path is taken. */
+size_t VideoDisplay::upload( const vector<TileChangeMap::Region> * regions )
+{
+  /* Texture::load*() binds on the active unit, so keep that off the units the shaders sample */
+  glActiveTexture( GL_TEXTURE4 );
+
+  if ( regions ) {
+    if ( regions->empty() ) {
+      return 0;
+    }
+
+    /* regions are staged packed, so they always fit where the whole planes do */
+    uint8_t * staging = unpack_ring_.acquire();
+    staged_regions_.clear();
+    size_t offset = 0;
+
+    for ( const auto & luma : *regions ) {
+      for ( const auto & plane : planes_ ) {
+        const TileChangeMap::Region region = plane_region( luma, *plane.second, plane.first != &Y_ );
+
+        for ( unsigned int row = 0; row < region.height; row++ ) {
+          memcpy( staging + offset + row * region.width,
+                  &plane.second->at( region.x, region.y + row ), region.width );
+        }
+
+        staged_regions_.emplace_back( plane.first, region, offset );
+        offset += region.width * region.height;
+      }
+    }
+
+    unpack_ring_.commit();
+
+    for ( const auto & plane : staged_regions_ ) {
+      const TileChangeMap::Region & region = get<1>( plane );
+      get<0>( plane )->load_region_from_unpack_buffer( region.x, region.y, region.width, region.height,
+                                                       get<2>( plane ), region.width );
+    }
+
+    unpack_ring_.fence();
+    return offset;
+  }
+
+  /* the planes are 8-bit, so a row of width() samples is width() bytes, as in the regions above */
+  size_t total = 0, bytes = 0;
+  for ( const auto & plane : planes_ ) {
+    total += plane.second->stride() * plane.second->height();
+    bytes += plane.second->width() * plane.second->height();
+  }
+
+  if ( total > unpack_ring_.slot_size() ) {
+    for ( const auto & plane : planes_ ) {
+      plane.first->load( *plane.second );
+    }
+    return bytes;
+  }
+
+  uint8_t * staging = unpack_ring_.acquire();
+  staged_offsets_.clear();
+  size_t offset = 0;
+
+  for ( const auto & plane : planes_ ) {
+    const size_t length = plane.second->stride() * plane.second->height();
+    memcpy( staging + offset, &plane.second->at( 0, 0 ), length );
+    staged_offsets_.push_back( offset );
+    offset += length;
+  }
+
+  unpack_ring_.commit();
+
+  for ( size_t i = 0; i < planes_.size(); i++ ) {
+    planes_[ i ].first->load_from_unpack_buffer( staged_offsets_[ i ], planes_[ i ].second->stride() );
+  }
+
+  unpack_ring_.fence();
+  return bytes;
+}
+
+void VideoDisplay::draw_planes( const ChromaLayout layout,
+                                const int64_t capture_timestamp,
+                                const TileChangeMap * tiles )
+{
+  const auto upload_start = steady_clock::now();
+  begin_gpu_timing();
+
+  set_layout( layout );
+
+  /* a full frame of dirty tiles goes up in one piece per plane */
+  const bool partial = tiles and tiles->dirty_count() < tiles->tile_count();
+  last_uploaded_bytes_ = upload( partial ? &tiles->dirty_regions() : nullptr );
+
+  const auto draw_start = steady_clock::now();
+  paint();
+  end_gpu_timing();
+
+  FrameTiming timing;
+  timing.capture_timestamp = capture_timestamp;
+  timing.upload_time = duration<double>( draw_start - upload_start ).count();
+  timing.uploaded_bytes = last_uploaded_bytes_;
+  if ( tiles ) {
+    timing.tiles = tiles->tile_count();
+    timing.clean_tiles = tiles->tile_count() - tiles->dirty_count();
+  }
+  present( true, timing );
+
+  const auto draw_end = steady_clock::now();
+
+  last_upload_time_ = draw_start - upload_start;
+  last_draw_time_ = draw_end - draw_start;
+}
+
 void VideoDisplay::draw( const BaseRaster & raster )
 {
   if ( width_ != raster.width() or height_ != raster.height() ) {
     throw Invalid( "inconsistent raster dimensions." );
   }
 
-  Y_.load( raster.Y() );
-  U_.load( raster.U() );
-  V_.load( raster.V() );
+  /* the other layouts overwrite the textures behind the tile map's back */
+  if ( layout_ != ChromaLayout::I420 ) {
+    tile_map_.invalidate();
+  }
+
+  tile_map_.update( raster );
 
-  repaint();
+  planes_.assign( { { &Y_, &raster.Y() }, { &U_, &raster.U() }, { &V_, &raster.V() } } );
+  draw_planes( ChromaLayout::I420, raster.capture_timestamp(), &tile_map_ );
 }
 
-void VideoDisplay::repaint( void )
+void VideoDisplay::draw_nv12( const TwoD<uint8_t> & Y, const TwoD<uint8_t> & UV,
+                              const int64_t capture_timestamp )
+{
+  if ( Y.width() != width_ or Y.height() != height_
+       or UV.width() != width_ or UV.height() != height_ / 2 ) {
+    throw Invalid( "inconsistent NV12 plane dimensions." );
+  }
+
+  planes_.assign( { { &Y_, &Y }, { &UV_, &UV } } );
+  draw_planes( ChromaLayout::NV12, capture_timestamp );
+}
+
+void VideoDisplay::draw_i422( const TwoD<uint8_t> & Y, const TwoD<uint8_t> & U, const TwoD<uint8_t> & V,
+                              const int64_t capture_timestamp )
+{
+  if ( Y.width() != width_ or Y.height() != height_
+       or U.width() != width_ / 2 or U.height() != height_
+       or V.width() != width_ / 2 or V.height() != height_ ) {
+    throw Invalid( "inconsistent 4:2:2 plane dimensions." );
+  }
+
+  planes_.assign( { { &Y_, &Y }, { &U_, &U }, { &V_, &V } } );
+  draw_planes( ChromaLayout::I422, capture_timestamp );
+}
+
+void VideoDisplay::paint( void )
 {
-  pair<unsigned int, unsigned int> window_size = current_context_window_.window_.window_size();
+  pair<unsigned int, unsigned int> window_size = current_context_.window_size();
 
   if ( window_size.first != display_width_ or window_size.second != display_height_ ) {
     display_width_ = window_size.first;
@@ -166,8 +442,177 @@ void VideoDisplay::repaint( void )
 
   ArrayBuffer::bind( screen_corners_ );
   texture_shader_array_object_.bind();
-  texture_shader_program_.use();
+  active_program().use();
   glDrawArrays( GL_TRIANGLE_FAN, 0, 4 );
-  glfwPollEvents();
-  current_context_window_.window_.swap_buffers();
+}
+
+void VideoDisplay::repaint( void )
+{
+  paint();
+  present( false, FrameTiming() );
+}
+
+void VideoDisplay::begin_gpu_timing( void )
+{
+  if ( not timer_queries_ ) {
+    return;
+  }
+
+  /* results come back a frame or two later, so keep a small pool in flight */
+  static constexpr size_t MAX_QUERIES = 32;
+
+  while ( idle_queries_.size() < 2 ) {
+    if ( queries_.size() >= MAX_QUERIES ) {
+      return;
+    }
+
+    GLuint query;
+    glGenQueries( 1, &query );
+    queries_.push_back( query );
+    idle_queries_.push_back( query );
+  }
+
+  active_begin_query_ = idle_queries_.back();
+  idle_queries_.pop_back();
+  active_end_query_ = idle_queries_.back();
+  idle_queries_.pop_back();
+
+  glQueryCounter( active_begin_query_, GL_TIMESTAMP );
+}
+
+void VideoDisplay::end_gpu_timing( void )
+{
+  if ( active_end_query_ ) {
+    glQueryCounter( active_end_query_, GL_TIMESTAMP );
+  }
+}
+
+void VideoDisplay::present( const bool frame, const FrameTiming & timing )
+{
+  current_context_.present();
+
+  pending_presents_.push_back( { timing, monotonic_timestamp_us(),
+                                 active_begin_query_, active_end_query_, frame } );
+  active_begin_query_ = active_end_query_ = 0;
+
+  collect_timings();
+}
+
+void VideoDisplay::collect_timings( void )
+{
+  /* completions arrive in present order; hand them to the oldest unmatched swaps */
+  if ( present_monitor_ ) {
+    PresentMonitor::Completion completion;
+
+    for ( PendingPresent & pending : pending_presents_ ) {
+      if ( pending.timing.present_from_server ) {
+        continue;
+      }
+
+      if ( not present_monitor_->poll( completion ) ) {
+        break;
+      }
+
+      pending.timing.present_timestamp = completion.ust;
+      pending.timing.msc = completion.msc;
+      pending.timing.present_from_server = true;
+    }
+
+    /* swaps that never produce completions don't go through Present (e.g. a
+       driver presenting on its own); stop waiting and use the swap times */
+    static constexpr size_t MAX_UNMATCHED = 8;
+
+    if ( pending_presents_.size() > MAX_UNMATCHED
+         and not pending_presents_.front().timing.present_from_server ) {
+      present_monitor_.reset();
+    }
+  }
+
+  while ( not pending_presents_.empty() ) {
+    PendingPresent & pending = pending_presents_.front();
+    FrameTiming & timing = pending.timing;
+
+    if ( present_monitor_ and not timing.present_from_server ) {
+      break;
+    }
+
+    if ( pending.end_query ) {
+      /* the later query being ready implies the earlier one is */
+      GLint available = 0;
+      glGetQueryObjectiv( pending.end_query, GL_QUERY_RESULT_AVAILABLE, &available );
+      if ( not available ) {
+        break;
+      }
+
+      GLuint64 begin = 0, end = 0;
+      glGetQueryObjectui64v( pending.begin_query, GL_QUERY_RESULT, &begin );
+      glGetQueryObjectui64v( pending.end_query, GL_QUERY_RESULT, &end );
+      timing.gpu_time = ( end - begin ) / 1e9;
+      idle_queries_.push_back( pending.begin_query );
+      idle_queries_.push_back( pending.end_query );
+    }
+
+    if ( not timing.present_from_server ) {
+      timing.present_timestamp = pending.swap_timestamp;
+    }
+
+    /* with a swap interval of 1, consecutive presents should be one vblank apart */
+    unsigned int missed = 0;
+    if ( timing.msc and last_msc_ ) {
+      missed = timing.msc > last_msc_ + 1 ? timing.msc - last_msc_ - 1 : 0;
+    } else if ( not timing.present_from_server and refresh_interval_ > 0 and last_present_timestamp_ ) {
+      const double intervals = ( timing.present_timestamp - last_present_timestamp_ ) / 1e6 / refresh_interval_;
+      missed = intervals > 1.5 ? lrint( intervals ) - 1 : 0;
+    }
+
+    last_msc_ = timing.msc;
+    last_present_timestamp_ = timing.present_timestamp;
+    missed_vsyncs_ += missed;
+    unreported_missed_vsyncs_ += missed;
+
+    if ( pending.frame ) {
+      timing.missed_vsyncs = unreported_missed_vsyncs_;
+      unreported_missed_vsyncs_ = 0;
+
+      /* nobody may be reading these; keep the most recent ones */
+      static constexpr size_t MAX_COMPLETED = 1024;
+      if ( completed_timings_.size() >= MAX_COMPLETED ) {
+        completed_timings_.pop_front();
+      }
+      completed_timings_.push_back( timing );
+    }
+
+    pending_presents_.pop_front();
+  }
+}
+
+bool VideoDisplay::pop_timing( FrameTiming & timing )
+{
+  collect_timings();
+
+  if ( completed_timings_.empty() ) {
+    return false;
+  }
+
+  timing = completed_timings_.front();
+  completed_timings_.pop_front();
+  return true;
+}
+
+const Window & VideoDisplay::window( void ) const
+{
+  if ( not current_context_.window_ ) {
+    throw runtime_error( "headless VideoDisplay has no window" );
+  }
+
+  return *current_context_.window_;
+}
+
+void VideoDisplay::read_pixels( vector<uint8_t> & rgba ) const
+{
+  if ( not headless() ) {
+    throw runtime_error( "only a headless VideoDisplay can read back its image" );
+  }
+
+  current_context_.framebuffer_->read_pixels( rgba );
 }
@@ -6,49 +6,150 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <tuple>
+#include <utility>
+#include <vector>
+
 #include "raster.hh"
+#include "tile_map.hh"
 #include "gl_objects.hh"
+#include "frame_timing.hh"
+#include "present_monitor.hh"
 
 class VideoDisplay
 {
 private:
   static const std::string shader_source_scale_from_pixel_coordinates;
   static const std::string shader_source_ycbcr;
+  static const std::string shader_source_ycbcr_nv12;
+
+  /* how the chroma planes handed to draw() are laid out */
+  enum class ChromaLayout { I420, I422, NV12 };
+  ChromaLayout layout_ { ChromaLayout::I420 };
 
   unsigned int display_width_, display_height_;
   unsigned int width_, height_;
 
-  struct CurrentContextWindow
-  {
-    GLFWContext glfw_context_ = {};
-    Window window_;
-
-    CurrentContextWindow( const unsigned int width, const unsigned int height,
-      const std::string & title, const bool fullscreen );
-  } current_context_window_;
+  RenderContext current_context_;
 
   VertexShader scale_from_pixel_coordinates_ = { shader_source_scale_from_pixel_coordinates };
   FragmentShader ycbcr_shader_ = { shader_source_ycbcr };
+  FragmentShader ycbcr_nv12_shader_ = { shader_source_ycbcr_nv12 };
 
   Program texture_shader_program_ = {};
+  Program nv12_shader_program_ = {};
+
+  Texture Y_, U_, V_, UV_;
 
-  Texture Y_, U_, V_;
+  PixelUnpackRing unpack_ring_;
+
+  /* what changed since the last I420 upload; only those tiles are uploaded */
+  TileChangeMap tile_map_;
+  size_t last_uploaded_bytes_ { 0 };
+
+  /* the planes being drawn and where they were staged, kept here so that
+     drawing a frame allocates nothing */
+  std::vector<std::pair<Texture *, const TwoD<uint8_t> *>> planes_ {};
+  std::vector<size_t> staged_offsets_ {};
+  std::vector<std::tuple<Texture *, TileChangeMap::Region, size_t>> staged_regions_ {};
+
+  std::chrono::duration<double> last_upload_time_ {};
+  std::chrono::duration<double> last_draw_time_ {};
+
+  /* a swap whose GPU time or present time is not known yet */
+  struct PendingPresent
+  {
+    FrameTiming timing;
+    int64_t swap_timestamp;
+    GLuint begin_query, end_query;  /* GL_TIMESTAMP queries around the GPU work, 0 if none */
+    bool frame;     /* false for a repaint of the previous frame */
+  };
+
+  bool timer_queries_ { false };
+  GLuint active_begin_query_ { 0 }, active_end_query_ { 0 };
+  std::vector<GLuint> queries_ {};
+  std::vector<GLuint> idle_queries_ {};
+
+  std::unique_ptr<PresentMonitor> present_monitor_ {};
+  double refresh_interval_ { 0 };
+
+  std::deque<PendingPresent> pending_presents_ {};
+  std::deque<FrameTiming> completed_timings_ {};
+  int64_t last_present_timestamp_ { 0 };
+  uint64_t last_msc_ { 0 };
+  unsigned int unreported_missed_vsyncs_ { 0 };
+  uint64_t missed_vsyncs_ { 0 };
 
   VertexArrayObject texture_shader_array_object_ = {};
   VertexBufferObject screen_corners_ = {};
   VertexBufferObject other_vertices_ = {};
 
+  Program & active_program( void );
+  void set_layout( const ChromaLayout layout );
+  size_t upload( const std::vector<TileChangeMap::Region> * regions = nullptr );
+  void initialize( void );
+
+  /* draws planes_ */
+  void draw_planes( const ChromaLayout layout,
+                    const int64_t capture_timestamp,
+                    const TileChangeMap * tiles = nullptr );
+  void paint( void );
+  void begin_gpu_timing( void );
+  void end_gpu_timing( void );
+  void present( const bool frame, const FrameTiming & timing );
+  void collect_timings( void );
+
 public:
+  /* GLSL function ycbcr_to_rgb( fY, fCb, fCr ) with the SMPTE 170M matrix, for other renderers */
+  static const std::string shader_source_ycbcr_to_rgb;
+
+  /* selects the offscreen backend */
+  struct Headless {};
+
   VideoDisplay( const BaseRaster & raster, const bool fullscreen = false );
+  VideoDisplay( const BaseRaster & raster, const Headless );
+  ~VideoDisplay();
 
   VideoDisplay( const VideoDisplay & other ) = delete;
   VideoDisplay & operator=( const VideoDisplay & other ) = delete;
 
   void draw( const BaseRaster & raster );
+
+  /* camera-native layouts, shown without deinterleaving or resampling on the CPU */
+  void draw_nv12( const TwoD<uint8_t> & Y, const TwoD<uint8_t> & UV,
+                  const int64_t capture_timestamp = 0 );
+  void draw_i422( const TwoD<uint8_t> & Y, const TwoD<uint8_t> & U, const TwoD<uint8_t> & V,
+                  const int64_t capture_timestamp = 0 );
   void repaint( void );
   void resize( const std::pair<unsigned int, unsigned int> & target_size );
 
-  const Window & window( void ) const { return current_context_window_.window_; }
+  bool headless( void ) const { return current_context_.framebuffer_ != nullptr; }
+  const Window & window( void ) const;
+
+  /* headless only: the last repainted image as RGBA rows, top row first */
+  void read_pixels( std::vector<uint8_t> & rgba ) const;
+
+  /* CPU time of the last draw call: staging and issuing the uploads, then repainting */
+  std::chrono::duration<double> last_upload_time( void ) const { return last_upload_time_; }
+  std::chrono::duration<double> last_draw_time( void ) const { return last_draw_time_; }
+
+  /* bytes of sample data uploaded by the last draw call, and the tile map deciding them for I420 frames */
+  size_t last_uploaded_bytes( void ) const { return last_uploaded_bytes_; }
+  const TileChangeMap & tile_map( void ) const { return tile_map_; }
+
+  /* largest SAD over a tile's three planes for which an I420 frame's tile
+     is not uploaded again; 0, the default, skips only identical tiles */
+  void set_tile_threshold( const uint64_t threshold ) { tile_map_.set_threshold( threshold ); }
+
+  /* Per-frame timing, in draw order, once the GPU and present times are
+     in. Present times come from Present completion events when the
+     window's swaps go through X Present, and from the swap returning
+     otherwise. Repaints are not reported, but vsyncs they miss are. */
+  bool pop_timing( FrameTiming & timing );
+  uint64_t missed_vsyncs( void ) const { return missed_vsyncs_; }
 };
 
 #endif /* DISPLAY_HH */
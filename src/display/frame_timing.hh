@@ -0,0 +1,28 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef FRAME_TIMING_HH
+#define FRAME_TIMING_HH
+
+#include <cstdint>
+
+/* where one displayed frame spent its time; timestamps are CLOCK_MONOTONIC microseconds */
+struct FrameTiming
+{
+  int64_t capture_timestamp { 0 };   /* from the raster, 0 if unknown */
+
+  double upload_time { 0 };          /* CPU seconds staging and issuing the uploads */
+  double gpu_time { -1 };            /* GPU seconds for uploads and shading, -1 if not measured */
+
+  uint64_t uploaded_bytes { 0 };     /* sample data sent for this frame, without row padding */
+  unsigned int tiles { 0 };          /* tiles in the change map, 0 if the display has none */
+  unsigned int clean_tiles { 0 };    /* of those, tiles left as they were */
+
+  int64_t present_timestamp { 0 };
+  bool present_from_server { false };  /* from a Present completion, rather than the swap returning */
+  uint64_t msc { 0 };                  /* vblank counter, 0 if unknown */
+
+  /* vblanks that went by without a present since the previous one */
+  unsigned int missed_vsyncs { 0 };
+};
+
+#endif /* FRAME_TIMING_HH */
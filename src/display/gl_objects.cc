@@ -1,8 +1,10 @@
 /* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
 
 #include <iostream>
+#include <sstream>
 #include <stdexcept>
 #include <memory>
+#include <cstring>
 
 #include "gl_objects.hh"
 #include "exception.hh"
@@ -102,12 +104,216 @@ pair<unsigned int, unsigned int> Window::window_size() const
   return pair<unsigned int, unsigned int>( width, height );
 }
 
+double Window::refresh_interval( void ) const
+{
+  GLFWmonitor * monitor = glfwGetWindowMonitor( window_.get() );
+  if ( not monitor ) {
+    monitor = glfwGetPrimaryMonitor();
+  }
+
+  const GLFWvidmode * mode = monitor ? glfwGetVideoMode( monitor ) : nullptr;
+  return ( mode and mode->refreshRate > 0 ) ? 1.0 / mode->refreshRate : 0;
+}
+
 void Window::Deleter::operator() ( GLFWwindow * x ) const
 {
   glfwHideWindow( x );
   glfwDestroyWindow( x );
 }
 
+static void eglCheck( const bool ok, const string & where )
+{
+  if ( not ok ) {
+    ostringstream message;
+    message << "EGL error " << where << ": 0x" << hex << eglGetError();
+    throw runtime_error( message.str() );
+  }
+}
+
+static bool has_extension( const char * extensions, const string & name )
+{
+  if ( not extensions ) {
+    return false;
+  }
+
+  const string list = string( " " ) + extensions + " ";
+  return list.find( " " + name + " " ) != string::npos;
+}
+
+static EGLDisplay headless_display( void )
+{
+  /* client extensions are queried without a display */
+  const char * client_extensions = eglQueryString( EGL_NO_DISPLAY, EGL_EXTENSIONS );
+
+  if ( has_extension( client_extensions, "EGL_MESA_platform_surfaceless" ) ) {
+    typedef EGLDisplay ( * GetPlatformDisplay )( EGLenum, void *, const EGLint * );
+    const auto get_platform_display = reinterpret_cast<GetPlatformDisplay>(
+      eglGetProcAddress( "eglGetPlatformDisplayEXT" ) );
+
+    if ( get_platform_display ) {
+      static constexpr EGLenum EGL_PLATFORM_SURFACELESS = 0x31DD;
+      const EGLDisplay display = get_platform_display( EGL_PLATFORM_SURFACELESS,
+                                                       EGL_DEFAULT_DISPLAY, nullptr );
+      if ( display != EGL_NO_DISPLAY ) {
+        return display;
+      }
+    }
+  }
+
+  return eglGetDisplay( EGL_DEFAULT_DISPLAY );
+}
+
+HeadlessContext::HeadlessContext()
+  : display_( headless_display() ),
+    context_( EGL_NO_CONTEXT ),
+    surface_( EGL_NO_SURFACE )
+{
+  eglCheck( display_ != EGL_NO_DISPLAY, "getting a display" );
+  eglCheck( eglInitialize( display_, nullptr, nullptr ), "initializing" );
+  eglCheck( eglBindAPI( EGL_OPENGL_API ), "binding the OpenGL API" );
+
+  const EGLint config_attributes[] = {
+    EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+    EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+    EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+    EGL_NONE
+  };
+
+  EGLConfig config;
+  EGLint config_count = 0;
+  eglCheck( eglChooseConfig( display_, config_attributes, &config, 1, &config_count )
+            and config_count > 0, "choosing a config" );
+
+  /* same version and profile as the GLFW windows */
+  const EGLint context_attributes[] = {
+    EGL_CONTEXT_MAJOR_VERSION, 3,
+    EGL_CONTEXT_MINOR_VERSION, 1,
+    EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, EGL_TRUE,
+    EGL_NONE
+  };
+
+  context_ = eglCreateContext( display_, config, EGL_NO_CONTEXT, context_attributes );
+  eglCheck( context_ != EGL_NO_CONTEXT, "creating a context" );
+
+  if ( not has_extension( eglQueryString( display_, EGL_EXTENSIONS ), "EGL_KHR_surfaceless_context" ) ) {
+    const EGLint pbuffer_attributes[] = { EGL_WIDTH, 1, EGL_HEIGHT, 1, EGL_NONE };
+    surface_ = eglCreatePbufferSurface( display_, config, pbuffer_attributes );
+    eglCheck( surface_ != EGL_NO_SURFACE, "creating a pbuffer" );
+  }
+}
+
+HeadlessContext::~HeadlessContext()
+{
+  eglMakeCurrent( display_, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT );
+
+  if ( surface_ != EGL_NO_SURFACE ) {
+    eglDestroySurface( display_, surface_ );
+  }
+
+  eglDestroyContext( display_, context_ );
+  eglTerminate( display_ );
+}
+
+void HeadlessContext::make_context_current( const bool initialize_extensions )
+{
+  eglCheck( eglMakeCurrent( display_, surface_, surface_, context_ ), "making context current" );
+
+  if ( initialize_extensions ) {
+    /* GLEW built for GLX reports a missing X display here, but the core
+       and extension entry points it resolves still work under EGL */
+    glewExperimental = GL_TRUE;
+    glewInit();
+    glCheck( "after initializing GLEW", true );
+  }
+}
+
+RenderContext::RenderContext( const unsigned int width,
+  const unsigned int height, const string & title, const bool fullscreen )
+  : glfw_context_( new GLFWContext ),
+    window_( new Window( width, height, title, fullscreen ) )
+{
+  window_->make_context_current( true );
+  glfwSwapInterval(1);
+}
+
+RenderContext::RenderContext( const unsigned int width, const unsigned int height )
+  : headless_context_( new HeadlessContext )
+{
+  headless_context_->make_context_current( true );
+  framebuffer_.reset( new Framebuffer( width, height ) );
+  framebuffer_->bind();
+}
+
+pair<unsigned int, unsigned int> RenderContext::size( void ) const
+{
+  return window_ ? window_->size() : framebuffer_->size();
+}
+
+pair<unsigned int, unsigned int> RenderContext::window_size( void ) const
+{
+  return window_ ? window_->window_size() : framebuffer_->size();
+}
+
+void RenderContext::present( void )
+{
+  if ( window_ ) {
+    glfwPollEvents();
+    window_->swap_buffers();
+  } else {
+    /* nothing to wait for but the GPU, so make the shade time honest */
+    glFinish();
+  }
+}
+
+Framebuffer::Framebuffer( const unsigned int width, const unsigned int height )
+  : framebuffer_(), renderbuffer_(), width_( width ), height_( height )
+{
+  glGenRenderbuffers( 1, &renderbuffer_ );
+  glBindRenderbuffer( GL_RENDERBUFFER, renderbuffer_ );
+  glRenderbufferStorage( GL_RENDERBUFFER, GL_RGBA8, width_, height_ );
+
+  glGenFramebuffers( 1, &framebuffer_ );
+  glBindFramebuffer( GL_FRAMEBUFFER, framebuffer_ );
+  glFramebufferRenderbuffer( GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, renderbuffer_ );
+
+  if ( glCheckFramebufferStatus( GL_FRAMEBUFFER ) != GL_FRAMEBUFFER_COMPLETE ) {
+    throw runtime_error( "incomplete framebuffer" );
+  }
+
+  glCheck( "after creating framebuffer" );
+}
+
+Framebuffer::~Framebuffer()
+{
+  glDeleteFramebuffers( 1, &framebuffer_ );
+  glDeleteRenderbuffers( 1, &renderbuffer_ );
+}
+
+void Framebuffer::bind( void )
+{
+  glBindFramebuffer( GL_FRAMEBUFFER, framebuffer_ );
+}
+
+void Framebuffer::read_pixels( vector<uint8_t> & rgba ) const
+{
+  const size_t row_length = 4 * width_;
+  rgba.resize( row_length * height_ );
+
+  glBindFramebuffer( GL_READ_FRAMEBUFFER, framebuffer_ );
+  glPixelStorei( GL_PACK_ALIGNMENT, 1 );
+  glPixelStorei( GL_PACK_ROW_LENGTH, 0 );
+  glReadPixels( 0, 0, width_, height_, GL_RGBA, GL_UNSIGNED_BYTE, rgba.data() );
+  glCheck( "after reading pixels" );
+
+  /* GL rows run bottom-up */
+  vector<uint8_t> row( row_length );
+  for ( unsigned int top = 0, bottom = height_ - 1; top < bottom; top++, bottom-- ) {
+    memcpy( row.data(), &rgba[ top * row_length ], row_length );
+    memcpy( &rgba[ top * row_length ], &rgba[ bottom * row_length ], row_length );
+    memcpy( &rgba[ bottom * row_length ], row.data(), row_length );
+  }
+}
+
 VertexBufferObject::VertexBufferObject()
   : num_()
 {
@@ -135,11 +341,17 @@ void VertexArrayObject::bind( void )
   glBindVertexArray( num_ );
 }
 
-Texture::Texture( const unsigned int width, const unsigned int height )
+Texture::Texture( const unsigned int width, const unsigned int height,
+                  const GLenum internal_format )
   : num_(),
     width_( width ),
-    height_( height )
+    height_( height ),
+    internal_format_( internal_format )
 {
+  if ( internal_format_ != GL_R8 and internal_format_ != GL_RG8 ) {
+    throw runtime_error( "unsupported texture format" );
+  }
+
   glGenTextures( 1, &num_ );
 }
 
@@ -164,20 +376,209 @@ void Texture::resize( const unsigned int width, const unsigned int height )
   width_ = width;
   height_ = height;
   glBindTexture( GL_TEXTURE_RECTANGLE, num_ );
-  glTexImage2D( GL_TEXTURE_RECTANGLE, 0, GL_RGBA8, width_, height_, 0,
-                GL_BGRA, GL_UNSIGNED_BYTE, nullptr );
+  glTexImage2D( GL_TEXTURE_RECTANGLE, 0, internal_format_, width_, height_, 0,
+                pixel_format(), GL_UNSIGNED_BYTE, nullptr );
 }
 
 void Texture::load( const TwoD< uint8_t > & raster )
 {
-  /*if ( image.size() != size() ) {
+  if ( raster.width() != width_ * bytes_per_texel() or raster.height() != height_ ) {
     throw runtime_error( "image size does not match texture dimensions" );
-  }*/
+  }
+
+  glBindTexture( GL_TEXTURE_RECTANGLE, num_ );
+  glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+  glPixelStorei( GL_UNPACK_ROW_LENGTH, raster.stride() / bytes_per_texel() );
+  glTexSubImage2D( GL_TEXTURE_RECTANGLE, 0, 0, 0, width_, height_,
+                   pixel_format(), GL_UNSIGNED_BYTE, &( raster.at( 0, 0 ) ) );
+}
+
+void Texture::load_from_unpack_buffer( const size_t offset, const unsigned int stride )
+{
+  load_region_from_unpack_buffer( 0, 0, width_, height_, offset, stride );
+}
+
+void Texture::load_region_from_unpack_buffer( const unsigned int x, const unsigned int y,
+                                              const unsigned int width, const unsigned int height,
+                                              const size_t offset, const unsigned int stride )
+{
+  if ( x + width > width_ or y + height > height_ ) {
+    throw runtime_error( "region exceeds texture dimensions" );
+  }
 
   glBindTexture( GL_TEXTURE_RECTANGLE, num_ );
-  glPixelStorei( GL_UNPACK_ROW_LENGTH, width_ );
-  glTexSubImage2D( GL_TEXTURE_RECTANGLE_ARB, 0, 0, 0, width_, height_,
-                   GL_LUMINANCE, GL_UNSIGNED_BYTE, &( raster.at( 0, 0 ) ) );
+  glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+  glPixelStorei( GL_UNPACK_ROW_LENGTH, stride / bytes_per_texel() );
+  glTexSubImage2D( GL_TEXTURE_RECTANGLE, 0, x, y, width, height,
+                   pixel_format(), GL_UNSIGNED_BYTE, reinterpret_cast<const void *>( offset ) );
+}
+
+TextureArray::TextureArray( const unsigned int width, const unsigned int height,
+                            const unsigned int layers )
+  : num_(),
+    width_( width ),
+    height_( height ),
+    layers_( layers )
+{
+  if ( layers_ == 0 ) {
+    throw runtime_error( "texture array needs at least one layer" );
+  }
+
+  glGenTextures( 1, &num_ );
+  glBindTexture( GL_TEXTURE_2D_ARRAY, num_ );
+  glTexImage3D( GL_TEXTURE_2D_ARRAY, 0, GL_R8, width_, height_, layers_, 0,
+                GL_RED, GL_UNSIGNED_BYTE, nullptr );
+
+  glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR );
+  glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR );
+  glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE );
+  glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE );
+  glTexParameteri( GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0 );
+}
+
+TextureArray::~TextureArray()
+{
+  glDeleteTextures( 1, &num_ );
+}
+
+void TextureArray::bind( const GLenum texture_unit )
+{
+  glActiveTexture( texture_unit );
+  glBindTexture( GL_TEXTURE_2D_ARRAY, num_ );
+}
+
+void TextureArray::fill( const uint8_t value )
+{
+  const vector<uint8_t> layer( size_t( width_ ) * height_, value );
+
+  glBindTexture( GL_TEXTURE_2D_ARRAY, num_ );
+  glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+  glPixelStorei( GL_UNPACK_ROW_LENGTH, 0 );
+
+  for ( unsigned int i = 0; i < layers_; i++ ) {
+    glTexSubImage3D( GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width_, height_, 1,
+                     GL_RED, GL_UNSIGNED_BYTE, layer.data() );
+  }
+}
+
+void TextureArray::load_layer( const unsigned int layer, const TwoD< uint8_t > & raster )
+{
+  if ( raster.width() != width_ or raster.height() != height_ ) {
+    throw runtime_error( "image size does not match texture dimensions" );
+  }
+
+  if ( layer >= layers_ ) {
+    throw out_of_range( "texture array layer out of range" );
+  }
+
+  glBindTexture( GL_TEXTURE_2D_ARRAY, num_ );
+  glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+  glPixelStorei( GL_UNPACK_ROW_LENGTH, raster.stride() );
+  glTexSubImage3D( GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width_, height_, 1,
+                   GL_RED, GL_UNSIGNED_BYTE, &( raster.at( 0, 0 ) ) );
+}
+
+void TextureArray::load_layer_from_unpack_buffer( const unsigned int layer, const size_t offset,
+                                                  const unsigned int stride )
+{
+  if ( layer >= layers_ ) {
+    throw out_of_range( "texture array layer out of range" );
+  }
+
+  glBindTexture( GL_TEXTURE_2D_ARRAY, num_ );
+  glPixelStorei( GL_UNPACK_ALIGNMENT, 1 );
+  glPixelStorei( GL_UNPACK_ROW_LENGTH, stride );
+  glTexSubImage3D( GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width_, height_, 1,
+                   GL_RED, GL_UNSIGNED_BYTE, reinterpret_cast<const void *>( offset ) );
+}
+
+PixelUnpackRing::PixelUnpackRing( const size_t slot_size, const size_t slot_count )
+  : slots_( slot_count, Slot { 0, nullptr, nullptr } ),
+    slot_size_( slot_size ),
+    current_( 0 ),
+    persistent_( GLEW_ARB_buffer_storage )
+{
+  static constexpr GLbitfield persistent_flags
+    = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+  for ( auto & slot : slots_ ) {
+    glGenBuffers( 1, &slot.buffer );
+    glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.buffer );
+
+    if ( persistent_ ) {
+      glBufferStorage( GL_PIXEL_UNPACK_BUFFER, slot_size_, nullptr, persistent_flags );
+      slot.mapping = static_cast<uint8_t *>(
+        glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, slot_size_, persistent_flags ) );
+
+      if ( slot.mapping == nullptr ) {
+        throw runtime_error( "could not map pixel unpack buffer" );
+      }
+    } else {
+      glBufferData( GL_PIXEL_UNPACK_BUFFER, slot_size_, nullptr, GL_STREAM_DRAW );
+    }
+  }
+
+  glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+  glCheck( "after creating pixel unpack buffers" );
+}
+
+PixelUnpackRing::~PixelUnpackRing()
+{
+  for ( auto & slot : slots_ ) {
+    if ( slot.fence ) {
+      glDeleteSync( slot.fence );
+    }
+
+    if ( persistent_ ) {
+      glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.buffer );
+      glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+    }
+
+    glDeleteBuffers( 1, &slot.buffer );
+  }
+
+  glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
+}
+
+uint8_t * PixelUnpackRing::acquire( void )
+{
+  current_ = ( current_ + 1 ) % slots_.size();
+  Slot & slot = slots_[ current_ ];
+
+  if ( slot.fence ) {
+    while ( glClientWaitSync( slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000 ) == GL_TIMEOUT_EXPIRED ) {}
+    glDeleteSync( slot.fence );
+    slot.fence = nullptr;
+  }
+
+  glBindBuffer( GL_PIXEL_UNPACK_BUFFER, slot.buffer );
+
+  if ( not persistent_ ) {
+    /* the fence already guarantees the GPU is done, so skip the driver's own sync */
+    slot.mapping = static_cast<uint8_t *>(
+      glMapBufferRange( GL_PIXEL_UNPACK_BUFFER, 0, slot_size_,
+                        GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT | GL_MAP_UNSYNCHRONIZED_BIT ) );
+
+    if ( slot.mapping == nullptr ) {
+      throw runtime_error( "could not map pixel unpack buffer" );
+    }
+  }
+
+  return slot.mapping;
+}
+
+void PixelUnpackRing::commit( void )
+{
+  if ( not persistent_ ) {
+    glUnmapBuffer( GL_PIXEL_UNPACK_BUFFER );
+    slots_[ current_ ].mapping = nullptr;
+  }
+}
+
+void PixelUnpackRing::fence( void )
+{
+  slots_[ current_ ].fence = glFenceSync( GL_SYNC_GPU_COMMANDS_COMPLETE, 0 );
+  glBindBuffer( GL_PIXEL_UNPACK_BUFFER, 0 );
 }
 
 void compile_shader( const GLuint num, const string & source )
@@ -211,6 +612,11 @@ void compile_shader( const GLuint num, const string & source )
   }
 }
 
+void Program::bind_attribute_location( const GLuint index, const string & name )
+{
+  glBindAttribLocation( num_, index, name.c_str() );
+}
+
 void Program::link( void )
 {
   glLinkProgram( num_ );
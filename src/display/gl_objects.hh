@@ -8,6 +8,10 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+/* headless contexts never talk to an X server */
+#define EGL_NO_X11
+#include <EGL/egl.h>
+
 #include <string>
 #include <vector>
 #include <memory>
@@ -42,6 +46,75 @@ public:
   bool key_pressed( const int key ) const;
   std::pair<unsigned int, unsigned int> size( void ) const;
   std::pair<unsigned int, unsigned int> window_size() const;
+
+  /* seconds per refresh of the monitor the window is on (or the primary one), 0 if unknown */
+  double refresh_interval( void ) const;
+
+  GLFWwindow * handle( void ) const { return window_.get(); }
+};
+
+/* OpenGL 3.1 context with no window, created through EGL. Uses the
+   surfaceless platform when the driver offers it (no display server
+   needed at all), and binds without a surface when possible, falling
+   back to a 1x1 pbuffer. Rendering goes to a Framebuffer. */
+class HeadlessContext
+{
+  EGLDisplay display_;
+  EGLContext context_;
+  EGLSurface surface_;
+
+public:
+  HeadlessContext();
+  ~HeadlessContext();
+
+  void make_context_current( const bool initialize_extensions = false );
+
+  /* forbid copy */
+  HeadlessContext( const HeadlessContext & other ) = delete;
+  HeadlessContext & operator=( const HeadlessContext & other ) = delete;
+};
+
+/* RGBA8 offscreen render target */
+class Framebuffer
+{
+  GLuint framebuffer_;
+  GLuint renderbuffer_;
+  unsigned int width_, height_;
+
+public:
+  Framebuffer( const unsigned int width, const unsigned int height );
+  ~Framebuffer();
+
+  void bind( void );
+  std::pair<unsigned int, unsigned int> size( void ) const { return std::make_pair( width_, height_ ); }
+
+  /* waits for rendering and copies the image out as RGBA rows, top row first */
+  void read_pixels( std::vector<uint8_t> & rgba ) const;
+
+  /* forbid copy */
+  Framebuffer( const Framebuffer & other ) = delete;
+  Framebuffer & operator=( const Framebuffer & other ) = delete;
+};
+
+/* what a display draws into: an on-screen window with a swap interval of
+   1, or a headless context rendering into a framebuffer */
+struct RenderContext
+{
+  std::unique_ptr<GLFWContext> glfw_context_ {};
+  std::unique_ptr<Window> window_ {};
+
+  std::unique_ptr<HeadlessContext> headless_context_ {};
+  std::unique_ptr<Framebuffer> framebuffer_ {};
+
+  RenderContext( const unsigned int width, const unsigned int height,
+                 const std::string & title, const bool fullscreen );
+  RenderContext( const unsigned int width, const unsigned int height );
+
+  std::pair<unsigned int, unsigned int> size( void ) const;
+  std::pair<unsigned int, unsigned int> window_size( void ) const;
+
+  /* swaps (waiting for vsync), or for headless contexts waits for the GPU */
+  void present( void );
 };
 
 struct VertexObject
@@ -102,18 +175,33 @@ public:
   VertexArrayObject & operator=( const VertexArrayObject & other ) = delete;
 };
 
+/* rectangle texture holding one 8-bit plane (GL_R8) or one interleaved
+   pair of planes (GL_RG8, e.g. NV12 chroma) */
 class Texture
 {
 private:
   GLuint num_;
   unsigned int width_, height_;
+  GLenum internal_format_;
+
+  GLenum pixel_format( void ) const { return internal_format_ == GL_RG8 ? GL_RG : GL_RED; }
+  unsigned int bytes_per_texel( void ) const { return internal_format_ == GL_RG8 ? 2 : 1; }
 
 public:
-  Texture( const unsigned int width, const unsigned int height );
+  Texture( const unsigned int width, const unsigned int height,
+           const GLenum internal_format = GL_R8 );
   ~Texture();
 
   void bind( const GLenum texture_unit );
   void load( const TwoD< uint8_t> & raster );
+
+  /* upload from the currently bound GL_PIXEL_UNPACK_BUFFER; stride is in bytes */
+  void load_from_unpack_buffer( const size_t offset, const unsigned int stride );
+
+  /* same, for a rectangle of the texture; the buffer holds just that rectangle */
+  void load_region_from_unpack_buffer( const unsigned int x, const unsigned int y,
+                                       const unsigned int width, const unsigned int height,
+                                       const size_t offset, const unsigned int stride );
   void resize( const unsigned int width, const unsigned int height );
   std::pair<unsigned int, unsigned int> size( void ) const { return std::make_pair( width_, height_ ); }
 
@@ -122,6 +210,78 @@ public:
   Texture & operator=( const Texture & other ) = delete;
 };
 
+/* array of 8-bit 2D textures, one layer per stream, sampled with
+   normalized coordinates through a sampler2DArray */
+class TextureArray
+{
+private:
+  GLuint num_;
+  unsigned int width_, height_, layers_;
+
+public:
+  TextureArray( const unsigned int width, const unsigned int height, const unsigned int layers );
+  ~TextureArray();
+
+  void bind( const GLenum texture_unit );
+
+  /* fills every layer with one value (e.g. video black) */
+  void fill( const uint8_t value );
+
+  void load_layer( const unsigned int layer, const TwoD<uint8_t> & raster );
+
+  /* upload from the currently bound GL_PIXEL_UNPACK_BUFFER; stride is in bytes */
+  void load_layer_from_unpack_buffer( const unsigned int layer, const size_t offset,
+                                      const unsigned int stride );
+
+  unsigned int layers( void ) const { return layers_; }
+  std::pair<unsigned int, unsigned int> size( void ) const { return std::make_pair( width_, height_ ); }
+
+  /* disallow copy */
+  TextureArray( const TextureArray & other ) = delete;
+  TextureArray & operator=( const TextureArray & other ) = delete;
+};
+
+/* Ring of pixel-unpack buffers for asynchronous texture uploads. The
+   client writes a frame into the mapped slot, the texture loads read
+   from it on the GPU timeline, and a fence keeps the slot from being
+   reused until those reads have finished. Slots stay persistently
+   mapped when ARB_buffer_storage is available and are mapped per frame
+   otherwise. */
+class PixelUnpackRing
+{
+private:
+  struct Slot
+  {
+    GLuint buffer;
+    uint8_t * mapping;
+    GLsync fence;
+  };
+
+  std::vector<Slot> slots_;
+  size_t slot_size_;
+  size_t current_;
+  bool persistent_;
+
+public:
+  PixelUnpackRing( const size_t slot_size, const size_t slot_count = 3 );
+  ~PixelUnpackRing();
+
+  size_t slot_size( void ) const { return slot_size_; }
+
+  /* waits until the next slot is idle, binds it and returns its mapping */
+  uint8_t * acquire( void );
+
+  /* makes the written data visible to GL; the slot stays bound for uploads */
+  void commit( void );
+
+  /* call after the uploads from the current slot have been issued */
+  void fence( void );
+
+  /* forbid copy */
+  PixelUnpackRing( const PixelUnpackRing & other ) = delete;
+  PixelUnpackRing & operator=( const PixelUnpackRing & other ) = delete;
+};
+
 void compile_shader( const GLuint num, const std::string & source );
 
 template <GLenum type_>
@@ -162,6 +322,7 @@ public:
     glAttachShader( num_, shader.num_ );
   }
 
+  void bind_attribute_location( const GLuint index, const std::string & name );
   void link( void );
   void use( void );
 
@@ -0,0 +1,86 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <stdexcept>
+
+#include <GLFW/glfw3.h>
+
+/* kept out of the headers: Xlib's Window would collide with ours */
+#define GLFW_EXPOSE_NATIVE_X11
+#include <GLFW/glfw3native.h>
+
+#include "present_monitor.hh"
+
+using namespace std;
+
+void PresentMonitor::ConnectionDeleter::operator() ( xcb_connection_t * x ) const
+{
+  xcb_disconnect( x );
+}
+
+PresentMonitor::PresentMonitor( const uint32_t window )
+  : connection_( xcb_connect( nullptr, nullptr ) ),
+    events_( nullptr )
+{
+  xcb_connection_t * connection = connection_.get();
+
+  if ( xcb_connection_has_error( connection ) ) {
+    throw runtime_error( "could not connect to the X server" );
+  }
+
+  const xcb_query_extension_reply_t * extension = xcb_get_extension_data( connection, &xcb_present_id );
+  if ( not extension or not extension->present ) {
+    throw runtime_error( "X server without the Present extension" );
+  }
+
+  unique_ptr<xcb_present_query_version_reply_t, decltype( &free )> version {
+    xcb_present_query_version_reply( connection, xcb_present_query_version( connection, 1, 0 ), nullptr ),
+    free };
+  if ( not version ) {
+    throw runtime_error( "Present version query failed" );
+  }
+
+  const xcb_present_event_t event_id = xcb_generate_id( connection );
+  unique_ptr<xcb_generic_error_t, decltype( &free )> error {
+    xcb_request_check( connection,
+                       xcb_present_select_input_checked( connection, event_id, window,
+                                                         XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY ) ),
+    free };
+  if ( error ) {
+    throw runtime_error( "could not select Present events on window" );
+  }
+
+  events_ = xcb_register_for_special_xge( connection, &xcb_present_id, event_id, nullptr );
+  if ( not events_ ) {
+    throw runtime_error( "could not register for Present events" );
+  }
+}
+
+PresentMonitor::~PresentMonitor()
+{
+  xcb_unregister_for_special_event( connection_.get(), events_ );
+}
+
+bool PresentMonitor::poll( Completion & completion )
+{
+  while ( xcb_generic_event_t * event = xcb_poll_for_special_event( connection_.get(), events_ ) ) {
+    unique_ptr<xcb_generic_event_t, decltype( &free )> owned { event, free };
+    const auto complete = reinterpret_cast<const xcb_present_complete_notify_event_t *>( event );
+
+    if ( complete->event_type == XCB_PRESENT_EVENT_COMPLETE_NOTIFY
+         and complete->kind == XCB_PRESENT_COMPLETE_KIND_PIXMAP ) {
+      completion = { complete->msc, complete->ust, complete->mode == XCB_PRESENT_COMPLETE_MODE_SKIP };
+      return true;
+    }
+  }
+
+  return false;
+}
+
+uint32_t x11_window( GLFWwindow * window )
+{
+  const ::Window x11 = glfwGetX11Window( window );
+  if ( x11 == None ) {
+    throw runtime_error( "GLFW window is not an X11 window" );
+  }
+  return x11;
+}
@@ -0,0 +1,47 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef PRESENT_MONITOR_HH
+#define PRESENT_MONITOR_HH
+
+#include <xcb/xcb.h>
+#include <xcb/present.h>
+
+#include <cstdint>
+#include <memory>
+
+/* Listens, on a connection of its own, for the Present CompleteNotify
+   events of a window someone else presents to (e.g. the GL driver
+   behind glfwSwapBuffers), so swaps can be given the time they really
+   reached the screen. Throws if there is no X server or no Present. */
+
+class PresentMonitor
+{
+private:
+  struct ConnectionDeleter { void operator() ( xcb_connection_t * x ) const; };
+
+  std::unique_ptr<xcb_connection_t, ConnectionDeleter> connection_;
+  xcb_special_event_t * events_;
+
+public:
+  struct Completion
+  {
+    uint64_t msc;
+    uint64_t ust;
+    bool skipped;
+  };
+
+  PresentMonitor( const uint32_t window );
+  ~PresentMonitor();
+
+  /* next completion, in present order, if one has arrived */
+  bool poll( Completion & completion );
+
+  PresentMonitor( const PresentMonitor & other ) = delete;
+  PresentMonitor & operator=( const PresentMonitor & other ) = delete;
+};
+
+/* the X11 window behind a GLFW window; throws if GLFW is not running on X11 */
+struct GLFWwindow;
+uint32_t x11_window( GLFWwindow * window );
+
+#endif /* PRESENT_MONITOR_HH */
@@ -0,0 +1,125 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <chrono>
+#include <ctime>
+
+#include "render_thread.hh"
+#include "display.hh"
+#include "xcb_display.hh"
+#include "realtime.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+/* how long a repaint should take when presenting waits for vsync (60 Hz) */
+static constexpr microseconds REFRESH_INTERVAL { 16667 };
+
+RenderThread::RenderThread( const uint16_t width, const uint16_t height, const bool fullscreen,
+                            const bool software, const uint64_t tile_threshold )
+  : mailbox_( width, height, width, height ),
+    fullscreen_( fullscreen ),
+    software_( software ),
+    tile_threshold_( tile_threshold ),
+    thread_( [this]() { loop(); } )
+{}
+
+RenderThread::~RenderThread()
+{
+  stop();
+  thread_.join();
+}
+
+void RenderThread::stop( void )
+{
+  stop_ = true;
+  mailbox_.interrupt();
+  timings_.close();
+}
+
+void RenderThread::pin( const int cpu )
+{
+  pin_thread( thread_, cpu );
+}
+
+bool RenderThread::set_fifo_priority( const int priority )
+{
+  return ::set_fifo_priority( thread_, priority );
+}
+
+void RenderThread::loop( void )
+{
+  /* the display is created here, so its context is current on this thread only */
+  if ( software_ ) {
+    XCBDisplay display { mailbox_.front() };
+    present_loop( display );
+  } else {
+    VideoDisplay display { mailbox_.front(), fullscreen_ };
+    display.set_tile_threshold( tile_threshold_ );
+    present_loop( display );
+  }
+}
+
+template <class Display>
+void RenderThread::present_loop( Display & display )
+{
+  /* nothing to show until the first raster arrives */
+  while ( not stop_ and not mailbox_.wait() ) {}
+
+  while ( not stop_ ) {
+    if ( mailbox_.acquire_latest() ) {
+      publish_to_draw_.record( monotonic_timestamp_us() - mailbox_.front_published_us() );
+      display.draw( mailbox_.front() );
+      presented_.fetch_add( 1, memory_order_relaxed );
+      last_upload_time_.store( display.last_upload_time().count(), memory_order_relaxed );
+      last_draw_time_.store( display.last_draw_time().count(), memory_order_relaxed );
+    } else {
+      /* both displays normally block here until the next vsync */
+      const auto repaint_start = steady_clock::now();
+      display.repaint();
+      duplicated_.fetch_add( 1, memory_order_relaxed );
+
+      /* Without vsync (headless, or a presenter that cannot wait for it)
+         the repaint returns at once. Rather than spin, which would starve
+         other threads on this CPU under SCHED_FIFO, sleep until a new
+         frame or the rest of a refresh interval, whichever comes first. */
+      const auto remaining = duration_cast<nanoseconds>( REFRESH_INTERVAL - ( steady_clock::now() - repaint_start ) );
+      if ( remaining > REFRESH_INTERVAL / 2 ) {
+        const timespec timeout { 0, long( remaining.count() ) };
+        mailbox_.wait( &timeout );
+      }
+    }
+
+    FrameTiming timing;
+    while ( display.pop_timing( timing ) ) {
+      if ( FrameTiming * slot = timings_.try_acquire_write() ) {
+        *slot = timing;
+        timings_.commit_write();
+      }
+    }
+    missed_vsyncs_.store( display.missed_vsyncs(), memory_order_relaxed );
+  }
+}
+
+bool RenderThread::pop_timing( FrameTiming & timing )
+{
+  const FrameTiming * next = timings_.try_acquire_read();
+  if ( not next ) {
+    return false;
+  }
+
+  timing = *next;
+  timings_.release_read();
+  return true;
+}
+
+bool RenderThread::wait_timing( FrameTiming & timing )
+{
+  const FrameTiming * next = timings_.wait_read();
+  if ( not next ) {
+    return false;
+  }
+
+  timing = *next;
+  timings_.release_read();
+  return true;
+}
@@ -0,0 +1,89 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef RENDER_THREAD_HH
+#define RENDER_THREAD_HH
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+
+#include "raster.hh"
+#include "mailbox.hh"
+#include "spsc_queue.hh"
+#include "frame_timing.hh"
+#include "latency_histogram.hh"
+
+/* Owns the GL context on a thread of its own and presents, once per
+   vsync, the newest raster published into its mailbox. The producer never
+   blocks on the display: a raster that is overtaken before the next vsync
+   is dropped, and a vsync with nothing new repeats the previous raster. */
+
+class RenderThread
+{
+private:
+  Mailbox<BaseRaster> mailbox_;
+  const bool fullscreen_;
+  const bool software_;
+  const uint64_t tile_threshold_;
+
+  std::atomic<bool> stop_ { false };
+
+  std::atomic<uint64_t> presented_ { 0 };
+  std::atomic<uint64_t> duplicated_ { 0 };
+  std::atomic<double> last_upload_time_ { 0 };
+  std::atomic<double> last_draw_time_ { 0 };
+  std::atomic<uint64_t> missed_vsyncs_ { 0 };
+  LatencyHistogram publish_to_draw_ {};
+
+  /* completed per-frame timings, for whoever wants them; dropped when full */
+  SPSCQueue<FrameTiming> timings_ { 256 };
+
+  std::thread thread_;
+
+  void loop( void );
+
+  template <class Display>
+  void present_loop( Display & display );
+
+public:
+  /* `software` presents through XCBDisplay instead of OpenGL;
+     `tile_threshold` goes to VideoDisplay::set_tile_threshold() */
+  RenderThread( const uint16_t width, const uint16_t height, const bool fullscreen = false,
+                const bool software = false, const uint64_t tile_threshold = 0 );
+  ~RenderThread();
+
+  /* producer side: fill back_buffer(), then publish() it */
+  BaseRaster & back_buffer( void ) { return mailbox_.back(); }
+  void publish( void ) { mailbox_.publish(); }
+
+  uint64_t presented( void ) const { return presented_.load( std::memory_order_relaxed ); }
+  uint64_t dropped( void ) const { return mailbox_.dropped(); }
+  uint64_t duplicated( void ) const { return duplicated_.load( std::memory_order_relaxed ); }
+
+  uint64_t missed_vsyncs( void ) const { return missed_vsyncs_.load( std::memory_order_relaxed ); }
+
+  /* from publish() to the start of drawing that frame: the display
+     thread's wakeup latency, plus any wait for the vsync in between */
+  const LatencyHistogram & publish_to_draw( void ) const { return publish_to_draw_; }
+
+  /* per-frame timings from the display, in order; the blocking version
+     waits for the next frame to complete, and returns false once stopped */
+  bool pop_timing( FrameTiming & timing );
+  bool wait_timing( FrameTiming & timing );
+
+  /* stops presenting and wakes wait_timing(); the destructor joins */
+  void stop( void );
+
+  /* the presenting thread's CPU and scheduling, as in realtime.hh */
+  void pin( const int cpu );
+  bool set_fifo_priority( const int priority );
+
+  /* seconds spent in the most recent VideoDisplay::draw() */
+  double last_upload_time( void ) const { return last_upload_time_.load( std::memory_order_relaxed ); }
+  double last_draw_time( void ) const { return last_draw_time_.load( std::memory_order_relaxed ); }
+
+  RenderThread( const RenderThread & other ) = delete;
+  RenderThread & operator=( const RenderThread & other ) = delete;
+};
+
+#endif /* RENDER_THREAD_HH */
@@ -0,0 +1,329 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "xcb_display.hh"
+#include "color_convert.hh"
+#include "exception.hh"
+#include "timestamp.hh"
+
+using namespace std;
+using namespace std::chrono;
+
+void XCBDisplay::ConnectionDeleter::operator() ( xcb_connection_t * x ) const
+{
+  xcb_disconnect( x );
+}
+
+static void xcb_check( xcb_connection_t * connection, const xcb_void_cookie_t cookie,
+                       const string & what )
+{
+  unique_ptr<xcb_generic_error_t, decltype( &free )> error { xcb_request_check( connection, cookie ), free };
+
+  if ( error ) {
+    throw runtime_error( "X error " + what + ": " + to_string( error->error_code ) );
+  }
+}
+
+XCBDisplay::XCBDisplay( const BaseRaster & raster, const size_t threads, const string & title )
+  : width_( raster.display_width() ),
+    height_( raster.display_height() ),
+    stride_( 4 * width_ ),
+    connection_( xcb_connect( nullptr, nullptr ) ),
+    screen_( nullptr ),
+    window_( 0 ),
+    gc_( 0 ),
+    workers_( threads )
+{
+  xcb_connection_t * connection = connection_.get();
+
+  if ( xcb_connection_has_error( connection ) ) {
+    throw runtime_error( "could not connect to the X server" );
+  }
+
+  screen_ = xcb_setup_roots_iterator( xcb_get_setup( connection ) ).data;
+  if ( screen_->root_depth != 24 ) {
+    throw Unsupported( "X screen depth " + to_string( screen_->root_depth ) + " (need 24)" );
+  }
+
+  /* MIT-SHM, with pixmap support */
+  unique_ptr<xcb_shm_query_version_reply_t, decltype( &free )> shm_version {
+    xcb_shm_query_version_reply( connection, xcb_shm_query_version( connection ), nullptr ), free };
+
+  if ( not shm_version or not shm_version->shared_pixmaps ) {
+    throw Unsupported( "X server without MIT-SHM shared pixmaps" );
+  }
+
+  /* window */
+  window_ = xcb_generate_id( connection );
+  const uint32_t window_values[] = { screen_->black_pixel,
+                                     XCB_EVENT_MASK_EXPOSURE | XCB_EVENT_MASK_STRUCTURE_NOTIFY };
+  xcb_check( connection,
+             xcb_create_window_checked( connection, XCB_COPY_FROM_PARENT, window_, screen_->root,
+                                        0, 0, width_, height_, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT,
+                                        screen_->root_visual, XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK,
+                                        window_values ),
+             "creating window" );
+
+  xcb_change_property( connection, XCB_PROP_MODE_REPLACE, window_, XCB_ATOM_WM_NAME,
+                       XCB_ATOM_STRING, 8, title.size(), title.data() );
+
+  gc_ = xcb_generate_id( connection );
+  xcb_create_gc( connection, gc_, window_, 0, nullptr );
+
+  for ( size_t i = 0; i < BUFFER_COUNT; i++ ) {
+    create_buffer();
+  }
+
+  /* Present, with completion and idle events delivered on their own queue */
+  const xcb_query_extension_reply_t * present_extension = xcb_get_extension_data( connection, &xcb_present_id );
+
+  if ( present_extension and present_extension->present ) {
+    unique_ptr<xcb_present_query_version_reply_t, decltype( &free )> present_version {
+      xcb_present_query_version_reply( connection, xcb_present_query_version( connection, 1, 0 ), nullptr ),
+      free };
+
+    if ( present_version ) {
+      const xcb_present_event_t event_id = xcb_generate_id( connection );
+      xcb_present_select_input( connection, event_id, window_,
+                                XCB_PRESENT_EVENT_MASK_COMPLETE_NOTIFY | XCB_PRESENT_EVENT_MASK_IDLE_NOTIFY );
+      present_events_ = xcb_register_for_special_xge( connection, &xcb_present_id, event_id, nullptr );
+      have_present_ = present_events_ != nullptr;
+    }
+  }
+
+  xcb_map_window( connection, window_ );
+  xcb_flush( connection );
+}
+
+void XCBDisplay::create_buffer( void )
+{
+  xcb_connection_t * connection = connection_.get();
+  Buffer buffer { -1, nullptr, 0, 0, false };
+
+  buffer.shmid = SystemCall( "shmget", shmget( IPC_PRIVATE, stride_ * height_, IPC_CREAT | 0600 ) );
+
+  void * mapping = shmat( buffer.shmid, nullptr, 0 );
+  if ( mapping == reinterpret_cast<void *>( -1 ) ) {
+    shmctl( buffer.shmid, IPC_RMID, nullptr );
+    throw unix_error( "shmat" );
+  }
+  buffer.data = static_cast<uint8_t *>( mapping );
+
+  buffer.segment = xcb_generate_id( connection );
+  const xcb_void_cookie_t attach = xcb_shm_attach_checked( connection, buffer.segment, buffer.shmid, 0 );
+
+  /* the attach request holds its own reference, so the segment can be
+     marked for removal now and vanishes once both sides detach */
+  try {
+    xcb_check( connection, attach, "attaching shared memory" );
+  } catch ( const exception & ) {
+    shmctl( buffer.shmid, IPC_RMID, nullptr );
+    shmdt( buffer.data );
+    throw;
+  }
+  shmctl( buffer.shmid, IPC_RMID, nullptr );
+
+  buffer.pixmap = xcb_generate_id( connection );
+  xcb_shm_create_pixmap( connection, buffer.pixmap, window_, width_, height_,
+                         screen_->root_depth, buffer.segment, 0 );
+
+  buffers_.push_back( buffer );
+}
+
+XCBDisplay::~XCBDisplay()
+{
+  xcb_connection_t * connection = connection_.get();
+
+  if ( present_events_ ) {
+    xcb_unregister_for_special_event( connection, present_events_ );
+  }
+
+  for ( const Buffer & buffer : buffers_ ) {
+    xcb_free_pixmap( connection, buffer.pixmap );
+    xcb_shm_detach( connection, buffer.segment );
+  }
+
+  xcb_free_gc( connection, gc_ );
+  xcb_destroy_window( connection, window_ );
+
+  /* make sure the server has detached before our mappings go away */
+  free( xcb_get_input_focus_reply( connection, xcb_get_input_focus( connection ), nullptr ) );
+
+  for ( const Buffer & buffer : buffers_ ) {
+    shmdt( buffer.data );
+  }
+}
+
+/* returns true if this was the CompleteNotify for `awaited_serial` */
+bool XCBDisplay::handle_present_event( xcb_generic_event_t * event, const uint32_t awaited_serial )
+{
+  unique_ptr<xcb_generic_event_t, decltype( &free )> owned { event, free };
+  const auto generic = reinterpret_cast<const xcb_present_generic_event_t *>( event );
+
+  switch ( generic->evtype ) {
+  case XCB_PRESENT_EVENT_IDLE_NOTIFY:
+    {
+      const auto idle = reinterpret_cast<const xcb_present_idle_notify_event_t *>( event );
+      for ( Buffer & buffer : buffers_ ) {
+        if ( buffer.pixmap == idle->pixmap ) {
+          buffer.busy = false;
+        }
+      }
+      return false;
+    }
+
+  case XCB_PRESENT_EVENT_COMPLETE_NOTIFY:
+    {
+      const auto complete = reinterpret_cast<const xcb_present_complete_notify_event_t *>( event );
+      if ( complete->kind != XCB_PRESENT_COMPLETE_KIND_PIXMAP ) {
+        return false;
+      }
+
+      skipped_ += complete->mode == XCB_PRESENT_COMPLETE_MODE_SKIP;
+      last_msc_ = complete->msc;
+      last_ust_ = complete->ust;
+      return complete->serial == awaited_serial;
+    }
+
+  default:
+    return false;
+  }
+}
+
+void XCBDisplay::drain_window_events( void )
+{
+  xcb_generic_event_t * event;
+  while ( ( event = xcb_poll_for_event( connection_.get() ) ) ) {
+    free( event );
+  }
+
+  if ( xcb_connection_has_error( connection_.get() ) ) {
+    throw runtime_error( "lost connection to the X server" );
+  }
+}
+
+size_t XCBDisplay::idle_buffer( void )
+{
+  while ( true ) {
+    for ( size_t i = 0; i < buffers_.size(); i++ ) {
+      if ( not buffers_[ i ].busy and int( i ) != last_presented_ ) {
+        return i;
+      }
+    }
+
+    /* every buffer is still held by the server; wait for an IdleNotify */
+    xcb_generic_event_t * event = xcb_wait_for_special_event( connection_.get(), present_events_ );
+    if ( not event ) {
+      throw runtime_error( "lost connection to the X server" );
+    }
+    handle_present_event( event, 0 );
+  }
+}
+
+void XCBDisplay::present( const size_t index, const bool frame, const int64_t capture_timestamp )
+{
+  xcb_connection_t * connection = connection_.get();
+  Buffer & buffer = buffers_[ index ];
+
+  const auto present_start = steady_clock::now();
+
+  if ( have_present_ ) {
+    const uint32_t serial = ++serial_;
+    buffer.busy = true;
+
+    /* target_msc 0, divisor 0: at the next vblank */
+    xcb_present_pixmap( connection, window_, buffer.pixmap, serial, 0, 0, 0, 0, 0, 0, 0,
+                        XCB_PRESENT_OPTION_NONE, 0, 0, 0, 0, nullptr );
+    xcb_flush( connection );
+
+    while ( true ) {
+      xcb_generic_event_t * event = xcb_wait_for_special_event( connection, present_events_ );
+      if ( not event ) {
+        throw runtime_error( "lost connection to the X server" );
+      }
+      if ( handle_present_event( event, serial ) ) {
+        break;
+      }
+    }
+  } else {
+    xcb_copy_area( connection, buffer.pixmap, window_, gc_, 0, 0, 0, 0, width_, height_ );
+    free( xcb_get_input_focus_reply( connection, xcb_get_input_focus( connection ), nullptr ) );
+  }
+
+  last_present_time_ = steady_clock::now() - present_start;
+  last_presented_ = index;
+
+  FrameTiming timing;
+  timing.capture_timestamp = capture_timestamp;
+  timing.upload_time = last_conversion_time_.count();
+
+  if ( have_present_ ) {
+    const uint64_t previous_msc = last_present_msc_;
+    last_present_msc_ = last_msc_;
+
+    timing.present_timestamp = last_ust_;
+    timing.present_from_server = true;
+    timing.msc = last_msc_;
+
+    /* consecutive presents should land on consecutive vblanks */
+    if ( previous_msc and last_msc_ > previous_msc + 1 ) {
+      missed_vsyncs_ += last_msc_ - previous_msc - 1;
+      unreported_missed_vsyncs_ += last_msc_ - previous_msc - 1;
+    }
+  } else {
+    timing.present_timestamp = monotonic_timestamp_us();
+  }
+
+  if ( frame ) {
+    timing.missed_vsyncs = unreported_missed_vsyncs_;
+    unreported_missed_vsyncs_ = 0;
+
+    static constexpr size_t MAX_COMPLETED = 1024;
+    if ( completed_timings_.size() >= MAX_COMPLETED ) {
+      completed_timings_.pop_front();
+    }
+    completed_timings_.push_back( timing );
+  }
+
+  drain_window_events();
+}
+
+void XCBDisplay::draw( const BaseRaster & raster )
+{
+  if ( raster.display_width() != width_ or raster.display_height() != height_ ) {
+    throw Invalid( "inconsistent raster dimensions." );
+  }
+
+  const size_t index = idle_buffer();
+  uint8_t * data = buffers_[ index ].data;
+
+  const auto conversion_start = steady_clock::now();
+  workers_.parallel_for( height_, [&]( const size_t begin, const size_t end ) {
+      i420_to_bgrx( raster, data, stride_, begin, end );
+    } );
+  last_conversion_time_ = steady_clock::now() - conversion_start;
+
+  present( index, true, raster.capture_timestamp() );
+}
+
+void XCBDisplay::repaint( void )
+{
+  if ( last_presented_ < 0 ) {
+    return;
+  }
+
+  present( last_presented_, false, 0 );
+}
+
+bool XCBDisplay::pop_timing( FrameTiming & timing )
+{
+  if ( completed_timings_.empty() ) {
+    return false;
+  }
+
+  timing = completed_timings_.front();
+  completed_timings_.pop_front();
+  return true;
+}
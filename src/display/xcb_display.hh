@@ -0,0 +1,111 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef XCB_DISPLAY_HH
+#define XCB_DISPLAY_HH
+
+#include <xcb/xcb.h>
+#include <xcb/shm.h>
+#include <xcb/present.h>
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "raster.hh"
+#include "worker_pool.hh"
+#include "frame_timing.hh"
+
+/* Software counterpart of VideoDisplay for machines without usable GL.
+   Frames are converted to BGRX on the CPU (SSE2, split across a worker
+   pool) straight into MIT-SHM pixmaps, and shown with the Present
+   extension, which reports when each frame actually reached the screen.
+   Without Present it falls back to CopyArea plus a round trip.
+
+   Works under Xvfb, whose Present vblanks are simulated; run it with
+   `-fakescreenfps 60` or the completion events arrive once a second. */
+
+class XCBDisplay
+{
+private:
+  struct ConnectionDeleter { void operator() ( xcb_connection_t * x ) const; };
+
+  /* one shared-memory segment, wrapped in a pixmap the server can present */
+  struct Buffer
+  {
+    int shmid;
+    uint8_t * data;
+    xcb_shm_seg_t segment;
+    xcb_pixmap_t pixmap;
+    bool busy;
+  };
+
+  static constexpr size_t BUFFER_COUNT = 3;
+
+  unsigned int width_, height_;
+  size_t stride_;
+
+  std::unique_ptr<xcb_connection_t, ConnectionDeleter> connection_;
+  xcb_screen_t * screen_;
+  xcb_window_t window_;
+  xcb_gcontext_t gc_;
+
+  std::vector<Buffer> buffers_ {};
+  int last_presented_ { -1 };
+
+  bool have_present_ { false };
+  xcb_special_event_t * present_events_ { nullptr };
+  uint32_t serial_ { 0 };
+
+  WorkerPool workers_;
+
+  std::chrono::duration<double> last_conversion_time_ {};
+  std::chrono::duration<double> last_present_time_ {};
+  uint64_t last_msc_ { 0 };
+  uint64_t last_ust_ { 0 };
+  uint64_t last_present_msc_ { 0 };
+  uint64_t skipped_ { 0 };
+
+  std::deque<FrameTiming> completed_timings_ {};
+  uint64_t missed_vsyncs_ { 0 };
+  unsigned int unreported_missed_vsyncs_ { 0 };
+
+  void create_buffer( void );
+  size_t idle_buffer( void );
+  void present( const size_t index, const bool frame, const int64_t capture_timestamp );
+  bool handle_present_event( xcb_generic_event_t * event, const uint32_t awaited_serial );
+  void drain_window_events( void );
+
+public:
+  XCBDisplay( const BaseRaster & raster, const size_t threads = std::thread::hardware_concurrency(),
+              const std::string & title = "VP8 Player" );
+  ~XCBDisplay();
+
+  /* converts and presents the raster, returning once it is on screen */
+  void draw( const BaseRaster & raster );
+
+  /* presents the previous frame again */
+  void repaint( void );
+
+  /* time to convert the last frame, and from present request to completion */
+  std::chrono::duration<double> last_upload_time( void ) const { return last_conversion_time_; }
+  std::chrono::duration<double> last_draw_time( void ) const { return last_present_time_; }
+
+  /* vblank counter and timestamp (microseconds) of the last completed present */
+  uint64_t last_msc( void ) const { return last_msc_; }
+  uint64_t last_ust( void ) const { return last_ust_; }
+
+  /* presents the server reported as skipped, because a newer one replaced them */
+  uint64_t skipped( void ) const { return skipped_; }
+
+  /* per-frame timing, as VideoDisplay reports it (no GPU time) */
+  bool pop_timing( FrameTiming & timing );
+  uint64_t missed_vsyncs( void ) const { return missed_vsyncs_; }
+
+  XCBDisplay( const XCBDisplay & other ) = delete;
+  XCBDisplay & operator=( const XCBDisplay & other ) = delete;
+};
+
+#endif /* XCB_DISPLAY_HH */
@@ -1,28 +1,79 @@
 /* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
 
+#include <algorithm>
 #include <atomic>
+#include <cmath>
+#include <csignal>
+#include <cstring>
 #include <getopt.h>
 #include <unistd.h>
 #include <chrono>
+#include <fstream>
 #include <iostream>
-#include <list>
+#include <map>
+#include <sstream>
 #include <string>
-#include <mutex>
-#include <condition_variable>
-#include <queue>
 #include <thread>
+#include <vector>
 #include <memory>
 
 #include <pulse/sample.h>
 
 #include "h264_degrader.hh"
+#include "opus_degrader.hh"
 #include "raster.hh"
-#include "display.hh"
+#include "y4m.hh"
+#include "render_thread.hh"
 #include "camera.hh"
 #include "audio.hh"
+#include "pulse_audio.hh"
+#include "audio_file.hh"
+#include "media_clock.hh"
+#include "audio_resampler.hh"
+#include "drift_compensator.hh"
+#include "signalfd.hh"
+#include "event_loop.hh"
+#include "pipeline.hh"
+#include "realtime.hh"
+#include "latency_histogram.hh"
+#include "timestamp.hh"
 
 using namespace std;
 
+/* what the record stage writes: a captured frame, and what the degrader made of it */
+struct RecordedFrame
+{
+  BaseRaster original, degraded;
+
+  RecordedFrame( const uint16_t width, const uint16_t height )
+    : original( width, height, width, height ), degraded( width, height, width, height )
+  {}
+};
+
+/* the threads --pin can place */
+static const vector<string> THREAD_NAMES { "capture", "audio-capture", "decode", "degrade",
+                                            "record", "audio-play", "display" };
+
+/* "name=cpu,name=cpu,..." */
+static map<string, int> parse_pinning( const string & spec )
+{
+  map<string, int> cpus;
+  istringstream list { spec };
+  string entry;
+
+  while ( getline( list, entry, ',' ) ) {
+    const size_t equals = entry.find( '=' );
+    const string name = entry.substr( 0, equals );
+
+    if ( equals == string::npos or find( THREAD_NAMES.begin(), THREAD_NAMES.end(), name ) == THREAD_NAMES.end() ) {
+      throw runtime_error( "invalid --pin entry: " + entry );
+    }
+    cpus[ name ] = allowed_cpu( stoi( entry.substr( equals + 1 ) ) );
+  }
+
+  return cpus;
+}
+
 int main( int argc, char * argv[] )
 {
   const uint16_t width = 1280;
@@ -33,7 +84,28 @@ int main( int argc, char * argv[] )
   string audio_sink = "";
   unsigned int fps = 30;
   size_t delay = 1;
+  double delay_ms = -1;
+  double audio_period_ms = 10;
   size_t quantizer = 24;
+  int64_t static_threshold = -1;
+  /* SAD over a 64x64 tile and its chroma (6144 samples) below which the
+     display does not upload it again: half a level per sample absorbs the
+     sensor noise the degrader passes on, and a smaller real change is
+     held back only until it adds up past the threshold */
+  uint64_t tile_threshold = 3072;
+  bool software_display = false;
+  bool async_audio = false;
+  string audio_source_file = "";
+  string audio_sink_file = "";
+  AudioPacing audio_file_pacing = AudioPacing::RealTime;
+  bool drift_compensation = true;
+  unsigned int opus_bitrate = 0;
+  OpusDegrader::Parameters opus;
+  string timing_filename = "";
+  OverflowPolicy video_policy = OverflowPolicy::Block;
+  map<string, int> pinning;
+  int realtime_priority = 0;
+  bool memory_locking = false;
 
   string before_filename = "before.y4m";
   string after_filename = "after.y4m";
@@ -44,9 +116,27 @@ int main( int argc, char * argv[] )
     { "audio-source", required_argument, NULL, 'a' },
     { "audio-sink",   required_argument, NULL, 'A' },
     { "delay",        required_argument, NULL, 'd' },
+    { "delay-ms",     required_argument, NULL, 'D' },
+    { "audio-period-ms", required_argument, NULL, 'p' },
     { "before-file",   required_argument, NULL, 'x' },
     { "after-file",    required_argument, NULL, 'y' },
     { "quantizer",    required_argument, NULL, 'q' },
+    { "static-threshold", required_argument, NULL, 's' },
+    { "tile-threshold", required_argument, NULL, 'T' },
+    { "software-display", no_argument,       NULL, 'S' },
+    { "async-audio",  no_argument,       NULL, 'P' },
+    { "audio-source-file", required_argument, NULL, 'i' },
+    { "audio-sink-file",   required_argument, NULL, 'I' },
+    { "free-running-audio", no_argument,      NULL, 'R' },
+    { "no-drift-compensation", no_argument,   NULL, 'N' },
+    { "opus-bitrate", required_argument, NULL, 'o' },
+    { "opus-frame-ms", required_argument, NULL, 'O' },
+    { "opus-complexity", required_argument, NULL, 'C' },
+    { "timing-log",   required_argument, NULL, 't' },
+    { "video-policy", required_argument, NULL, 'V' },
+    { "pin",          required_argument, NULL, 'K' },
+    { "realtime",     required_argument, NULL, 'r' },
+    { "lock-memory",  no_argument,       NULL, 'L' },
     { 0, 0, 0, 0 }
   };
 
@@ -63,29 +153,148 @@ int main( int argc, char * argv[] )
     case 'a': audio_source = optarg; break;
     case 'A': audio_sink = optarg; break;
     case 'd': delay = stoul( optarg ); break;
+    case 'D': delay_ms = stod( optarg ); break;
+    case 'p': audio_period_ms = stod( optarg ); break;
     case 'x': before_filename = optarg; break;
     case 'y': after_filename = optarg; break;
     case 'q': quantizer = stoul( optarg ); break;
+    case 's': static_threshold = stoll( optarg ); break;
+    case 'T': tile_threshold = stoull( optarg ); break;
+    case 'S': software_display = true; break;
+    case 'P': async_audio = true; break;
+    case 'i': audio_source_file = optarg; break;
+    case 'I': audio_sink_file = optarg; break;
+    case 'R': audio_file_pacing = AudioPacing::FreeRunning; break;
+    case 'N': drift_compensation = false; break;
+    case 'o': opus_bitrate = stoul( optarg ); break;
+    case 'O': opus.frame_ms = stod( optarg ); break;
+    case 'C': opus.complexity = stoul( optarg ); break;
+    case 't': timing_filename = optarg; break;
+    case 'V': video_policy = overflow_policy( optarg ); break;
+    case 'K': pinning = parse_pinning( optarg ); break;
+    case 'r': realtime_priority = stoi( optarg ); break;
+    case 'L': memory_locking = true; break;
 
     default: throw runtime_error( "invalid option" );
     }
   }
 
-  /* AUDIO STUFF */
+  /* Shutdown is driven by signals, read from a signalfd on this thread.
+     They are blocked before any thread (ours, or PulseAudio's) starts, so
+     every thread inherits the mask and none is interrupted by them. */
+  const SignalMask shutdown_signals { SIGINT, SIGTERM, SIGHUP };
+  shutdown_signals.set_as_mask();
+  SignalFD signal_fd { shutdown_signals };
+
+  /* the video stages run one below it, which must still be a SCHED_FIFO priority */
+  if ( realtime_priority and ( realtime_priority < 2 or realtime_priority > 99 ) ) {
+    throw runtime_error( "--realtime priority must be from 2 to 99" );
+  }
+
+  /* Before anything is allocated, so that every raster, device buffer and
+     codec buffer is faulted in as it is allocated at startup, and none on
+     first use in the middle of a frame. */
+  const bool memory_locked = memory_locking and lock_memory();
+  if ( memory_locking and not memory_locked ) {
+    cerr << "warning: not permitted to lock memory; continuing without" << endl;
+  }
+
+  /* AUDIO STUFF: 16-bit stereo, at the source's native rate so the
+     server does not resample capture. Raw files are taken to be 44.1 kHz. */
   pa_sample_spec ss;
   ss.format = PA_SAMPLE_S16LE;
   ss.rate = 44100;
   ss.channels = 2;
 
-  size_t audio_bytes_per_frame = pa_bytes_per_second( &ss ) / fps;
-  cout << audio_bytes_per_frame << endl;
+  const DeviceFormat source_format = audio_source_file.empty()
+    ? query_source_format( audio_source )
+    : DeviceFormat { audio_source_file, AudioFileReader::file_sample_spec( audio_source_file, ss ) };
+  ss.rate = source_format.sample_spec.rate;
+
+  /* Opus only runs at its own rates */
+  const bool opus_rate = ss.rate == 8000 or ss.rate == 12000 or ss.rate == 16000
+                         or ss.rate == 24000 or ss.rate == 48000;
+  if ( opus_bitrate and not opus_rate ) {
+    ss.rate = 48000;
+  }
+  opus.sample_rate = ss.rate;
+
+  /* the sink runs at its own native rate; if that differs, one resampler runs here */
+  pa_sample_spec sink_ss = ss;
+  const DeviceFormat sink_format = audio_sink_file.empty()
+    ? query_sink_format( audio_sink )
+    : DeviceFormat { audio_sink_file, ss };
+  sink_ss.rate = sink_format.sample_spec.rate;
+
+  cout << "audio source:\t" << source_format.name << "\tserver converts:\t"
+       << describe_conversion( source_format.sample_spec, ss ) << endl;
+  cout << "audio sink:\t" << sink_format.name << "\tserver converts:\t"
+       << describe_conversion( sink_ss, sink_format.sample_spec ) << endl;
+  cout << "in-process resampling:\t"
+       << ( ss.rate == sink_ss.rate ? "none" : to_string( ss.rate ) + " -> " + to_string( sink_ss.rate ) + " Hz" )
+       << ( drift_compensation ? " (with drift compensation)" : "" ) << endl;
+
+  /* Audio moves in short fixed periods, independent of the video frame
+     rate, and the delay line is a duration (`--delay` frames, unless
+     given in milliseconds) rounded to whole periods. */
+  const size_t audio_period_samples = max( 1.0, ss.rate * audio_period_ms / 1000 );
+  const size_t audio_period_bytes = audio_period_samples * pa_frame_size( &ss );
+  const int64_t audio_period = pa_bytes_to_usec( audio_period_bytes, &ss );
+
+  if ( delay_ms < 0 ) {
+    delay_ms = 1000.0 * delay / fps;
+  }
+
+  const size_t audio_delay_periods = max( 1.0, round( delay_ms * 1000 / audio_period ) );
+  cout << "audio period:\t" << audio_period / 1000.0 << " ms (" << audio_period_bytes << " bytes)"
+       << "\tdelay:\t" << audio_delay_periods << " periods" << endl;
 
   pa_buffer_attr ba;
-  ba.maxlength = 4 * audio_bytes_per_frame;
-  ba.prebuf = audio_bytes_per_frame;
-  ba.fragsize = audio_bytes_per_frame;
+  ba.maxlength = -1;
+  ba.tlength = 2 * audio_period_bytes;
+  ba.prebuf = audio_period_bytes;
+  ba.minreq = audio_period_bytes;
+  ba.fragsize = audio_period_bytes;
+
+  /* The capture and playback clocks drift apart from each other and from
+     the camera's (CLOCK_MONOTONIC) timestamps, which shows up as a creep
+     in how long ago the audio being heard was captured. The resampler
+     trims its ratio to hold that constant, so no audio or video is ever
+     dropped or repeated for it. */
+  unique_ptr<AudioResampler> resampler;
+  vector<int16_t> resampled;
+  DriftCompensator drift;
+  if ( sink_ss.rate != ss.rate or drift_compensation ) {
+    resampler.reset( new AudioResampler( ss.rate, sink_ss.rate, ss.channels, audio_period_samples ) );
+    resampled.resize( resampler->max_output_frames() * ss.channels );
+  }
+
+  /* the same period, in the sink's format */
+  const size_t sink_period_bytes = pa_usec_to_bytes( audio_period, &sink_ss );
+  pa_buffer_attr sink_ba = ba;
+  sink_ba.tlength = 2 * sink_period_bytes;
+  sink_ba.prebuf = sink_ba.minreq = sink_ba.fragsize = sink_period_bytes;
+
+  /* the asynchronous backend sizes its own server buffers, starting from one period;
+     files stand in for either end when benchmarking without a sound server */
+  unique_ptr<AudioSource> audio_reader;
+  unique_ptr<AudioSink> audio_writer;
+
+  if ( not audio_source_file.empty() ) {
+    audio_reader.reset( new AudioFileReader( audio_source_file, ss, audio_file_pacing ) );
+  } else if ( async_audio ) {
+    audio_reader.reset( new AsyncAudioReader( audio_source, ss, audio_period_bytes ) );
+  } else {
+    audio_reader.reset( new AudioReader( audio_source, ss, ba ) );
+  }
 
-  AudioReader audio_reader { audio_source, ss, ba };
+  if ( not audio_sink_file.empty() ) {
+    audio_writer.reset( new AudioFileWriter( audio_sink_file, sink_ss, audio_file_pacing ) );
+  } else if ( async_audio ) {
+    audio_writer.reset( new AsyncAudioWriter( audio_sink, sink_ss, sink_period_bytes ) );
+  } else {
+    audio_writer.reset( new AudioWriter( audio_sink, sink_ss, sink_ba ) );
+  }
 
   /* CAMERA */
   Camera camera { width, height, 1 << 20, 40, V4L2_PIX_FMT_MJPEG, camera_path };
@@ -93,137 +302,479 @@ int main( int argc, char * argv[] )
   /* DEGRADER */
   H264_degrader degrader { width, height, 1 << 20, quantizer };
 
-  /* VIDEO DISPLAY */
-  BaseRasterQueue video_frames { delay, width, height, width, height };
-  list<string> audio_frames {};
+  if ( static_threshold >= 0 ) {
+    degrader.set_static_threshold( static_threshold );
+  }
 
-  atomic<size_t> video_frame_count(0);
-  atomic<size_t> audio_frame_count(0);
+  /* AUDIO DEGRADER: off unless given a bitrate */
+  unique_ptr<OpusDegrader> audio_degrader;
+  if ( opus_bitrate ) {
+    opus.channels = ss.channels;
+    opus.bitrate = opus_bitrate;
+    audio_degrader.reset( new OpusDegrader( opus, audio_period_samples ) );
+    cout << "audio codec:\t" << audio_degrader->parameter_string()
+         << "\tlatency:\t" << audio_degrader->latency() / 1000.0 << " ms" << endl;
+  }
 
-  mutex video_mtx;
-  condition_variable video_cv;
+  /* THE PIPELINE: stages on threads of their own, connected by bounded
+     edges that each have an overflow policy and count what they drop.
+
+       camera -> [capture] -> decode -> [video] -> degrade -> [record] -> record
+                                                      `-> display
+       audio source -> [audio] -> audio play
+
+     Capture runs from an event loop and never blocks; a frame the decoder
+     has not taken yet is superseded by the next (drop-oldest). The video
+     edge holds frames while they wait for the audio captured with them to
+     be heard, and its policy is --video-policy: when the degrader falls
+     behind, blocking backs up to the capture edge, while the drop
+     policies shed the backlog here. Recording blocks, so before and
+     after stay frame-aligned. The display is the RenderThread, whose
+     mailbox always keeps only the newest frame. */
+  MediaClock media_clock;
+  atomic<uint64_t> late_frames { 0 };
+  LatencyHistogram camera_wakeups, audio_capture_latency, clock_wakeups;
+
+  /* A paced file's latency() is how late its period's timer was served,
+     which is a wakeup; PulseAudio's is how much captured audio was still
+     buffered, which is not. Free-running files have none. */
+  const bool paced_audio_file = not audio_source_file.empty() and audio_file_pacing == AudioPacing::RealTime;
+  const int64_t frame_interval = 1000000 / fps;
+
+  Edge<CameraFrame> capture_edge { "capture", OverflowPolicy::DropOldest, 1 };
+  capture_edge.set_drop_handler( [&]( CameraFrame & frame ) { camera.release_frame( frame ); } );
+
+  const size_t video_queue_length = ceil( delay_ms * fps / 1000 ) + 4;
+  Edge<BaseRaster> video_edge { "video", video_policy, video_queue_length, width, height, width, height };
+
+  Edge<RecordedFrame> record_edge { "record", OverflowPolicy::Block, 4, width, height };
+
+  /* The delay line, of preallocated one-period audio frames, and a spare
+     so capture is not held up while the oldest one is being played. When
+     the source is served from the capture loop, a full delay line must not
+     hold up the camera, so a period with no room is dropped (an overrun,
+     as a device would have) instead of blocking. */
+  FileDescriptor * audio_ready = audio_reader->readiness_fd( audio_period_bytes );
+  Edge<AudioFrame> audio_edge { "audio", audio_ready ? OverflowPolicy::DropNewest : OverflowPolicy::Block,
+                                audio_delay_periods + 1, audio_period_bytes };
+
+  Y4MWriter foriginal { before_filename, { width, height, fps } };
+  Y4MWriter fdegraded { after_filename, { width, height, fps } };
+
+  /* a dropped period is still read, so the source does not back up */
+  vector<uint8_t> discarded_audio( audio_period_bytes );
+
+  auto capture_audio_period = [&]()
+    {
+      AudioFrame * audio_frame = audio_edge.acquire_write();
+      if ( not audio_frame ) {
+        if ( not audio_edge.closed() ) {
+          audio_reader->read( discarded_audio.data(), audio_period_bytes );
+        }
+        return;
+      }
 
-  mutex audio_mtx;
-  condition_variable audio_cv;
+      audio_reader->read( audio_frame->data(), audio_period_bytes );
 
-  const string yuv4mpeg_header = "YUV4MPEG2 W1280 H720 F24:1 Ip A0:0 C420\n";
-  const string frame_header = "FRAME\n";
+      /* the last sample read was captured `latency` ago */
+      const uint64_t read_latency = audio_reader->latency();
+      audio_capture_latency.record( read_latency );
+      audio_frame->capture_timestamp = monotonic_timestamp_us() - read_latency - audio_period;
 
-  unique_ptr<FILE, decltype( &fclose )> foriginal { fopen( before_filename.c_str(), "wb" ), fclose };
-  unique_ptr<FILE, decltype( &fclose )> fdegraded { fopen( after_filename.c_str(), "wb" ),  fclose };
+      /* in place; what comes out was captured the codec's latency earlier */
+      if ( audio_degrader ) {
+        audio_degrader->degrade( audio_frame->data(), audio_frame->data(), audio_period_bytes );
+        audio_frame->capture_timestamp -= audio_degrader->latency();
+      }
+      audio_edge.commit_write();
+    };
 
-  fwrite( yuv4mpeg_header.c_str(), sizeof( char ), yuv4mpeg_header.size(), foriginal.get() );
-  fwrite( yuv4mpeg_header.c_str(), sizeof( char ), yuv4mpeg_header.size(), fdegraded.get() );
+  const auto cpu_for = [&]( const string & name ) { return pinning.count( name ) ? pinning.at( name ) : -1; };
 
-  if ( foriginal.get() == nullptr or fdegraded.get() == nullptr ) {
-    throw runtime_error( "could not open before or after file" );
-  }
+  /* CAPTURE: the camera and, when its backend can say when a period is
+     ready, the audio source, served from one event loop; each frame costs
+     one wakeup, and each dispatch counts as one item of the stage's
+     service. The callbacks are registered on the loop's own thread.
+     Stopping the loop closes the edges it feeds. */
+  EventLoop capture_loop;
 
-  thread video_read_thread {
-    [&]()
+  Stage capture_stage {
+    "capture",
+    [&]( Stage & stage )
+    {
+      capture_loop.add( camera.fd(), EventLoop::In,
+                        [&]()
+                        {
+                          Stage::ServiceTimer timer { stage };
+
+                          CameraFrame frame;
+                          if ( not camera.dequeue_frame( frame ) ) {
+                            return EventLoop::Result::Continue;
+                          }
+
+                          /* from the driver's timestamp, which usually marks the end of the frame */
+                          camera_wakeups.record( monotonic_timestamp_us() - frame.capture_timestamp );
+
+                          CameraFrame * slot = capture_edge.acquire_write();
+                          if ( not slot ) {
+                            camera.release_frame( frame );
+                            return EventLoop::Result::Continue;
+                          }
+
+                          *slot = frame;
+                          capture_edge.commit_write();
+                          return EventLoop::Result::Continue;
+                        } );
+
+      if ( audio_ready ) {
+        capture_loop.add( *audio_ready, EventLoop::In,
+                          [&]()
+                          {
+                            Stage::ServiceTimer timer { stage };
+                            capture_audio_period();
+                            return EventLoop::Result::Continue;
+                          } );
+      }
+
+      capture_loop.run();
+      capture_edge.close();
+      if ( audio_ready ) {
+        audio_edge.close();
+      }
+    },
+    cpu_for( "capture" )
+  };
+
+  /* the blocking backends (pa_simple, unpaced files) get a stage of their
+     own, which runs until shutdown clears `running` */
+  atomic<bool> running { true };
+  unique_ptr<Stage> audio_capture_stage;
+  if ( not audio_ready ) {
+    audio_capture_stage.reset( new Stage {
+      "audio-capture",
+      [&]( Stage & stage )
       {
-        while(true) {
-          unique_lock<mutex> ul { video_mtx };
-          video_cv.wait(ul, [&](){ return video_frames.occupancy < delay; });
+        while ( running ) {
+          Stage::ServiceTimer timer { stage };
+          capture_audio_period();
+        }
+        audio_edge.close();
+      },
+      cpu_for( "audio-capture" )
+    } );
+  }
+
+  Stage decode_stage {
+    "decode",
+    [&]( Stage & stage )
+    {
+      while ( CameraFrame * frame = capture_edge.wait_read() ) {
+        if ( BaseRaster * raster = video_edge.acquire_write() ) {
+          {
+            Stage::ServiceTimer timer { stage };
+            camera.decode_frame( *frame, *raster );
+          }
+          video_edge.commit_write();
+        }
+
+        camera.release_frame( *frame );
+        capture_edge.release_read();
+      }
+      video_edge.close();
+    },
+    cpu_for( "decode" )
+  };
 
-          BaseRaster &r = video_frames.back();
-          camera.get_next_frame( r );
-          video_cv.notify_all();
+  /* VIDEO DISPLAY: presented on its own thread, so vsync never stalls the degrader */
+  RenderThread renderer { width, height, false, software_display, tile_threshold };
+  if ( pinning.count( "display" ) ) {
+    renderer.pin( pinning.at( "display" ) );
+  }
 
-          fwrite( frame_header.c_str(), sizeof( char ), frame_header.size(), foriginal.get() );
-          r.dump( foriginal.get() );
+  Stage degrade_stage {
+    "degrade",
+    [&]( Stage & stage )
+    {
+      while ( BaseRaster * original = video_edge.wait_read() ) {
+        BaseRaster & degraded = renderer.back_buffer();
+        {
+          Stage::ServiceTimer timer { stage };
+          degrader.degrade( *original, degraded );
         }
+
+        if ( RecordedFrame * record = record_edge.acquire_write() ) {
+          record->original.copy_from( *original );
+          record->degraded.copy_from( degraded );
+          record_edge.commit_write();
+        }
+        video_edge.release_read();
+
+        /* show the frame once the audio captured with it is being heard;
+           if it had to wait, its lateness is how long waking up took */
+        const bool early = media_clock.running()
+                           and media_clock.wall_time( degraded.capture_timestamp() ) > monotonic_timestamp_us();
+        int64_t lateness = 0;
+        media_clock.wait_until( degraded.capture_timestamp(), &lateness );
+        if ( lateness > frame_interval ) {
+          late_frames++;
+        }
+        if ( early ) {
+          clock_wakeups.record( lateness );
+        }
+
+        renderer.publish();
       }
+      record_edge.close();
+    },
+    cpu_for( "degrade" )
   };
 
-  bool first_degraded_frame = true;
+  Stage record_stage {
+    "record",
+    [&]( Stage & stage )
+    {
+      bool first_degraded_frame = true;
 
-  thread video_play_thread {
-    [&]()
-      {
-        BaseRaster v { width, height, width, height };
-        VideoDisplay display { v };
-
-        while ( true ) {
-          unique_lock<mutex> ul { video_mtx };
-          video_cv.wait(ul, [&](){ return video_frames.occupancy >= delay; });
-
-          if(video_frames.occupancy >= delay){
-            BaseRaster &r = video_frames.front();
-            ul.unlock();
-            video_frame_count.fetch_add(1);
-            video_cv.notify_all();
-
-            // TODO(sadjad) call degrader...
-            memcpy( degrader.encoder_frame->data[0], &r.Y().at( 0, 0 ), width * height );
-            memcpy( degrader.encoder_frame->data[1], &r.U().at( 0, 0 ), width * height / 4 );
-            memcpy( degrader.encoder_frame->data[2], &r.V().at( 0, 0 ), width * height / 4 );
-
-            degrader.degrade( degrader.encoder_frame, degrader.decoder_frame );
-
-            memcpy( &r.Y().at( 0, 0 ), degrader.decoder_frame->data[0], width * height );
-            memcpy( &r.U().at( 0, 0 ), degrader.decoder_frame->data[1], width * height / 4 );
-            memcpy( &r.V().at( 0, 0 ), degrader.decoder_frame->data[2], width * height / 4 );
-
-            while(video_frame_count.load() > audio_frame_count.load()){}
-            display.draw( r );
-
-            if ( not first_degraded_frame ) {
-              fwrite( frame_header.c_str(), sizeof( char ), frame_header.size(), fdegraded.get() );
-              r.dump( fdegraded.get() );
-            }
-            else {
-              first_degraded_frame = false;
-            }
-
-            ul.lock();
-            video_frames.pop_front();
-            ul.unlock();
+      while ( RecordedFrame * frame = record_edge.wait_read() ) {
+        {
+          Stage::ServiceTimer timer { stage };
+          foriginal.write( frame->original );
+
+          if ( not first_degraded_frame ) {
+            fdegraded.write( frame->degraded );
+          }
+          else {
+            first_degraded_frame = false;
           }
-          video_cv.notify_all();
         }
+        record_edge.release_read();
       }
+    },
+    cpu_for( "record" )
   };
 
-  thread audio_read_thread {
-    [&]()
+  Stage audio_play_stage {
+    "audio-play",
+    [&]( Stage & stage )
     {
-      while ( true ) {
-        string audio_frame = audio_reader.read( audio_bytes_per_frame );
+      /* once closed, plays out the whole delay line */
+      while ( const AudioFrame * audio_frame = audio_edge.wait_read( audio_delay_periods ) ) {
+        Stage::ServiceTimer timer { stage };
+        int64_t resampler_latency = 0;
+
+        if ( resampler ) {
+          const size_t frames = resampler->process( reinterpret_cast<const int16_t *>( audio_frame->samples.data() ),
+                                                    audio_period_samples, resampled.data() );
+          audio_writer->write( { reinterpret_cast<const uint8_t *>( resampled.data() ),
+                                 frames * pa_frame_size( &sink_ss ) } );
+          resampler_latency = resampler->latency();
+        } else {
+          audio_writer->write( audio_frame->chunk() );
+        }
+
+        /* the end of this chunk will be heard after the device latency */
+        const int64_t now = monotonic_timestamp_us();
+        const int64_t heard = audio_frame->capture_timestamp + audio_period - resampler_latency
+                              - int64_t( audio_writer->latency() );
+        media_clock.update( heard, now );
 
-        unique_lock<mutex> ul { audio_mtx };
-        audio_cv.wait(ul, [&](){ return audio_frames.size() < delay; } );
-        audio_frames.push_back(audio_frame);
-        audio_cv.notify_all();
+        if ( drift_compensation ) {
+          resampler->set_adjustment( drift.update( now, now - heard ) );
+        }
+        audio_edge.release_read();
       }
-    }
+    },
+    cpu_for( "audio-play" )
   };
 
-  thread audio_play_thread {
+  vector<Stage *> stages { &capture_stage, &decode_stage, &degrade_stage, &record_stage, &audio_play_stage };
+  if ( audio_capture_stage ) {
+    stages.push_back( audio_capture_stage.get() );
+  }
+
+  /* --realtime: capture and audio, which must never be late, at the given
+     priority, and decode, degrade and display one below; recording only
+     has to keep up on average, so it stays in the normal class */
+  if ( realtime_priority ) {
+    bool permitted = true;
+    for ( Stage * stage : stages ) {
+      if ( stage != &record_stage ) {
+        const bool video = stage == &decode_stage or stage == &degrade_stage;
+        permitted &= stage->set_fifo_priority( video ? realtime_priority - 1 : realtime_priority );
+      }
+    }
+    permitted &= renderer.set_fifo_priority( realtime_priority - 1 );
+
+    if ( not permitted ) {
+      cerr << "warning: not permitted to use SCHED_FIFO; those threads stay in the normal class" << endl;
+    }
+  }
+
+  /* Wakeup latency of each thread: how long after what it waits for
+     happened it was running again. Compare runs with and without --pin,
+     --realtime and --lock-memory under the same load. */
+  const auto print_wakeups = [&]()
+    {
+      string pinned;
+      for ( const auto & thread_cpu : pinning ) {
+        pinned += ( pinned.empty() ? "" : "," ) + thread_cpu.first + "=" + to_string( thread_cpu.second );
+      }
+
+      cout << "wakeup latency:"
+           << "\tpinned:\t" << ( pinned.empty() ? "none" : pinned )
+           << "\tfifo:\t" << ( realtime_priority ? to_string( realtime_priority ) : "off" )
+           << "\tmemory locked:\t" << ( memory_locked ? "yes" : "no" ) << endl;
+      cout << "  capture (camera frame):\t" << camera_wakeups.report();
+      if ( paced_audio_file ) {
+        cout << "\n  capture (audio period):\t" << audio_capture_latency.report();
+      }
+      cout << "\n  decode (capture edge):\t" << capture_edge.wakeup_latency().report()
+           << "\n  degrade (video edge):\t" << video_edge.wakeup_latency().report()
+           << "\n  degrade (media clock):\t" << clock_wakeups.report()
+           << "\n  record (record edge):\t" << record_edge.wakeup_latency().report()
+           << "\n  audio-play (audio edge):\t" << audio_edge.wakeup_latency().report()
+           << "\n  display (publish to draw):\t" << renderer.publish_to_draw().report() << endl;
+      if ( audio_source_file.empty() ) {
+        cout << "capture buffer latency:\t" << audio_capture_latency.report() << endl;
+      }
+    };
+
+  /* STATS: per-frame display timing, where each frame spent its time between
+     capture and glass, and how each stage and edge of the pipeline is coping */
+  thread stats_thread {
     [&]()
-      {
-        AudioWriter audio_writer { audio_sink, ss, ba };
+    {
+      ofstream timing_log;
+      if ( not timing_filename.empty() ) {
+        timing_log.open( timing_filename );
+        timing_log << "capture_us\tupload_s\tgpu_s\tuploaded_bytes\tclean_tiles\ttiles"
+                   << "\tpresent_us\tpresent_source\tmsc\tmissed_vsyncs\tlatency_ms\tav_offset_ms"
+                   << "\taudio_drift_ppm\taudio_correction_ppm" << endl;
+      }
 
-        while ( true ) {
-          string audio_frame;
-          {
-            unique_lock<mutex> ul { audio_mtx };
-            audio_cv.wait(ul, [&](){ return audio_frames.size() >= delay; });
+      double latency_sum = 0;
+      size_t latency_count = 0;
+      double av_offset_sum = 0;
+      size_t av_offset_count = 0;
+      uint64_t uploaded_bytes = 0, clean_tiles = 0, tiles = 0;
+      size_t frame_count = 0;
+
+      FrameTiming timing;
+      while ( renderer.wait_timing( timing ) ) {
+        const double latency = ( timing.present_timestamp - timing.capture_timestamp ) / 1000.0;
+
+        /* positive when the audio being heard was captured after the frame being shown */
+        const bool synchronized = timing.capture_timestamp and media_clock.running();
+        const double av_offset = synchronized
+          ? ( media_clock.media_time( timing.present_timestamp ) - timing.capture_timestamp ) / 1000.0 : 0;
+
+        if ( timing_log.is_open() ) {
+          timing_log << timing.capture_timestamp << "\t" << timing.upload_time << "\t" << timing.gpu_time
+                     << "\t" << timing.uploaded_bytes << "\t" << timing.clean_tiles << "\t" << timing.tiles
+                     << "\t" << timing.present_timestamp << "\t" << ( timing.present_from_server ? "present" : "swap" )
+                     << "\t" << timing.msc << "\t" << timing.missed_vsyncs
+                     << "\t" << ( timing.capture_timestamp ? latency : -1 )
+                     << "\t" << av_offset << "\t" << drift.drift_ppm() << "\t" << drift.correction_ppm() << "\n";
+        }
 
-            audio_frame = audio_frames.front();
-            audio_frames.pop_front();
-            audio_frame_count.fetch_add(1);
-            audio_cv.notify_all();
-          }
+        if ( timing.capture_timestamp ) {
+          latency_sum += latency;
+          latency_count++;
+        }
 
-          while(audio_frame_count.load() > video_frame_count.load()){}
-          audio_writer.write( audio_frame );
+        if ( synchronized ) {
+          av_offset_sum += av_offset;
+          av_offset_count++;
+        }
 
+        uploaded_bytes += timing.uploaded_bytes;
+        clean_tiles += timing.clean_tiles;
+        tiles += timing.tiles;
+        frame_count++;
+
+        if ( frame_count == 100 ) {
+          cout << "capture to present:\t" << ( latency_count ? latency_sum / latency_count : -1 ) << " ms"
+               << "\tmissed vsyncs:\t" << renderer.missed_vsyncs()
+               << "\tuploaded:\t" << uploaded_bytes / frame_count / 1024 << " KiB/frame"
+               << "\ttile hit rate:\t" << ( tiles ? 100.0 * clean_tiles / tiles : 0 ) << "%" << endl;
+          cout << "presented:\t" << renderer.presented()
+               << "\tdropped:\t" << renderer.dropped()
+               << "\tduplicated:\t" << renderer.duplicated()
+               << "\tupload:\t" << renderer.last_upload_time()
+               << "\tdraw:\t" << renderer.last_draw_time() << endl;
+          if ( static_threshold >= 0 ) {
+            cout << "static frames:\t" << degrader.static_frames() << "/" << degrader.total_frames() << endl;
+          }
+          cout << "A/V offset:\t" << ( av_offset_count ? av_offset_sum / av_offset_count : 0 ) << " ms"
+               << "\tlate frames:\t" << late_frames.load()
+               << "\taudio in/out latency:\t" << audio_reader->latency() / 1000.0
+               << "/" << audio_writer->latency() / 1000.0 << " ms"
+               << "\toverruns:\t" << audio_reader->overruns() + audio_edge.dropped()
+               << "\tunderruns:\t" << audio_writer->underruns() << endl;
+          if ( drift_compensation ) {
+            cout << "audio drift:\t" << drift.drift_ppm() << " ppm"
+                 << "\tcorrection:\t" << drift.correction_ppm() << " ppm"
+                 << "\tlatency error:\t" << drift.error_us() / 1000 << " ms" << endl;
+          }
+          if ( audio_degrader ) {
+            cout << "opus:\t" << audio_degrader->encoded_bitrate() / 1000 << " kbit/s"
+                 << "\tlast frame:\t" << audio_degrader->last_frame_size() << " bytes"
+                 << "\tcpu/frame:\t" << audio_degrader->mean_cpu_ns() / 1000
+                 << " us (max " << audio_degrader->max_cpu_ns() / 1000.0 << ")"
+                 << "\tcodec latency:\t" << audio_degrader->latency() / 1000.0 << " ms" << endl;
+          }
+          cout << "camera dropped:\t" << camera.dropped_frames()
+               << "\tcapture loop wakeups/frame:\t"
+               << double( capture_loop.wakeups() ) / max<uint64_t>( capture_edge.committed(), 1 ) << endl;
+          for ( const Stage * stage : stages ) {
+            cout << "stage " << stage->report() << endl;
+          }
+          cout << "edge " << capture_edge.report() << "\nedge " << video_edge.report()
+               << "\nedge " << record_edge.report() << "\nedge " << audio_edge.report() << endl;
+          print_wakeups();
+          latency_sum = 0;
+          latency_count = 0;
+          av_offset_sum = 0;
+          av_offset_count = 0;
+          uploaded_bytes = clean_tiles = tiles = 0;
+          frame_count = 0;
         }
       }
+    }
   };
 
-  while ( true ) { }
+  /* everything runs on the stages above; this thread sleeps until told to stop */
+  const signalfd_siginfo received = signal_fd.read_signal();
+  cout << "shutting down on " << strsignal( received.ssi_signo ) << endl;
+
+  /* a second signal kills the process outright, should some stage be stuck */
+  SignalMask {}.set_as_mask();
+
+  /* Stop the capture stages first. Each stage closes its output once its
+     input is closed and drained, so the audio delay line is played out and
+     every frame captured is degraded and recorded. Once no more audio is
+     coming, the frames still waiting for it to be heard go through at once. */
+  capture_loop.stop();
+  capture_stage.join();
+
+  if ( audio_capture_stage ) {
+    running = false;
+    audio_capture_stage->join();
+  }
+  audio_play_stage.join();
+
+  media_clock.interrupt();
+  decode_stage.join();
+  degrade_stage.join();
+  record_stage.join();
+
+  renderer.stop();
+  stats_thread.join();
+
+  foriginal.flush();
+  fdegraded.flush();
+
+  print_wakeups();
 
   return 0;
 }
@@ -0,0 +1,177 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "h264_degrader.hh"
+#include "encode_cache.hh"
+#include "raster.hh"
+#include "y4m.hh"
+
+using namespace std;
+
+void usage( const char * argv0 )
+{
+  cerr << "usage: " << argv0 << " [--cache DIR] [--bitrate N] --qp Q1,Q2,... INPUT.y4m" << endl;
+}
+
+vector<size_t> parse_list( const string & list )
+{
+  vector<size_t> ret;
+  istringstream in { list };
+  string item;
+
+  while ( getline( in, item, ',' ) ) {
+    ret.push_back( stoul( item ) );
+  }
+
+  return ret;
+}
+
+int main( int argc, char * argv[] )
+{
+  string cache_directory = "qp-sweep-cache";
+  vector<size_t> qps;
+  size_t bitrate = 1 << 20;
+
+  constexpr option options[] = {
+    { "cache",   required_argument, NULL, 'c' },
+    { "qp",      required_argument, NULL, 'q' },
+    { "bitrate", required_argument, NULL, 'b' },
+    { 0, 0, 0, 0 }
+  };
+
+  while ( true ) {
+    const int opt = getopt_long( argc, argv, "", options, NULL );
+
+    if ( opt == -1 ) {
+      break;
+    }
+
+    switch ( opt ) {
+    case 'c': cache_directory = optarg; break;
+    case 'q': qps = parse_list( optarg ); break;
+    case 'b': bitrate = stoul( optarg ); break;
+
+    default: usage( argv[ 0 ] ); return EXIT_FAILURE;
+    }
+  }
+
+  if ( optind + 1 != argc or qps.empty() ) {
+    usage( argv[ 0 ] );
+    return EXIT_FAILURE;
+  }
+
+  Y4MReader reader { argv[ optind ] };
+  const Y4MHeader & header = reader.header();
+  const uint16_t width = header.width;
+  const uint16_t height = header.height;
+
+  /* completing the index up front lets the workers share the frame views */
+  const size_t frame_count = reader.frame_count();
+  vector<Y4MFrame> frames;
+  vector<size_t> hashes;
+
+  {
+    BaseRaster scratch { width, height, width, height };
+
+    for ( size_t i = 0; i < frame_count; i++ ) {
+      frames.push_back( reader.frame( i ) );
+      frames.back().copy_to( scratch, header );
+      hashes.push_back( scratch.raw_hash() );
+    }
+  }
+
+  /* one degrader per QP; libavcodec setup is not thread-safe, so build them here */
+  vector<unique_ptr<H264_degrader>> degraders;
+  for ( const size_t qp : qps ) {
+    degraders.emplace_back( new H264_degrader( width, height, bitrate, qp ) );
+  }
+
+  EncodeCache cache { cache_directory };
+
+  /* results[ frame ][ qp index ], filled from the cache first */
+  vector<vector<Optional<EncodeResult>>> results( frame_count, vector<Optional<EncodeResult>>( qps.size() ) );
+  size_t cached_cells = 0;
+
+  for ( size_t i = 0; i < frame_count; i++ ) {
+    for ( size_t q = 0; q < qps.size(); q++ ) {
+      results[ i ][ q ] = cache.get( hashes[ i ], degraders[ q ]->parameter_string() );
+      cached_cells += results[ i ][ q ].initialized();
+    }
+  }
+
+  cerr << "qp-sweep: " << cached_cells << " of " << frame_count * qps.size()
+       << " cells cached" << endl;
+
+  /* The degrader encodes intra-only (gop_size 0), so every frame is independent
+     of its neighbours and missing cells can be computed in isolation. */
+  vector<thread> workers;
+
+  for ( size_t q = 0; q < qps.size(); q++ ) {
+    workers.emplace_back(
+      [&, q]()
+      {
+        H264_degrader & degrader = *degraders[ q ];
+        const string parameters = degrader.parameter_string();
+        BaseRaster original { width, height, width, height };
+        BaseRaster degraded { width, height, width, height };
+
+        for ( size_t i = 0; i < frame_count; i++ ) {
+          if ( results[ i ][ q ].initialized() ) {
+            continue;
+          }
+
+          frames[ i ].copy_to( original, header );
+          const size_t bytes = degrader.degrade( original, degraded );
+
+          EncodeResult result { bytes, degraded.psnr( original ), degraded.quality( original ) };
+          cache.put( hashes[ i ], parameters, result );
+          results[ i ][ q ].initialize( result );
+        }
+      } );
+  }
+
+  for ( auto & worker : workers ) {
+    worker.join();
+  }
+
+  cout << fixed << setprecision( 4 );
+  cout << "# per frame" << endl;
+  cout << "frame\tqp\tbytes\tpsnr\tssim" << endl;
+
+  for ( size_t i = 0; i < frame_count; i++ ) {
+    for ( size_t q = 0; q < qps.size(); q++ ) {
+      const EncodeResult & r = results[ i ][ q ].get();
+      cout << i << "\t" << qps[ q ] << "\t" << r.bytes << "\t" << r.psnr << "\t" << r.ssim << endl;
+    }
+  }
+
+  const double fps = double( header.fps_numerator ) / header.fps_denominator;
+
+  cout << endl << "# per clip" << endl;
+  cout << "qp\tmean_bytes\tkbps\tmean_psnr\tmean_ssim" << endl;
+
+  for ( size_t q = 0; q < qps.size(); q++ ) {
+    double bytes = 0, psnr = 0, ssim = 0;
+
+    for ( size_t i = 0; i < frame_count; i++ ) {
+      const EncodeResult & r = results[ i ][ q ].get();
+      bytes += r.bytes;
+      psnr += r.psnr;
+      ssim += r.ssim;
+    }
+
+    const double n = frame_count ? frame_count : 1;
+    cout << qps[ q ] << "\t" << bytes / n << "\t" << bytes * 8 * fps / n / 1000
+         << "\t" << psnr / n << "\t" << ssim / n << endl;
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -21,18 +21,25 @@ AudioReader::AudioReader( const string & input_device,
   }
 }
 
-string AudioReader::read( const ssize_t size )
+void AudioReader::read( uint8_t * buffer, const size_t size )
 {
   int error;
 
-  static constexpr size_t BUFFER_SIZE = 1048576;
-  char buffer[ BUFFER_SIZE ] = {0};
-
   if ( pa_simple_read( source_.get(), buffer, size, &error ) < 0 ) {
     throw runtime_error( string( "pa_simple_read(): " ) + pa_strerror( error ) );
   }
+}
+
+uint64_t AudioReader::latency( void )
+{
+  int error;
+  const pa_usec_t latency = pa_simple_get_latency( source_.get(), &error );
+
+  if ( latency == pa_usec_t( -1 ) ) {
+    throw runtime_error( string( "pa_simple_get_latency(): " ) + pa_strerror( error ) );
+  }
 
-  return string( buffer, size );
+  return latency;
 }
 
 AudioWriter::AudioWriter( const string & output_device,
@@ -51,10 +58,22 @@ AudioWriter::AudioWriter( const string & output_device,
   }
 }
 
-void AudioWriter::write( const string & data )
+void AudioWriter::write( const Chunk & data )
 {
   int error;
-  if ( pa_simple_write( sink_.get(), data.data(), data.size(), &error ) < 0 ) {
+  if ( pa_simple_write( sink_.get(), data.buffer(), data.size(), &error ) < 0 ) {
     throw runtime_error( string( "pa_simple_write(): " ) + pa_strerror(error) );
   }
 }
+
+uint64_t AudioWriter::latency( void )
+{
+  int error;
+  const pa_usec_t latency = pa_simple_get_latency( sink_.get(), &error );
+
+  if ( latency == pa_usec_t( -1 ) ) {
+    throw runtime_error( string( "pa_simple_get_latency(): " ) + pa_strerror( error ) );
+  }
+
+  return latency;
+}
@@ -3,16 +3,58 @@
 
 #include <string>
 #include <memory>
+#include <vector>
 
 #include <pulse/simple.h>
 #include <pulse/error.h>
 
+#include "chunk.hh"
+#include "file_descriptor.hh"
+
 struct PADeleter
 {
   void operator()( pa_simple * pa ) { if ( pa ) { pa_simple_free( pa ); } }
 };
 
-class AudioReader
+/* where captured audio comes from */
+class AudioSource
+{
+public:
+  virtual ~AudioSource() {}
+
+  /* blocks until `size` bytes have been captured into `buffer` */
+  virtual void read( uint8_t * buffer, const size_t size ) = 0;
+
+  /* microseconds between a sample being captured and being read */
+  virtual uint64_t latency( void ) = 0;
+
+  /* captured audio lost because the reader fell behind, if the backend can tell */
+  virtual uint64_t overruns( void ) const { return 0; }
+
+  /* For capturing from an EventLoop: a descriptor that polls readable
+     whenever a read() of `period` bytes would not block, after which
+     every read() must be of exactly one period. nullptr if the backend
+     can only block. */
+  virtual FileDescriptor * readiness_fd( const size_t /* period */ ) { return nullptr; }
+};
+
+/* where audio is played */
+class AudioSink
+{
+public:
+  virtual ~AudioSink() {}
+
+  virtual void write( const Chunk & data ) = 0;
+
+  /* microseconds until the last sample written is heard */
+  virtual uint64_t latency( void ) = 0;
+
+  /* times the device ran out of audio, if the backend can tell */
+  virtual uint64_t underruns( void ) const { return 0; }
+};
+
+/* blocking pa_simple backends */
+class AudioReader : public AudioSource
 {
 private:
   std::unique_ptr<pa_simple, PADeleter> source_;
@@ -22,10 +64,11 @@ public:
                const pa_sample_spec & ss,
                const pa_buffer_attr & ba );
 
-  std::string read( const ssize_t buffer_size );
+  void read( uint8_t * buffer, const size_t size ) override;
+  uint64_t latency( void ) override;
 };
 
-class AudioWriter
+class AudioWriter : public AudioSink
 {
 private:
   std::unique_ptr<pa_simple, PADeleter> sink_;
@@ -35,7 +78,22 @@ public:
                const pa_sample_spec & ss,
                const pa_buffer_attr & ba );
 
-  void write( const std::string & data );
+  void write( const Chunk & data ) override;
+  uint64_t latency( void ) override;
+};
+
+/* a fixed-size chunk of interleaved samples, allocated once */
+struct AudioFrame
+{
+  std::vector<uint8_t> samples;
+
+  /* CLOCK_MONOTONIC microseconds at which the first sample was captured, 0 if unknown */
+  int64_t capture_timestamp { 0 };
+
+  AudioFrame( const size_t size ) : samples( size ) {}
+
+  uint8_t * data( void ) { return samples.data(); }
+  Chunk chunk( void ) const { return { samples.data(), samples.size() }; }
 };
 
 #endif /* AUDIO_HH */
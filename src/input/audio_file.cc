@@ -0,0 +1,251 @@
+#include "audio_file.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <stdexcept>
+
+#include "exception.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+static constexpr size_t WAV_HEADER_SIZE = 44;
+
+static bool is_wav( const string & filename )
+{
+  return filename.size() >= 4 and filename.compare( filename.size() - 4, 4, ".wav" ) == 0;
+}
+
+/* finds the samples in a RIFF/WAVE file, and their format */
+static Chunk wav_data( const Chunk & file, pa_sample_spec & ss )
+{
+  if ( file.size() < 12 or file( 0, 4 ).to_string() != "RIFF" or file( 8, 4 ).to_string() != "WAVE" ) {
+    throw Invalid( "not a RIFF/WAVE file" );
+  }
+
+  bool have_format = false;
+  uint64_t offset = 12;
+
+  while ( offset + 8 <= file.size() ) {
+    const string id = file( offset, 4 ).to_string();
+    const uint64_t length = file( offset + 4, 4 ).le32();
+
+    /* streamed files may leave the length unset, so clip it to the file */
+    const Chunk body = file( offset + 8, min( length, file.size() - offset - 8 ) );
+
+    if ( id == "fmt " ) {
+      const uint16_t tag = body.le16();
+      const uint16_t bits = body( 14, 2 ).le16();
+
+      /* plain PCM, or WAVE_FORMAT_EXTENSIBLE */
+      if ( ( tag != 1 and tag != 0xFFFE ) or bits != 16 ) {
+        throw Unsupported( "only 16-bit PCM WAV files are supported" );
+      }
+
+      ss.format = PA_SAMPLE_S16LE;
+      ss.channels = body( 2, 2 ).le16();
+      ss.rate = body( 4, 4 ).le32();
+      have_format = true;
+    } else if ( id == "data" ) {
+      if ( not have_format ) {
+        throw Invalid( "WAV data before its format" );
+      }
+
+      return body;
+    }
+
+    offset += 8 + length + ( length & 1 );
+  }
+
+  throw Invalid( "WAV file has no data" );
+}
+
+static void put_le( uint8_t * target, const uint32_t value, const unsigned int bytes )
+{
+  for ( unsigned int i = 0; i < bytes; i++ ) {
+    target[ i ] = value >> ( 8 * i );
+  }
+}
+
+AudioFileReader::AudioFileReader( const string & filename, const pa_sample_spec & ss,
+                                  const AudioPacing pacing )
+  : file_( filename ),
+    sample_spec_( ss ),
+    data_( file_.chunk() ),
+    pacing_( pacing )
+{
+  if ( is_wav( filename ) ) {
+    data_ = wav_data( file_.chunk(), sample_spec_ );
+
+    if ( not pa_sample_spec_equal( &sample_spec_, &ss ) ) {
+      char file_format[ PA_SAMPLE_SPEC_SNPRINT_MAX ], wanted_format[ PA_SAMPLE_SPEC_SNPRINT_MAX ];
+      throw Unsupported( filename + " is " + pa_sample_spec_snprint( file_format, sizeof( file_format ), &sample_spec_ )
+                         + ", not " + pa_sample_spec_snprint( wanted_format, sizeof( wanted_format ), &ss ) );
+    }
+  }
+
+  /* whole frames only */
+  data_ = data_( 0, data_.size() - data_.size() % pa_frame_size( &sample_spec_ ) );
+
+  if ( data_.size() == 0 ) {
+    throw Invalid( filename + " has no audio" );
+  }
+}
+
+pa_sample_spec AudioFileReader::file_sample_spec( const string & filename, const pa_sample_spec & raw_spec )
+{
+  pa_sample_spec ss = raw_spec;
+
+  if ( is_wav( filename ) ) {
+    const File file { filename };
+    wav_data( file.chunk(), ss );
+  }
+
+  return ss;
+}
+
+void AudioFileReader::read( uint8_t * buffer, const size_t size )
+{
+  for ( size_t copied = 0; copied < size; ) {
+    const size_t amount = min( size - copied, data_.size() - position_ );
+    memcpy( buffer + copied, data_.buffer() + position_, amount );
+
+    copied += amount;
+    position_ = ( position_ + amount ) % data_.size();
+  }
+
+  bytes_read_ += size;
+
+  if ( pacing_ == AudioPacing::RealTime ) {
+    if ( start_ == 0 ) {
+      start_ = monotonic_timestamp_us();
+    }
+
+    const int64_t deadline = start_ + pa_bytes_to_usec( bytes_read_, &sample_spec_ );
+    deadline_.store( deadline, memory_order_relaxed );
+    timer_.wait_until( deadline );
+
+    /* re-arming also clears the expiration that made the descriptor readable */
+    if ( ready_period_ ) {
+      timer_.arm_at( start_ + pa_bytes_to_usec( bytes_read_ + ready_period_, &sample_spec_ ) );
+    }
+  }
+}
+
+FileDescriptor * AudioFileReader::readiness_fd( const size_t period )
+{
+  if ( pacing_ == AudioPacing::FreeRunning ) {
+    return nullptr;
+  }
+
+  if ( period == 0 ) {
+    throw runtime_error( "AudioFileReader: period must be positive" );
+  }
+
+  if ( start_ == 0 ) {
+    start_ = monotonic_timestamp_us();
+  }
+
+  ready_period_ = period;
+  timer_.arm_at( start_ + pa_bytes_to_usec( bytes_read_ + period, &sample_spec_ ) );
+  return &timer_.fd();
+}
+
+uint64_t AudioFileReader::latency( void )
+{
+  const int64_t deadline = deadline_.load( memory_order_relaxed );
+  if ( pacing_ == AudioPacing::FreeRunning or deadline == 0 ) {
+    return 0;
+  }
+
+  return max( int64_t( 0 ), monotonic_timestamp_us() - deadline );
+}
+
+AudioFileWriter::AudioFileWriter( const string & filename, const pa_sample_spec & ss,
+                                  const AudioPacing pacing )
+  : fd_( SystemCall( filename, open( filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644 ) ) ),
+    sample_spec_( ss ),
+    wav_( is_wav( filename ) ),
+    pacing_( pacing )
+{
+  if ( not pa_sample_spec_valid( &ss ) ) {
+    throw Invalid( "invalid sample spec for " + filename );
+  }
+
+  if ( not wav_ ) {
+    return;
+  }
+
+  if ( ss.format != PA_SAMPLE_S16LE ) {
+    throw Unsupported( "only 16-bit PCM WAV files are supported" );
+  }
+
+  /* the sizes are filled in when the file is closed */
+  uint8_t header[ WAV_HEADER_SIZE ] = "RIFF\0\0\0\0WAVEfmt ";
+  put_le( header + 16, 16, 4 );
+  put_le( header + 20, 1, 2 );
+  put_le( header + 22, ss.channels, 2 );
+  put_le( header + 24, ss.rate, 4 );
+  put_le( header + 28, ss.rate * pa_frame_size( &ss ), 4 );
+  put_le( header + 32, pa_frame_size( &ss ), 2 );
+  put_le( header + 34, 16, 2 );
+  memcpy( header + 36, "data", 4 );
+
+  fd_.write( Chunk( header, WAV_HEADER_SIZE ) );
+}
+
+AudioFileWriter::~AudioFileWriter()
+{
+  if ( not wav_ ) {
+    return;
+  }
+
+  const uint32_t data_size = min( bytes_written_, uint64_t( UINT32_MAX - WAV_HEADER_SIZE ) );
+  uint8_t size[ 4 ];
+
+  try {
+    put_le( size, data_size + WAV_HEADER_SIZE - 8, 4 );
+    SystemCall( "pwrite", pwrite( fd_.fd_num(), size, 4, 4 ) );
+    put_le( size, data_size, 4 );
+    SystemCall( "pwrite", pwrite( fd_.fd_num(), size, 4, 40 ) );
+  } catch ( const exception & e ) {
+    print_exception( "AudioFileWriter", e );
+  }
+}
+
+void AudioFileWriter::write( const Chunk & data )
+{
+  if ( pacing_ == AudioPacing::RealTime ) {
+    const int64_t now = monotonic_timestamp_us();
+
+    if ( start_ == 0 ) {
+      start_ = now;
+    } else if ( now > play_end() ) {
+      /* the device would have run dry; it starts again with this chunk */
+      underruns_++;
+      start_ = now - pa_bytes_to_usec( bytes_written_, &sample_spec_ );
+    } else {
+      /* queue at most this chunk behind what is playing */
+      timer_.wait_until( play_end() );
+    }
+  }
+
+  fd_.write( data );
+  bytes_written_ += data.size();
+
+  if ( pacing_ == AudioPacing::RealTime ) {
+    published_play_end_.store( play_end(), memory_order_relaxed );
+  }
+}
+
+uint64_t AudioFileWriter::latency( void )
+{
+  /* zero until the first paced write */
+  const int64_t end = published_play_end_.load( memory_order_relaxed );
+  if ( end == 0 ) {
+    return 0;
+  }
+
+  return max( int64_t( 0 ), end - monotonic_timestamp_us() );
+}
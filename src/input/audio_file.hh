@@ -0,0 +1,100 @@
+#ifndef AUDIO_FILE_HH
+#define AUDIO_FILE_HH
+
+#include <atomic>
+#include <string>
+
+#include <pulse/sample.h>
+
+#include "audio.hh"
+#include "file.hh"
+#include "file_descriptor.hh"
+#include "timerfd.hh"
+
+/* Stand-ins for the PulseAudio backends, for benchmarking without a
+   sound server. Files ending in ".wav" are RIFF/WAVE with 16-bit PCM;
+   anything else is raw interleaved samples in the caller's format.
+
+   RealTime paces the stream like a device would: each read returns
+   when the last sample it holds would have been captured, and each
+   write returns once the audio before it would have been played, both
+   measured from the first call and slept for on a timerfd.
+   FreeRunning moves audio as fast as the caller asks for it. */
+enum class AudioPacing { RealTime, FreeRunning };
+
+/* plays a file in a loop */
+class AudioFileReader : public AudioSource
+{
+private:
+  File file_;
+  pa_sample_spec sample_spec_;
+  Chunk data_;
+  size_t position_ { 0 };
+
+  AudioPacing pacing_;
+  TimerFD timer_ {};
+  int64_t start_ { 0 };
+  uint64_t bytes_read_ { 0 };
+
+  /* the reading thread sets it; latency() may be asked from any thread */
+  std::atomic<int64_t> deadline_ { 0 };
+
+  /* set once the timer is also a readiness descriptor: it is kept armed for the next period */
+  size_t ready_period_ { 0 };
+
+public:
+  /* `ss` is the format of raw files, and must match the header of WAV files */
+  AudioFileReader( const std::string & filename, const pa_sample_spec & ss,
+                   const AudioPacing pacing = AudioPacing::RealTime );
+
+  void read( uint8_t * buffer, const size_t size ) override;
+
+  /* how late the last paced read woke up */
+  uint64_t latency( void ) override;
+
+  /* the pacing timer, when paced; free-running reads never block anyway */
+  FileDescriptor * readiness_fd( const size_t period ) override;
+
+  const pa_sample_spec & sample_spec( void ) const { return sample_spec_; }
+
+  /* the format from a WAV file's header, or `raw_spec` for raw files */
+  static pa_sample_spec file_sample_spec( const std::string & filename, const pa_sample_spec & raw_spec );
+};
+
+class AudioFileWriter : public AudioSink
+{
+private:
+  FileDescriptor fd_;
+  pa_sample_spec sample_spec_;
+  bool wav_;
+  uint64_t bytes_written_ { 0 };
+
+  AudioPacing pacing_;
+  TimerFD timer_ {};
+  int64_t start_ { 0 };
+
+  /* the writing thread updates these; latency() and underruns() may be asked from any thread */
+  std::atomic<int64_t> published_play_end_ { 0 };
+  std::atomic<uint64_t> underruns_ { 0 };
+
+  /* when everything written so far will have been played */
+  int64_t play_end( void ) const { return start_ + pa_bytes_to_usec( bytes_written_, &sample_spec_ ); }
+
+public:
+  AudioFileWriter( const std::string & filename, const pa_sample_spec & ss,
+                   const AudioPacing pacing = AudioPacing::RealTime );
+
+  /* fills in the WAV header's sizes */
+  ~AudioFileWriter();
+
+  void write( const Chunk & data ) override;
+  uint64_t latency( void ) override;
+
+  /* paced writes that arrived after the audio before them had finished playing */
+  uint64_t underruns( void ) const override { return underruns_.load( std::memory_order_relaxed ); }
+
+  AudioFileWriter( const AudioFileWriter & other ) = delete;
+  AudioFileWriter & operator=( const AudioFileWriter & other ) = delete;
+};
+
+#endif /* AUDIO_FILE_HH */
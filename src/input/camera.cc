@@ -5,11 +5,13 @@
 #include <unordered_set>
 #include <cstdio>
 #include <fcntl.h>
+#include <poll.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
 
 #include "camera.hh"
 #include "exception.hh"
+#include "timestamp.hh"
 
 using namespace std;
 
@@ -18,12 +20,21 @@ unordered_set<uint32_t> SUPPORTED_FORMATS {
     V4L2_PIX_FMT_MJPEG }
 };
 
+/* copies `rows` rows, `src_stride` bytes apart, into a raster plane */
+static void copy_rows( const uint8_t * src, const size_t src_stride,
+                       TwoD<uint8_t> & plane, const size_t rows )
+{
+  for ( size_t row = 0; row < rows; row++ ) {
+    memcpy( &plane.at( 0, row ), src + row * src_stride, plane.width() );
+  }
+}
+
 Camera::Camera( const uint16_t width, const uint16_t height,
                 const size_t bitrate, const size_t quantizer,
                 const uint32_t pixel_format, const string device )
   : width_( width ), height_( height ),
-    camera_fd_( SystemCall( "open camera", open( device.c_str(), O_RDWR ) ) ),
-    mmap_region_(), pixel_format_( pixel_format ), buffer_info_(), type_(),
+    camera_fd_( SystemCall( "open camera", open( device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC ) ) ),
+    pixel_format_( pixel_format ), buffer_info_(), type_(),
     degrader_( width_, height_, bitrate, quantizer ),
     mjpeg_decoder_( width_, height_ )
 {
@@ -57,24 +68,33 @@ Camera::Camera( const uint16_t width, const uint16_t height,
   v4l2_requestbuffers buf_request;
   buf_request.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   buf_request.memory = V4L2_MEMORY_MMAP;
-  buf_request.count = 1;
+  buf_request.count = BUFFER_COUNT;
 
   SystemCall( "buffer request", ioctl( camera_fd_.fd_num(), VIDIOC_REQBUFS, &buf_request ) );
 
-  /* allocate buffers */
-  memset( &buffer_info_, 0, sizeof( buffer_info_ ) );
+  if ( buf_request.count == 0 ) {
+    throw runtime_error( "the camera granted no buffers" );
+  }
+
+  /* allocate buffers; the driver may grant fewer or more than asked */
+  for ( unsigned int index = 0; index < buf_request.count; index++ ) {
+    memset( &buffer_info_, 0, sizeof( buffer_info_ ) );
+
+    buffer_info_.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buffer_info_.memory = V4L2_MEMORY_MMAP;
+    buffer_info_.index = index;
 
-  buffer_info_.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  buffer_info_.memory = V4L2_MEMORY_MMAP;
-  buffer_info_.index = 0;
+    SystemCall( "allocate buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QUERYBUF, &buffer_info_ ) );
 
-  type_ = buffer_info_.type;
-  SystemCall( "allocate buffer", ioctl( camera_fd_.fd_num(), VIDIOC_QUERYBUF, &buffer_info_ ) );
+    /* mmap the thing, at the offset the driver gave this buffer */
+    mmap_regions_.emplace_back( make_unique<MMap_Region>( buffer_info_.length, PROT_READ | PROT_WRITE,
+                                                          MAP_SHARED, camera_fd_.fd_num(),
+                                                          buffer_info_.m.offset ) );
 
-  /* mmap the thing */
-  mmap_region_ = make_unique<MMap_Region>( buffer_info_.length, PROT_READ | PROT_WRITE,
-                                                MAP_SHARED, camera_fd_.fd_num() );
+    enqueue( buffer_info_ );
+  }
 
+  type_ = V4L2_BUF_TYPE_VIDEO_CAPTURE;
   SystemCall( "stream on", ioctl( camera_fd_.fd_num(), VIDIOC_STREAMON, &type_ ) );
 }
 
@@ -83,59 +103,132 @@ Camera::~Camera()
   SystemCall( "stream off", ioctl( camera_fd_.fd_num(), VIDIOC_STREAMOFF, &type_ ) );
 }
 
+bool Camera::dequeue( v4l2_buffer & buffer )
+{
+  memset( &buffer, 0, sizeof( buffer ) );
+  buffer.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+  buffer.memory = V4L2_MEMORY_MMAP;
+
+  if ( ioctl( camera_fd_.fd_num(), VIDIOC_DQBUF, &buffer ) < 0 ) {
+    if ( errno == EAGAIN ) {
+      return false;
+    }
+    throw unix_error( "dequeue buffer" );
+  }
+
+  return true;
+}
+
+void Camera::enqueue( v4l2_buffer & buffer )
+{
+  SystemCall( "queue", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &buffer ) );
+}
+
+bool Camera::dequeue_frame( CameraFrame & frame )
+{
+  if ( not dequeue( frame.buffer ) ) {
+    return false;
+  }
+
+  /* a later frame supersedes this one */
+  v4l2_buffer newer;
+  while ( dequeue( newer ) ) {
+    enqueue( frame.buffer );
+    frame.buffer = newer;
+    dropped_frames_++;
+  }
+
+  /* drivers normally stamp buffers with CLOCK_MONOTONIC; otherwise use the dequeue time */
+  if ( ( frame.buffer.flags & V4L2_BUF_FLAG_TIMESTAMP_MASK ) == V4L2_BUF_FLAG_TIMESTAMP_MONOTONIC ) {
+    frame.capture_timestamp = timestamp_us( frame.buffer.timestamp );
+  } else {
+    frame.capture_timestamp = monotonic_timestamp_us();
+  }
+
+  return true;
+}
+
+void Camera::release_frame( CameraFrame & frame )
+{
+  enqueue( frame.buffer );
+}
+
+void Camera::drop_ready_frames( void )
+{
+  v4l2_buffer buffer;
+  while ( dequeue( buffer ) ) {
+    enqueue( buffer );
+    dropped_frames_++;
+  }
+}
+
 void Camera::get_next_frame( BaseRaster & raster )
 {
-  buffer_info_.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
-  buffer_info_.memory = V4L2_MEMORY_MMAP;
-  buffer_info_.index = 0;
+  CameraFrame frame;
+  while ( not dequeue_frame( frame ) ) {
+    pollfd ready { camera_fd_.fd_num(), POLLIN, 0 };
+    SystemCall( "poll", poll( &ready, 1, -1 ) );
+  }
 
-  SystemCall( "queue", ioctl( camera_fd_.fd_num(), VIDIOC_QBUF, &buffer_info_ ) );
-  SystemCall( "dequeue buffer", ioctl( camera_fd_.fd_num(), VIDIOC_DQBUF, &buffer_info_ ) );
+  decode_frame( frame, raster );
+
+  /* the driver can fill it again */
+  release_frame( frame );
+}
+
+void Camera::decode_frame( const CameraFrame & frame, BaseRaster & raster )
+{
+  uint8_t * frame_data = mmap_regions_.at( frame.buffer.index )->addr();
+  raster.set_capture_timestamp( frame.capture_timestamp );
 
   switch( pixel_format_ ) {
   case V4L2_PIX_FMT_MJPEG:
   {
-    uint8_t * src = mmap_region_->addr();
+    uint8_t * src = frame_data;
 
     auto decode_raster_t1 = std::chrono::high_resolution_clock::now();
-    mjpeg_decoder_.decode( src, buffer_info_.length, degrader_.decoder_frame );
+    mjpeg_decoder_.decode( src, frame.buffer.length, degrader_.decoder_frame );
     auto decode_raster_t2 = std::chrono::high_resolution_clock::now();
     auto decode_raster_time = std::chrono::duration_cast<std::chrono::duration<double>>(decode_raster_t2 - decode_raster_t1);
     std::cout << "decode_raster:\t" << decode_raster_time.count() << endl;
 
-    memcpy( &raster.Y().at( 0, 0 ), degrader_.decoder_frame->data[0], width_ * height_ );
-    memcpy( &raster.U().at( 0, 0 ), degrader_.decoder_frame->data[1], width_ * height_ / 4 );
-    memcpy( &raster.V().at( 0, 0 ), degrader_.decoder_frame->data[2], width_ * height_ / 4 );
+    const AVFrame * frame = degrader_.decoder_frame;
+    copy_rows( frame->data[ 0 ], frame->linesize[ 0 ], raster.Y(), height_ );
+    copy_rows( frame->data[ 1 ], frame->linesize[ 1 ], raster.U(), height_ / 2 );
+    copy_rows( frame->data[ 2 ], frame->linesize[ 2 ], raster.V(), height_ / 2 );
   }
 
   break;
 
   case V4L2_PIX_FMT_YUYV:
   {
-    uint8_t * src = mmap_region_->addr();
+    uint8_t * src = frame_data;
 
     degrader_.yuyv2yuv420p( src, degrader_.encoder_frame, width_, height_ );
     degrader_.degrade( degrader_.encoder_frame, degrader_.decoder_frame );
-    memcpy( &raster.Y().at( 0, 0 ), degrader_.decoder_frame->data[ 0 ], width_ * height_ );
-    memcpy( &raster.U().at( 0, 0 ), degrader_.decoder_frame->data[ 1 ], width_ * height_ / 4 );
-    memcpy( &raster.V().at( 0, 0 ), degrader_.decoder_frame->data[ 2 ], width_ * height_ / 4 );
+    const AVFrame * frame = degrader_.decoder_frame;
+    copy_rows( frame->data[ 0 ], frame->linesize[ 0 ], raster.Y(), height_ );
+    copy_rows( frame->data[ 1 ], frame->linesize[ 1 ], raster.U(), height_ / 2 );
+    copy_rows( frame->data[ 2 ], frame->linesize[ 2 ], raster.V(), height_ / 2 );
   }
 
   break;
 
   case V4L2_PIX_FMT_NV12:
     {
-      memcpy( &raster.Y().at( 0, 0 ), mmap_region_->addr(), width_ * height_ );
+      copy_rows( frame_data, width_, raster.Y(), height_ );
 
-      uint8_t * src_chroma_start = mmap_region_->addr() + width_ * height_;
-      uint8_t * dst_cb_start = &raster.U().at( 0, 0 );
-      uint8_t * dst_cr_start = &raster.V().at( 0, 0 );
+      const uint8_t * src_chroma_start = frame_data + width_ * height_;
 
-      size_t chroma_length = width_ * height_ / 4;
+      for ( size_t row = 0; row < height_ / 2u; row++ ) {
+        const uint8_t * src = src_chroma_start + row * width_;
+        uint8_t * dst_cb = &raster.U().at( 0, row );
+        uint8_t * dst_cr = &raster.V().at( 0, row );
 
-      for ( size_t i = 0; i < chroma_length; i++ ) {
-        dst_cb_start[ i ] = src_chroma_start[ 2 * i ];
-        dst_cr_start[ i ] = src_chroma_start[ 2 * i + 1 ];
+        for ( size_t i = 0; i < width_ / 2u; i++ ) {
+          dst_cb[ i ] = src[ 2 * i ];
+          dst_cr[ i ] = src[ 2 * i + 1 ];
+        }
       }
     }
 
@@ -143,9 +236,9 @@ void Camera::get_next_frame( BaseRaster & raster )
 
   case V4L2_PIX_FMT_YUV420:
     {
-      memcpy( &raster.Y().at( 0, 0 ), mmap_region_->addr(), width_ * height_ );
-      memcpy( &raster.U().at( 0, 0 ), mmap_region_->addr() + width_ * height_, width_ * height_ / 4 );
-      memcpy( &raster.V().at( 0, 0 ), mmap_region_->addr() + width_ * height_ * 5 / 4, width_ * height_ / 4 );
+      copy_rows( frame_data, width_, raster.Y(), height_ );
+      copy_rows( frame_data + width_ * height_, width_ / 2, raster.U(), height_ / 2 );
+      copy_rows( frame_data + width_ * height_ * 5 / 4, width_ / 2, raster.V(), height_ / 2 );
     }
 
     break;
@@ -5,7 +5,9 @@
 
 #include <linux/videodev2.h>
 
+#include <atomic>
 #include <unordered_map>
+#include <vector>
 
 #include "optional.hh"
 #include "file_descriptor.hh"
@@ -20,14 +22,32 @@ static const std::unordered_map<std::string, uint32_t> PIXEL_FORMAT_STRS {
   { "MJPEG", V4L2_PIX_FMT_MJPEG }
 };
 
+/* a frame the driver has filled, lent out in its mmap'ed buffer until release_frame() */
+struct CameraFrame
+{
+  v4l2_buffer buffer {};
+  int64_t capture_timestamp { 0 };
+};
+
+/* V4L2 capture through a few mmap'ed buffers, all of which stay queued
+   to the driver except while frames are lent out. The descriptor is
+   non-blocking and polls readable once a frame is ready, so the camera
+   can be run from an EventLoop; get_next_frame() also works on its own,
+   polling until a frame is ready. Either way the newest ready frame is
+   delivered and any older ones go straight back to the driver.
+
+   Dequeuing and decoding can happen on different threads (a capture
+   thread that only dequeues, and a decoder), but each on one thread. */
 class Camera
 {
 private:
+  static constexpr unsigned int BUFFER_COUNT = 4;
+
   uint16_t width_;
   uint16_t height_;
 
   FileDescriptor camera_fd_;
-  std::unique_ptr<MMap_Region> mmap_region_;
+  std::vector<std::unique_ptr<MMap_Region>> mmap_regions_ {};
 
   uint32_t pixel_format_;
   v4l2_buffer buffer_info_;
@@ -36,6 +56,12 @@ private:
   H264_degrader degrader_;
   MJPEGDecoder mjpeg_decoder_;
 
+  std::atomic<uint64_t> dropped_frames_ { 0 };
+
+  /* false if no frame is ready */
+  bool dequeue( v4l2_buffer & buffer );
+  void enqueue( v4l2_buffer & buffer );
+
 public:
   Camera( const uint16_t width, const uint16_t height,
           const size_t bitrate, const size_t quantizer,
@@ -44,8 +70,24 @@ public:
 
   ~Camera();
 
+  /* dequeue_frame(), waiting if need be, then decode_frame() and release_frame() */
   void get_next_frame( BaseRaster & raster );
 
+  /* the newest ready frame, without waiting; false if there is none */
+  bool dequeue_frame( CameraFrame & frame );
+
+  /* converts (for MJPEG, decodes) a dequeued frame into a raster */
+  void decode_frame( const CameraFrame & frame, BaseRaster & raster );
+
+  /* hands a dequeued frame's buffer back to the driver */
+  void release_frame( CameraFrame & frame );
+
+  /* hands every ready frame straight back, for when there is nowhere to put them */
+  void drop_ready_frames( void );
+
+  /* frames captured but never delivered, because a newer one was ready or they were dropped */
+  uint64_t dropped_frames( void ) const { return dropped_frames_.load( std::memory_order_relaxed ); }
+
   uint16_t display_width() { return width_; }
   uint16_t display_height() { return height_; }
 
@@ -0,0 +1,508 @@
+#include "pulse_audio.hh"
+
+#include <algorithm>
+#include <stdexcept>
+#include <sys/eventfd.h>
+
+#include "exception.hh"
+
+using namespace std;
+
+/* good periods before the adaptive buffer is shrunk again */
+static constexpr unsigned int SHRINK_AFTER_PERIODS = 1000;
+
+/* the adaptive buffer never grows beyond this many periods */
+static constexpr uint32_t MAX_PERIODS = 32;
+
+PulseMainloop::PulseMainloop( const string & name )
+  : mainloop_( pa_threaded_mainloop_new() ),
+    context_( nullptr )
+{
+  if ( mainloop_ == nullptr ) {
+    throw runtime_error( "pa_threaded_mainloop_new() failed" );
+  }
+
+  context_ = pa_context_new( pa_threaded_mainloop_get_api( mainloop_ ), name.c_str() );
+  if ( context_ == nullptr ) {
+    pa_threaded_mainloop_free( mainloop_ );
+    throw runtime_error( "pa_context_new() failed" );
+  }
+
+  pa_context_set_state_callback( context_, context_state_callback, this );
+
+  try {
+    if ( pa_context_connect( context_, nullptr, PA_CONTEXT_NOFLAGS, nullptr ) < 0 ) {
+      throw runtime_error( error( "pa_context_connect" ) );
+    }
+
+    if ( pa_threaded_mainloop_start( mainloop_ ) < 0 ) {
+      throw runtime_error( "pa_threaded_mainloop_start() failed" );
+    }
+
+    Lock lock { *this };
+
+    while ( true ) {
+      const pa_context_state_t state = pa_context_get_state( context_ );
+
+      if ( state == PA_CONTEXT_READY ) {
+        break;
+      } else if ( state == PA_CONTEXT_FAILED or state == PA_CONTEXT_TERMINATED ) {
+        throw runtime_error( error( "pa_context_connect" ) );
+      }
+
+      wait();
+    }
+  } catch ( const exception & ) {
+    destroy();
+    throw;
+  }
+}
+
+void PulseMainloop::destroy( void )
+{
+  pa_threaded_mainloop_stop( mainloop_ );
+  pa_context_disconnect( context_ );
+  pa_context_unref( context_ );
+  pa_threaded_mainloop_free( mainloop_ );
+}
+
+PulseMainloop::~PulseMainloop()
+{
+  destroy();
+}
+
+void PulseMainloop::context_state_callback( pa_context *, void * userdata )
+{
+  static_cast<PulseMainloop *>( userdata )->signal();
+}
+
+PulseMainloop::Lock::Lock( PulseMainloop & mainloop )
+  : mainloop_( mainloop.mainloop_ )
+{
+  pa_threaded_mainloop_lock( mainloop_ );
+}
+
+PulseMainloop::Lock::~Lock()
+{
+  pa_threaded_mainloop_unlock( mainloop_ );
+}
+
+void PulseMainloop::wait( void )
+{
+  pa_threaded_mainloop_wait( mainloop_ );
+}
+
+void PulseMainloop::signal( void )
+{
+  pa_threaded_mainloop_signal( mainloop_, 0 );
+}
+
+string PulseMainloop::error( const string & function )
+{
+  return function + "(): " + pa_strerror( pa_context_errno( context_ ) );
+}
+
+/* pa_source_info and pa_sink_info share the fields used here */
+template <class Info>
+struct FormatQuery
+{
+  PulseMainloop & mainloop;
+  DeviceFormat format;
+  bool found;
+
+  static void callback( pa_context *, const Info * info, int eol, void * userdata )
+  {
+    FormatQuery * query = static_cast<FormatQuery *>( userdata );
+
+    if ( not eol and info ) {
+      query->format = { info->name, info->sample_spec };
+      query->found = true;
+    }
+
+    query->mainloop.signal();
+  }
+};
+
+template <class Info, class Callback>
+static DeviceFormat query_format( const string & device, const string & what,
+                                  pa_operation * ( *get_info )( pa_context *, const char *, Callback, void * ) )
+{
+  PulseMainloop mainloop { "format query" };
+  FormatQuery<Info> query { mainloop, {}, false };
+
+  PulseMainloop::Lock lock { mainloop };
+
+  pa_operation * operation = get_info( mainloop.context(), device.empty() ? nullptr : device.c_str(),
+                                       FormatQuery<Info>::callback, &query );
+  if ( operation == nullptr ) {
+    throw runtime_error( mainloop.error( "pa_context_get_" + what + "_info_by_name" ) );
+  }
+
+  while ( pa_operation_get_state( operation ) == PA_OPERATION_RUNNING ) {
+    mainloop.wait();
+  }
+  pa_operation_unref( operation );
+
+  if ( not query.found ) {
+    throw runtime_error( "no such " + what + ": " + ( device.empty() ? "(default)" : device ) );
+  }
+
+  return query.format;
+}
+
+DeviceFormat query_source_format( const string & device )
+{
+  return query_format<pa_source_info>( device, "source", pa_context_get_source_info_by_name );
+}
+
+DeviceFormat query_sink_format( const string & device )
+{
+  return query_format<pa_sink_info>( device, "sink", pa_context_get_sink_info_by_name );
+}
+
+string describe_conversion( const pa_sample_spec & from, const pa_sample_spec & to )
+{
+  string ret;
+
+  const auto add = [&ret]( const string & what, const string & before, const string & after ) {
+    ret += ( ret.empty() ? "" : ", " ) + what + " " + before + " -> " + after;
+  };
+
+  if ( from.format != to.format ) {
+    add( "format", pa_sample_format_to_string( from.format ), pa_sample_format_to_string( to.format ) );
+  }
+
+  if ( from.rate != to.rate ) {
+    add( "rate", to_string( from.rate ), to_string( to.rate ) + " Hz" );
+  }
+
+  if ( from.channels != to.channels ) {
+    add( "channels", to_string( from.channels ), to_string( to.channels ) );
+  }
+
+  return ret.empty() ? "none" : ret;
+}
+
+PulseStream::PulseStream( const string & name, const pa_sample_spec & ss, const size_t period,
+                          const size_t ring_periods )
+  : mainloop_( name ),
+    sample_spec_( ss ),
+    period_( period - period % pa_frame_size( &ss ) ),
+    ring_( period_ * ring_periods )
+{
+  if ( period_ == 0 ) {
+    throw runtime_error( "audio period is shorter than one frame" );
+  }
+
+  /* (uint32_t) -1 lets the server choose */
+  attr_.maxlength = attr_.tlength = attr_.prebuf = attr_.minreq = attr_.fragsize = -1;
+}
+
+PulseStream::~PulseStream()
+{
+  disconnect();
+}
+
+void PulseStream::disconnect( void )
+{
+  ring_.close();
+
+  if ( stream_ ) {
+    PulseMainloop::Lock lock { mainloop_ };
+    pa_stream_disconnect( stream_ );
+    pa_stream_unref( stream_ );
+    stream_ = nullptr;
+  }
+}
+
+void PulseStream::state_callback( pa_stream *, void * userdata )
+{
+  static_cast<PulseStream *>( userdata )->mainloop_.signal();
+}
+
+/* with the lock held, and the callbacks already set */
+void PulseStream::connect( const pa_stream_direction_t direction, const string & device )
+{
+  direction_ = direction;
+  buffer_length_ = adaptive_length();
+
+  const pa_stream_flags_t flags = pa_stream_flags_t( PA_STREAM_ADJUST_LATENCY
+                                                     | PA_STREAM_AUTO_TIMING_UPDATE
+                                                     | PA_STREAM_INTERPOLATE_TIMING );
+  const char * device_name = device.length() ? device.c_str() : nullptr;
+
+  pa_stream_set_state_callback( stream_, state_callback, this );
+
+  const int result = direction == PA_STREAM_PLAYBACK
+    ? pa_stream_connect_playback( stream_, device_name, &attr_, flags, nullptr, nullptr )
+    : pa_stream_connect_record( stream_, device_name, &attr_, flags );
+
+  if ( result < 0 ) {
+    throw runtime_error( mainloop_.error( direction == PA_STREAM_PLAYBACK
+                                          ? "pa_stream_connect_playback" : "pa_stream_connect_record" ) );
+  }
+
+  while ( true ) {
+    const pa_stream_state_t state = pa_stream_get_state( stream_ );
+
+    if ( state == PA_STREAM_READY ) {
+      break;
+    } else if ( state == PA_STREAM_FAILED or state == PA_STREAM_TERMINATED ) {
+      throw runtime_error( mainloop_.error( "pa_stream_connect" ) );
+    }
+
+    mainloop_.wait();
+  }
+
+  /* the server may have rounded what we asked for */
+  const pa_buffer_attr * granted = pa_stream_get_buffer_attr( stream_ );
+  if ( granted ) {
+    attr_ = *granted;
+    buffer_length_ = adaptive_length();
+  }
+}
+
+uint32_t & PulseStream::adaptive_length( void )
+{
+  return direction_ == PA_STREAM_PLAYBACK ? attr_.tlength : attr_.fragsize;
+}
+
+void PulseStream::update_latency( void )
+{
+  pa_usec_t latency;
+  int negative;
+
+  if ( pa_stream_get_latency( stream_, &latency, &negative ) == 0 ) {
+    server_latency_.store( negative ? 0 : latency, memory_order_relaxed );
+  }
+}
+
+void PulseStream::adapt( const bool lost )
+{
+  uint32_t & length = adaptive_length();
+  const uint32_t frame_size = pa_frame_size( &sample_spec_ );
+  const uint32_t step = max( frame_size, period_ / 2 / frame_size * frame_size );
+  uint32_t target = length;
+
+  if ( lost ) {
+    target = min( length + period_, MAX_PERIODS * period_ );
+  } else if ( ++stable_periods_ >= SHRINK_AFTER_PERIODS ) {
+    target = max( period_, length > step ? length - step : period_ );
+  }
+
+  if ( target == length ) {
+    return;
+  }
+
+  length = target;
+  stable_periods_ = 0;
+  buffer_length_.store( length, memory_order_relaxed );
+
+  pa_operation * operation = pa_stream_set_buffer_attr( stream_, &attr_, nullptr, nullptr );
+  if ( operation ) {
+    pa_operation_unref( operation );
+  }
+}
+
+AsyncAudioReader::AsyncAudioReader( const string & input_device, const pa_sample_spec & ss,
+                                    const size_t period )
+  : PulseStream( "source", ss, period, 16 )
+{
+  attr_.fragsize = period_;
+
+  PulseMainloop::Lock lock { mainloop_ };
+
+  stream_ = pa_stream_new( mainloop_.context(), "record", &sample_spec_, nullptr );
+  if ( stream_ == nullptr ) {
+    throw runtime_error( mainloop_.error( "pa_stream_new" ) );
+  }
+
+  pa_stream_set_read_callback( stream_, read_callback, this );
+  connect( PA_STREAM_RECORD, input_device );
+}
+
+AsyncAudioReader::~AsyncAudioReader()
+{
+  disconnect();
+}
+
+void AsyncAudioReader::read_callback( pa_stream * stream, size_t, void * userdata )
+{
+  AsyncAudioReader * reader = static_cast<AsyncAudioReader *>( userdata );
+  bool lost = false;
+
+  while ( pa_stream_readable_size( stream ) > 0 ) {
+    const void * data;
+    size_t length;
+
+    if ( pa_stream_peek( stream, &data, &length ) < 0 or length == 0 ) {
+      break;
+    }
+
+    /* a hole (data == nullptr) is audio the server already lost */
+    const size_t written = data ? reader->ring_.try_write( static_cast<const uint8_t *>( data ), length ) : 0;
+    if ( written < length ) {
+      lost = true;
+    }
+    reader->captured( written );
+
+    pa_stream_drop( stream );
+  }
+
+  if ( lost ) {
+    reader->overruns_++;
+  }
+
+  reader->update_latency();
+  reader->adapt( lost );
+}
+
+void AsyncAudioReader::captured( const size_t length )
+{
+  const uint64_t before = captured_;
+  captured_ += length;
+
+  if ( ready_ ) {
+    const uint64_t periods = captured_ / ready_period_ - before / ready_period_;
+    if ( periods ) {
+      SystemCall( "write to eventfd", ::write( ready_->fd_num(), &periods, sizeof( periods ) ) );
+    }
+  }
+}
+
+FileDescriptor * AsyncAudioReader::readiness_fd( const size_t period )
+{
+  if ( period == 0 ) {
+    throw runtime_error( "AsyncAudioReader: period must be positive" );
+  }
+
+  PulseMainloop::Lock lock { mainloop_ };
+
+  if ( not ready_ ) {
+    ready_.reset( new FileDescriptor( SystemCall( "eventfd", eventfd( 0, EFD_SEMAPHORE | EFD_CLOEXEC ) ) ) );
+    ready_period_ = period;
+
+    /* what is already in the ring counts too */
+    captured_ = ring_.occupancy();
+    const uint64_t periods = captured_ / period;
+    if ( periods ) {
+      SystemCall( "write to eventfd", ::write( ready_->fd_num(), &periods, sizeof( periods ) ) );
+    }
+  } else if ( period != ready_period_ ) {
+    throw runtime_error( "AsyncAudioReader: readiness already set up for another period" );
+  }
+
+  return ready_.get();
+}
+
+void AsyncAudioReader::read( uint8_t * buffer, const size_t size )
+{
+  /* takes one period off the semaphore, so the descriptor stays readable only while whole periods remain */
+  if ( ready_ ) {
+    uint64_t one;
+    SystemCall( "read from eventfd", ::read( ready_->fd_num(), &one, sizeof( one ) ) );
+  }
+
+  if ( not ring_.read( buffer, size ) ) {
+    throw runtime_error( "audio source closed" );
+  }
+}
+
+uint64_t AsyncAudioReader::latency( void )
+{
+  return server_latency_.load( memory_order_relaxed ) + ring_latency();
+}
+
+AsyncAudioWriter::AsyncAudioWriter( const string & output_device, const pa_sample_spec & ss,
+                                    const size_t period )
+  : PulseStream( "sink", ss, period, 8 )
+{
+  attr_.tlength = 2 * period_;
+  attr_.minreq = period_;
+
+  PulseMainloop::Lock lock { mainloop_ };
+
+  stream_ = pa_stream_new( mainloop_.context(), "playback", &sample_spec_, nullptr );
+  if ( stream_ == nullptr ) {
+    throw runtime_error( mainloop_.error( "pa_stream_new" ) );
+  }
+
+  pa_stream_set_write_callback( stream_, write_callback, this );
+  pa_stream_set_underflow_callback( stream_, underflow_callback, this );
+  pa_stream_set_overflow_callback( stream_, overflow_callback, this );
+  connect( PA_STREAM_PLAYBACK, output_device );
+}
+
+AsyncAudioWriter::~AsyncAudioWriter()
+{
+  disconnect();
+}
+
+void AsyncAudioWriter::fill( void )
+{
+  size_t wanted = min( pa_stream_writable_size( stream_ ), ring_.occupancy() );
+
+  while ( wanted > 0 ) {
+    void * buffer;
+    size_t length = wanted;
+
+    /* writes straight into the server's memory block */
+    if ( pa_stream_begin_write( stream_, &buffer, &length ) < 0 or length == 0 ) {
+      return;
+    }
+
+    length = ring_.try_read( static_cast<uint8_t *>( buffer ), min( length, wanted ) );
+    if ( length == 0 ) {
+      pa_stream_cancel_write( stream_ );
+      return;
+    }
+
+    pa_stream_write( stream_, buffer, length, nullptr, 0, PA_SEEK_RELATIVE );
+    wanted -= length;
+  }
+}
+
+void AsyncAudioWriter::write_callback( pa_stream *, size_t, void * userdata )
+{
+  AsyncAudioWriter * writer = static_cast<AsyncAudioWriter *>( userdata );
+
+  writer->fill();
+  writer->update_latency();
+  writer->adapt( false );
+}
+
+void AsyncAudioWriter::underflow_callback( pa_stream *, void * userdata )
+{
+  AsyncAudioWriter * writer = static_cast<AsyncAudioWriter *>( userdata );
+
+  writer->underruns_++;
+  writer->adapt( true );
+}
+
+void AsyncAudioWriter::overflow_callback( pa_stream *, void * userdata )
+{
+  static_cast<AsyncAudioWriter *>( userdata )->overruns_++;
+}
+
+void AsyncAudioWriter::write( const Chunk & data )
+{
+  /* larger writes go through the ring a piece at a time */
+  for ( Chunk remaining = data; remaining.size() > 0; ) {
+    const size_t length = min( remaining.size(), uint64_t( ring_.capacity() / 2 ) );
+
+    if ( not ring_.write( remaining.buffer(), length ) ) {
+      throw runtime_error( "audio sink closed" );
+    }
+
+    remaining = remaining( length );
+
+    /* don't wait for the next request if the server has room now */
+    PulseMainloop::Lock lock { mainloop_ };
+    fill();
+  }
+}
+
+uint64_t AsyncAudioWriter::latency( void )
+{
+  return server_latency_.load( memory_order_relaxed ) + ring_latency();
+}
@@ -0,0 +1,176 @@
+#ifndef PULSE_AUDIO_HH
+#define PULSE_AUDIO_HH
+
+#include <atomic>
+#include <string>
+
+#include <pulse/pulseaudio.h>
+
+#include "audio.hh"
+#include "byte_ring.hh"
+
+/* a pa_threaded_mainloop with one connected context */
+class PulseMainloop
+{
+private:
+  pa_threaded_mainloop * mainloop_;
+  pa_context * context_;
+
+  static void context_state_callback( pa_context * context, void * userdata );
+  void destroy( void );
+
+public:
+  PulseMainloop( const std::string & name );
+  ~PulseMainloop();
+
+  pa_context * context( void ) { return context_; }
+
+  /* for code outside the mainloop thread that touches streams */
+  class Lock
+  {
+    pa_threaded_mainloop * mainloop_;
+
+  public:
+    Lock( PulseMainloop & mainloop );
+    ~Lock();
+
+    Lock( const Lock & other ) = delete;
+    Lock & operator=( const Lock & other ) = delete;
+  };
+
+  /* with the lock held: sleeps until a callback calls signal() */
+  void wait( void );
+  void signal( void );
+
+  std::string error( const std::string & function );
+
+  PulseMainloop( const PulseMainloop & other ) = delete;
+  PulseMainloop & operator=( const PulseMainloop & other ) = delete;
+};
+
+/* a device's name and the format it runs at natively; streams in the
+   same format are passed through by the server without conversion */
+struct DeviceFormat
+{
+  std::string name;
+  pa_sample_spec sample_spec;
+};
+
+/* "" is the server's default device */
+DeviceFormat query_source_format( const std::string & device );
+DeviceFormat query_sink_format( const std::string & device );
+
+/* what the server does to turn one format into the other, or "none" */
+std::string describe_conversion( const pa_sample_spec & from, const pa_sample_spec & to );
+
+/* What the asynchronous reader and writer share: a stream whose
+   callbacks run on the mainloop thread and move audio between the
+   server and a ring buffer, never blocking. The stream latency is
+   queried every period, and the server-side buffer (tlength for
+   playback, fragsize for capture) is grown by a period whenever audio
+   is lost and shrunk by half a period after a long stretch without
+   loss, so it settles at the smallest size the system can sustain. */
+class PulseStream
+{
+protected:
+  PulseMainloop mainloop_;
+  const pa_sample_spec sample_spec_;
+  const uint32_t period_;
+  pa_stream_direction_t direction_ { PA_STREAM_NODIRECTION };
+  pa_stream * stream_ { nullptr };
+  pa_buffer_attr attr_ {};
+
+  ByteRing ring_;
+
+  std::atomic<uint64_t> server_latency_ { 0 };
+  std::atomic<uint64_t> underruns_ { 0 };
+  std::atomic<uint64_t> overruns_ { 0 };
+  std::atomic<uint32_t> buffer_length_ { 0 };
+
+  /* periods since the buffer was last grown or shrunk */
+  unsigned int stable_periods_ { 0 };
+
+  static void state_callback( pa_stream * stream, void * userdata );
+
+  void connect( pa_stream_direction_t direction, const std::string & device );
+
+  /* closes the ring and, under the lock, disconnects the stream, after
+     which no callback runs; the callbacks use the derived classes'
+     members, so their destructors call this before those are destroyed */
+  void disconnect( void );
+
+  void update_latency( void );
+
+  /* grows the adaptive buffer after a loss; shrinks it after enough good periods */
+  void adapt( const bool lost );
+
+  uint32_t & adaptive_length( void );
+  uint64_t ring_latency( void ) const { return pa_bytes_to_usec( ring_.occupancy(), &sample_spec_ ); }
+
+public:
+  PulseStream( const std::string & name, const pa_sample_spec & ss, const size_t period,
+               const size_t ring_periods );
+  virtual ~PulseStream();
+
+  /* the server-side buffer the stream has settled on, in microseconds */
+  uint64_t buffer_latency( void ) const
+  {
+    return pa_bytes_to_usec( buffer_length_.load( std::memory_order_relaxed ), &sample_spec_ );
+  }
+
+  PulseStream( const PulseStream & other ) = delete;
+  PulseStream & operator=( const PulseStream & other ) = delete;
+};
+
+class AsyncAudioReader : public AudioSource, public PulseStream
+{
+private:
+  /* once asked for: a semaphore eventfd counting the whole periods in the ring */
+  std::unique_ptr<FileDescriptor> ready_ {};
+  size_t ready_period_ { 0 };
+  uint64_t captured_ { 0 };
+
+  static void read_callback( pa_stream * stream, size_t length, void * userdata );
+
+  /* on the mainloop thread: counts `length` more bytes in the ring */
+  void captured( const size_t length );
+
+public:
+  /* `period` is the capture fragment the stream starts with, in bytes */
+  AsyncAudioReader( const std::string & input_device, const pa_sample_spec & ss,
+                    const size_t period );
+  ~AsyncAudioReader();
+
+  void read( uint8_t * buffer, const size_t size ) override;
+  uint64_t latency( void ) override;
+  uint64_t overruns( void ) const override { return overruns_.load( std::memory_order_relaxed ); }
+
+  /* the mainloop thread posts each period it completes, so capture can
+     run on the caller's loop instead of a thread blocked in read() */
+  FileDescriptor * readiness_fd( const size_t period ) override;
+};
+
+class AsyncAudioWriter : public AudioSink, public PulseStream
+{
+private:
+  static void write_callback( pa_stream * stream, size_t length, void * userdata );
+  static void underflow_callback( pa_stream * stream, void * userdata );
+  static void overflow_callback( pa_stream * stream, void * userdata );
+
+  /* with the lock held: moves what the server asks for from the ring */
+  void fill( void );
+
+public:
+  /* `period` is how much the server requests at a time, in bytes; the
+     target length starts at two periods */
+  AsyncAudioWriter( const std::string & output_device, const pa_sample_spec & ss,
+                    const size_t period );
+  ~AsyncAudioWriter();
+
+  void write( const Chunk & data ) override;
+  uint64_t latency( void ) override;
+  uint64_t underruns( void ) const override { return underruns_.load( std::memory_order_relaxed ); }
+  uint64_t overruns( void ) const { return overruns_.load( std::memory_order_relaxed ); }
+};
+
+#endif /* PULSE_AUDIO_HH */
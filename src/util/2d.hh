@@ -4,22 +4,24 @@
 #define TWOD_HH
 
 #include <cassert>
+#include <cstring>
 #include <vector>
 #include <memory>
 #include <functional>
 
 #include "optional.hh"
+#include "aligned_allocator.hh"
 
-/* simple two-dimensional container */
+/* simple two-dimensional container; rows are stride() elements apart */
 template <class T>
 class TwoDStorage
 {
 private:
-  unsigned int width_, height_;
-  std::vector< T > storage_;
+  unsigned int width_, height_, stride_;
+  std::vector< T, AlignedAllocator< T > > storage_;
 
 public:
-  using const_iterator = typename std::vector< T >::const_iterator;
+  using const_iterator = typename std::vector< T, AlignedAllocator< T > >::const_iterator;
 
   struct Context
   {
@@ -45,7 +47,7 @@ public:
 
   template< typename... Targs >
   TwoDStorage( const unsigned int width, const unsigned int height, Targs&&... Fargs )
-    : width_( width ), height_( height ), storage_()
+    : width_( width ), height_( height ), stride_( width ), storage_()
   {
     assert( width > 0 );
     assert( height > 0 );
@@ -64,13 +66,13 @@ public:
   T & at( const unsigned int column, const unsigned int row )
   {
     assert( column < width_ and row < height_ );
-    return storage_[ row * width_ + column ];
+    return storage_[ row * stride_ + column ];
   }
 
   const T & at( const unsigned int column, const unsigned int row ) const
   {
     assert( column < width_ and row < height_ );
-    return storage_[ row * width_ + column ];
+    return storage_[ row * stride_ + column ];
   }
 
   Optional<const T *> maybe_at( const unsigned int column, const unsigned int row ) const
@@ -84,6 +86,7 @@ public:
 
   unsigned int width( void ) const { return width_; }
   unsigned int height( void ) const { return height_; }
+  unsigned int stride( void ) const { return stride_; }
 
   const_iterator begin( void ) const
   {
@@ -162,6 +165,7 @@ public:
   {
     assert( width_ == other.width_ );
     assert( height_ == other.height_ );
+    assert( stride_ == other.stride_ );
     memcpy( &storage_[ 0 ], &other.storage_[ 0 ], sizeof( T ) * storage_.size() );
   }
 
@@ -192,6 +196,7 @@ public:
 
   unsigned int width( void ) const { return storage_->width(); }
   unsigned int height( void ) const { return storage_->height(); }
+  unsigned int stride( void ) const { return storage_->stride(); }
 
   template <class lambda>
   void forall( const lambda & f ) { storage_->forall( f ); }
@@ -384,7 +389,7 @@ public:
     }
   }
 
-  unsigned int stride( void ) const { return master_->width(); }
+  unsigned int stride( void ) const { return master_->stride(); }
 };
 
 #endif /* TWOD_HH */
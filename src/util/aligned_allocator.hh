@@ -0,0 +1,42 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef ALIGNED_ALLOCATOR_HH
+#define ALIGNED_ALLOCATOR_HH
+
+#include <cstdlib>
+#include <new>
+
+/* std::allocator replacement that hands out memory aligned to `alignment` bytes */
+
+template <class T, size_t alignment = 64>
+struct AlignedAllocator
+{
+  using value_type = T;
+
+  template <class U>
+  struct rebind { using other = AlignedAllocator<U, alignment>; };
+
+  AlignedAllocator() noexcept {}
+
+  template <class U>
+  AlignedAllocator( const AlignedAllocator<U, alignment> & ) noexcept {}
+
+  T * allocate( const size_t n )
+  {
+    void * ret = nullptr;
+    if ( posix_memalign( &ret, alignment, n * sizeof( T ) ) ) {
+      throw std::bad_alloc();
+    }
+    return static_cast<T *>( ret );
+  }
+
+  void deallocate( T * p, const size_t ) noexcept { free( p ); }
+
+  template <class U>
+  bool operator==( const AlignedAllocator<U, alignment> & ) const noexcept { return true; }
+
+  template <class U>
+  bool operator!=( const AlignedAllocator<U, alignment> & ) const noexcept { return false; }
+};
+
+#endif /* ALIGNED_ALLOCATOR_HH */
@@ -0,0 +1,173 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+
+#include "audio_resampler.hh"
+
+using namespace std;
+
+static constexpr unsigned int HALF_TAPS = AudioResampler::TAPS / 2;
+static constexpr double KAISER_BETA = 8.0;
+
+/* zeroth-order modified Bessel function of the first kind, by its power series */
+static double bessel_i0( const double x )
+{
+  double sum = 1, term = 1;
+
+  for ( unsigned int k = 1; term > sum * 1e-12; k++ ) {
+    term *= ( x / ( 2 * k ) ) * ( x / ( 2 * k ) );
+    sum += term;
+  }
+
+  return sum;
+}
+
+static double windowed_sinc( const double x, const double cutoff )
+{
+  const double r = x / HALF_TAPS;
+  if ( abs( r ) >= 1 ) {
+    return 0;
+  }
+
+  const double sinc = x == 0 ? 1 : sin( M_PI * cutoff * x ) / ( M_PI * cutoff * x );
+  return cutoff * sinc * bessel_i0( KAISER_BETA * sqrt( 1 - r * r ) ) / bessel_i0( KAISER_BETA );
+}
+
+/* the input against the two phases either side of the output's offset */
+static inline void dot2( const float * x, const float * h0, const float * h1, float & a, float & b )
+{
+#ifdef __SSE__
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+
+  for ( unsigned int i = 0; i < AudioResampler::TAPS; i += 4 ) {
+    const __m128 samples = _mm_loadu_ps( x + i );
+    acc0 = _mm_add_ps( acc0, _mm_mul_ps( samples, _mm_load_ps( h0 + i ) ) );
+    acc1 = _mm_add_ps( acc1, _mm_mul_ps( samples, _mm_load_ps( h1 + i ) ) );
+  }
+
+  /* both horizontal sums at once: (a0+a1, b0+b1, a2+a3, b2+b3) */
+  const __m128 pairs = _mm_add_ps( _mm_unpacklo_ps( acc0, acc1 ), _mm_unpackhi_ps( acc0, acc1 ) );
+  const __m128 sums = _mm_add_ps( pairs, _mm_movehl_ps( pairs, pairs ) );
+
+  a = _mm_cvtss_f32( sums );
+  b = _mm_cvtss_f32( _mm_shuffle_ps( sums, sums, 1 ) );
+#else
+  a = b = 0;
+
+  for ( unsigned int i = 0; i < AudioResampler::TAPS; i++ ) {
+    a += x[ i ] * h0[ i ];
+    b += x[ i ] * h1[ i ];
+  }
+#endif
+}
+
+static inline int16_t to_s16( const float sample )
+{
+  return max( -32768.0f, min( 32767.0f, nearbyintf( sample * 32768 ) ) );
+}
+
+AudioResampler::AudioResampler( const unsigned int input_rate, const unsigned int output_rate,
+                                const unsigned int channels, const size_t max_input_frames )
+  : input_rate_( input_rate ),
+    output_rate_( output_rate ),
+    channels_( channels ),
+    max_input_frames_( max_input_frames ),
+    filter_( ( PHASES + 1 ) * TAPS ),
+    history_( channels, FloatBuffer( TAPS + max_input_frames ) ),
+    history_frames_( HALF_TAPS - 1 ),
+    nominal_step_( double( input_rate ) / output_rate ),
+    step_( nominal_step_ )
+{
+  if ( input_rate == 0 or output_rate == 0 or channels == 0 or max_input_frames == 0 ) {
+    throw invalid_argument( "AudioResampler: invalid rates or sizes" );
+  }
+
+  /* a little below the lower Nyquist frequency, so the transition band aliases nothing audible */
+  const double cutoff = 0.95 * min( 1.0, double( output_rate ) / input_rate );
+
+  for ( unsigned int phase = 0; phase <= PHASES; phase++ ) {
+    float * row = &filter_[ phase * TAPS ];
+    double sum = 0;
+
+    for ( unsigned int tap = 0; tap < TAPS; tap++ ) {
+      row[ tap ] = windowed_sinc( tap - ( HALF_TAPS - 1.0 ) - double( phase ) / PHASES, cutoff );
+      sum += row[ tap ];
+    }
+
+    /* unity gain at DC for every phase */
+    for ( unsigned int tap = 0; tap < TAPS; tap++ ) {
+      row[ tap ] /= sum;
+    }
+  }
+}
+
+size_t AudioResampler::process( const int16_t * input, const size_t input_frames, int16_t * output )
+{
+  if ( input_frames > max_input_frames_ ) {
+    throw invalid_argument( "AudioResampler: input larger than configured" );
+  }
+
+  for ( unsigned int channel = 0; channel < channels_; channel++ ) {
+    float * history = history_[ channel ].data() + history_frames_;
+    for ( size_t frame = 0; frame < input_frames; frame++ ) {
+      history[ frame ] = input[ frame * channels_ + channel ] * ( 1.0f / 32768 );
+    }
+  }
+  history_frames_ += input_frames;
+
+  size_t output_frames = 0;
+
+  while ( true ) {
+    const size_t base = position_;
+    if ( base + TAPS > history_frames_ ) {
+      break;
+    }
+
+    const double phase = ( position_ - base ) * PHASES;
+    const unsigned int row = phase;
+    const float weight = phase - row;
+    const float * h0 = &filter_[ row * TAPS ];
+
+    for ( unsigned int channel = 0; channel < channels_; channel++ ) {
+      float a, b;
+      dot2( history_[ channel ].data() + base, h0, h0 + TAPS, a, b );
+      output[ output_frames * channels_ + channel ] = to_s16( a + weight * ( b - a ) );
+    }
+
+    output_frames++;
+    position_ += step_;
+  }
+
+  /* drop the input no future output reaches back to */
+  const size_t consumed = min( size_t( position_ ), history_frames_ );
+  for ( auto & history : history_ ) {
+    memmove( history.data(), history.data() + consumed, ( history_frames_ - consumed ) * sizeof( float ) );
+  }
+  history_frames_ -= consumed;
+  position_ -= consumed;
+
+  return output_frames;
+}
+
+size_t AudioResampler::max_output_frames( void ) const
+{
+  return ceil( ( max_input_frames_ + TAPS ) / ( nominal_step_ * ( 1 - MAX_ADJUSTMENT_PPM / 1e6 ) ) ) + 1;
+}
+
+void AudioResampler::set_adjustment( const double ppm )
+{
+  const double limit = MAX_ADJUSTMENT_PPM;
+  step_ = nominal_step_ * ( 1 + max( -limit, min( limit, ppm ) ) / 1e6 );
+}
+
+uint64_t AudioResampler::latency( void ) const
+{
+  return uint64_t( HALF_TAPS ) * 1000000 / input_rate_;
+}
@@ -0,0 +1,68 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef AUDIO_RESAMPLER_HH
+#define AUDIO_RESAMPLER_HH
+
+#include <cstdint>
+#include <vector>
+
+#include "aligned_allocator.hh"
+
+/* Streaming sample-rate converter for interleaved 16-bit PCM.
+
+   A Kaiser-windowed sinc, cut off just below the lower of the two
+   Nyquist frequencies, is tabulated at PHASES fractional offsets; each
+   output sample interpolates linearly between the two nearest phases,
+   so any ratio works without a table per ratio. Channels are kept
+   deinterleaved as floats, and the dot products run four taps at a time
+   with SSE. All buffers are sized in the constructor for inputs of up
+   to `max_input_frames` per call. */
+class AudioResampler
+{
+public:
+  static constexpr unsigned int TAPS = 32;
+  static constexpr unsigned int PHASES = 256;
+
+  /* the most set_adjustment() will speed up or slow down the conversion, in ppm */
+  static constexpr double MAX_ADJUSTMENT_PPM = 10000;
+
+private:
+  typedef std::vector<float, AlignedAllocator<float>> FloatBuffer;
+
+  unsigned int input_rate_, output_rate_, channels_;
+  size_t max_input_frames_;
+
+  /* (PHASES + 1) rows of TAPS coefficients; the last row is the first shifted by one tap */
+  FloatBuffer filter_;
+
+  /* per channel: the input not yet consumed, oldest first */
+  std::vector<FloatBuffer> history_;
+  size_t history_frames_;
+
+  /* position of the next output, in input frames from the start of the history */
+  double position_ { 0 };
+  double nominal_step_, step_;
+
+public:
+  AudioResampler( const unsigned int input_rate, const unsigned int output_rate,
+                  const unsigned int channels, const size_t max_input_frames );
+
+  /* converts `input_frames` frames; returns the number written to `output`, which
+     must have room for max_output_frames() */
+  size_t process( const int16_t * input, const size_t input_frames, int16_t * output );
+
+  size_t max_output_frames( void ) const;
+
+  /* Consumes input `ppm` parts per million faster than the nominal ratio
+     (slower if negative), for trimming clock drift; takes effect at the
+     next output sample, so it can change every call without clicks. */
+  void set_adjustment( const double ppm );
+
+  /* microseconds of delay the filter adds */
+  uint64_t latency( void ) const;
+
+  unsigned int input_rate( void ) const { return input_rate_; }
+  unsigned int output_rate( void ) const { return output_rate_; }
+};
+
+#endif /* AUDIO_RESAMPLER_HH */
@@ -0,0 +1,199 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef BYTE_RING_HH
+#define BYTE_RING_HH
+
+#include <algorithm>
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+
+#include "futex.hh"
+
+/* Single-producer/single-consumer ring of bytes, for streams whose two
+   ends move in different amounts (an audio device's callback on one
+   side, fixed-size reads or writes on the other).
+
+   try_read()/try_write() never block, so they are safe to call from
+   callbacks that must not sleep; read()/write() sleep on a shared
+   sequence number with a futex until the whole request fits, and a read
+   or write bumps (and wakes) it only when the other side is actually
+   asleep; close() bumps it once without waiting for anyone. Positions are free-running 32-bit counters,
+   so the capacity is limited to 2 GiB. */
+
+class ByteRing
+{
+private:
+  std::vector<uint8_t> buffer_;
+  const uint32_t capacity_;
+
+  /* the two sides' words sit on separate cache lines; padded rather than
+     aligned, so rings can be members of heap-allocated objects in C++14 */
+  char padding0_[ 64 ] {};
+  std::atomic<uint32_t> write_position_ { 0 };
+  std::atomic<uint32_t> producer_waiting_ { 0 };
+
+  char padding1_[ 64 ] {};
+  std::atomic<uint32_t> read_position_ { 0 };
+  std::atomic<uint32_t> consumer_waiting_ { 0 };
+
+  char padding2_[ 64 ] {};
+
+  std::atomic<bool> closed_ { false };
+  std::atomic<uint32_t> sequence_ { 0 };
+
+  void wake_all( void )
+  {
+    sequence_.fetch_add( 1 );
+    futex_wake( sequence_, INT_MAX );
+  }
+
+  /* copies between the ring and linear memory, wrapping at the end */
+  void copy_in( const uint32_t position, const uint8_t * data, const size_t length )
+  {
+    const size_t offset = position % capacity_;
+    const size_t first = std::min( length, capacity_ - offset );
+    memcpy( buffer_.data() + offset, data, first );
+    memcpy( buffer_.data(), data + first, length - first );
+  }
+
+  void copy_out( const uint32_t position, uint8_t * data, const size_t length ) const
+  {
+    const size_t offset = position % capacity_;
+    const size_t first = std::min( length, capacity_ - offset );
+    memcpy( data, buffer_.data() + offset, first );
+    memcpy( data + first, buffer_.data(), length - first );
+  }
+
+  template <class Predicate>
+  bool wait_for( std::atomic<uint32_t> & other, std::atomic<uint32_t> & waiting,
+                 const Predicate & ready )
+  {
+    while ( not ready( other.load( std::memory_order_acquire ) ) ) {
+      if ( closed_.load( std::memory_order_acquire ) ) {
+        return false;
+      }
+
+      const uint32_t sequence = sequence_.load();
+      waiting.store( 1 );
+
+      /* re-check after announcing, so a concurrent update or close either
+         sees the flag (and bumps the sequence we read) or we see its update */
+      if ( not ready( other.load() ) and not closed_.load() ) {
+        futex_wait( sequence_, sequence );
+      }
+
+      waiting.store( 0, std::memory_order_relaxed );
+    }
+
+    return true;
+  }
+
+public:
+  ByteRing( const size_t capacity )
+    : buffer_( capacity ), capacity_( capacity )
+  {
+    if ( capacity == 0 or capacity > UINT32_MAX / 2 ) {
+      throw std::invalid_argument( "ByteRing: invalid capacity" );
+    }
+  }
+
+  size_t capacity( void ) const { return capacity_; }
+
+  size_t occupancy( void ) const
+  {
+    return write_position_.load( std::memory_order_acquire ) - read_position_.load( std::memory_order_acquire );
+  }
+
+  /* producer side: writes as much as fits, returns the number of bytes written */
+  size_t try_write( const uint8_t * data, const size_t length )
+  {
+    const uint32_t written = write_position_.load( std::memory_order_relaxed );
+    const size_t free = capacity_ - ( written - read_position_.load( std::memory_order_acquire ) );
+    const size_t amount = std::min( length, free );
+
+    copy_in( written, data, amount );
+    write_position_.store( written + amount, std::memory_order_seq_cst );
+
+    if ( amount and consumer_waiting_.load() ) {
+      wake_all();
+    }
+
+    return amount;
+  }
+
+  /* blocks until all of `data` fits; returns false if the ring was closed */
+  bool write( const uint8_t * data, const size_t length )
+  {
+    if ( length > capacity_ ) {
+      throw std::invalid_argument( "ByteRing: write larger than capacity" );
+    }
+
+    const uint32_t written = write_position_.load( std::memory_order_relaxed );
+    if ( not wait_for( read_position_, producer_waiting_,
+                       [&]( const uint32_t read ) { return capacity_ - ( written - read ) >= length; } ) ) {
+      return false;
+    }
+
+    return try_write( data, length ) == length;
+  }
+
+  /* consumer side: reads what is there, up to `length` */
+  size_t try_read( uint8_t * data, const size_t length )
+  {
+    const uint32_t read = read_position_.load( std::memory_order_relaxed );
+    const size_t available = write_position_.load( std::memory_order_acquire ) - read;
+    const size_t amount = std::min( length, available );
+
+    copy_out( read, data, amount );
+    read_position_.store( read + amount, std::memory_order_seq_cst );
+
+    if ( amount and producer_waiting_.load() ) {
+      wake_all();
+    }
+
+    return amount;
+  }
+
+  /* blocks until `length` bytes have arrived; returns false if the ring was closed */
+  bool read( uint8_t * data, const size_t length )
+  {
+    if ( length > capacity_ ) {
+      throw std::invalid_argument( "ByteRing: read larger than capacity" );
+    }
+
+    const uint32_t read = read_position_.load( std::memory_order_relaxed );
+    if ( not wait_for( write_position_, consumer_waiting_,
+                       [&]( const uint32_t written ) { return written - read >= length; } ) ) {
+      return false;
+    }
+
+    return try_read( data, length ) == length;
+  }
+
+  /* drops everything waiting to be read (consumer side) */
+  void clear( void )
+  {
+    read_position_.store( write_position_.load( std::memory_order_acquire ) );
+
+    if ( producer_waiting_.load() ) {
+      wake_all();
+    }
+  }
+
+  /* wakes both sides without waiting for them; blocking calls fail from then on */
+  void close( void )
+  {
+    closed_.store( true );
+    wake_all();
+  }
+
+  /* forbid copying and moving; both sides share buffer_ */
+  ByteRing( const ByteRing & other ) = delete;
+  ByteRing & operator=( const ByteRing & other ) = delete;
+};
+
+#endif /* BYTE_RING_HH */
@@ -0,0 +1,151 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <algorithm>
+#include <cmath>
+#include <emmintrin.h>
+
+#include "color_convert.hh"
+
+using namespace std;
+
+/* bilinear sample of a chroma plane at texel coordinates (x, y), where
+   texel centers sit at +0.5 as in a GL rectangle texture */
+static float sample( const TwoD<uint8_t> & plane, const float x, const float y )
+{
+  const float fx = x - 0.5f, fy = y - 0.5f;
+  const int x0 = floor( fx ), y0 = floor( fy );
+  const float ax = fx - x0, ay = fy - y0;
+
+  const int max_x = plane.width() - 1, max_y = plane.height() - 1;
+  auto at = [&]( const int col, const int row ) -> float {
+    return plane.at( min( max( col, 0 ), max_x ), min( max( row, 0 ), max_y ) );
+  };
+
+  return ( 1 - ay ) * ( ( 1 - ax ) * at( x0, y0 ) + ax * at( x0 + 1, y0 ) )
+    + ay * ( ( 1 - ax ) * at( x0, y0 + 1 ) + ax * at( x0 + 1, y0 + 1 ) );
+}
+
+static uint8_t to_byte( const float value )
+{
+  return lrint( 255 * min( max( value, 0.0f ), 1.0f ) );
+}
+
+void ycbcr_to_rgba_reference( const BaseRaster & raster, vector<uint8_t> & rgba )
+{
+  const unsigned int width = raster.display_width();
+  const unsigned int height = raster.display_height();
+
+  rgba.resize( 4 * size_t( width ) * height );
+
+  for ( unsigned int row = 0; row < height; row++ ) {
+    for ( unsigned int col = 0; col < width; col++ ) {
+      /* the shader's chroma coordinate is (x / 2 + 0.25, y / 2) at pixel center (x, y) */
+      const float chroma_x = ( col + 0.5f ) / 2 + 0.25f;
+      const float chroma_y = ( row + 0.5f ) / 2;
+
+      const float Y = raster.Y().at( col, row ) / 255.0f - 0.06274509803921568627f;
+      const float Cb = sample( raster.U(), chroma_x, chroma_y ) / 255.0f - 0.50196078431372549019f;
+      const float Cr = sample( raster.V(), chroma_x, chroma_y ) / 255.0f - 0.50196078431372549019f;
+
+      uint8_t * pixel = &rgba[ 4 * ( size_t( row ) * width + col ) ];
+      pixel[ 0 ] = to_byte( 1.16438356164384f * Y + 1.59567019581339f * Cr );
+      pixel[ 1 ] = to_byte( 1.16438356164384f * Y - 0.391260370716072f * Cb - 0.813004933873461f * Cr );
+      pixel[ 2 ] = to_byte( 1.16438356164384f * Y + 2.01741475897078f * Cb );
+      pixel[ 3 ] = 255;
+    }
+  }
+}
+
+/* coefficients in Q13, applied with _mm_mulhi_epi16 to samples in Q6,
+   leaving 3 fractional bits */
+static constexpr int16_t K_Y = 9539;      /* 1.164 */
+static constexpr int16_t K_R_CR = 13075;  /* 1.596 */
+static constexpr int16_t K_G_CB = 3209;   /* 0.391 */
+static constexpr int16_t K_G_CR = 6660;   /* 0.813 */
+static constexpr int16_t K_B_CB = 16525;  /* 2.017 */
+
+static inline uint8_t clamp_byte( const int value )
+{
+  return min( max( value, 0 ), 255 );
+}
+
+static void bgrx_pixel( const int Y, const int Cb, const int Cr, uint8_t * out )
+{
+  const int y = ( Y - 16 ) * 64, cb = ( Cb - 128 ) * 64, cr = ( Cr - 128 ) * 64;
+  const int luma = ( y * K_Y ) >> 16;
+
+  out[ 0 ] = clamp_byte( ( luma + ( ( cb * K_B_CB ) >> 16 ) + 4 ) >> 3 );
+  out[ 1 ] = clamp_byte( ( luma - ( ( cb * K_G_CB ) >> 16 ) - ( ( cr * K_G_CR ) >> 16 ) + 4 ) >> 3 );
+  out[ 2 ] = clamp_byte( ( luma + ( ( cr * K_R_CR ) >> 16 ) + 4 ) >> 3 );
+  out[ 3 ] = 255;
+}
+
+/* 8 pixels: 16-bit Q6 luma and (already duplicated) chroma in, packed 16-bit B, G, R out */
+static inline void bgr_16( const __m128i y, const __m128i cb, const __m128i cr,
+                           __m128i & b, __m128i & g, __m128i & r )
+{
+  const __m128i round = _mm_set1_epi16( 4 );
+  const __m128i luma = _mm_add_epi16( _mm_mulhi_epi16( y, _mm_set1_epi16( K_Y ) ), round );
+
+  b = _mm_srai_epi16( _mm_add_epi16( luma, _mm_mulhi_epi16( cb, _mm_set1_epi16( K_B_CB ) ) ), 3 );
+  g = _mm_srai_epi16( _mm_sub_epi16( _mm_sub_epi16( luma, _mm_mulhi_epi16( cb, _mm_set1_epi16( K_G_CB ) ) ),
+                                     _mm_mulhi_epi16( cr, _mm_set1_epi16( K_G_CR ) ) ), 3 );
+  r = _mm_srai_epi16( _mm_add_epi16( luma, _mm_mulhi_epi16( cr, _mm_set1_epi16( K_R_CR ) ) ), 3 );
+}
+
+void i420_to_bgrx( const BaseRaster & raster, uint8_t * bgrx, const size_t stride,
+                   const unsigned int begin_row, const unsigned int end_row )
+{
+  const unsigned int width = raster.display_width();
+  const unsigned int last_chroma_col = raster.U().width() - 1;
+  const unsigned int last_chroma_row = raster.U().height() - 1;
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i luma_offset = _mm_set1_epi16( 16 );
+  const __m128i chroma_offset = _mm_set1_epi16( 128 );
+  const __m128i opaque = _mm_set1_epi8( -1 );
+
+  for ( unsigned int row = begin_row; row < end_row; row++ ) {
+    const uint8_t * Y = &raster.Y().at( 0, row );
+    const uint8_t * U = &raster.U().at( 0, min( row / 2, last_chroma_row ) );
+    const uint8_t * V = &raster.V().at( 0, min( row / 2, last_chroma_row ) );
+    uint8_t * out = bgrx + row * stride;
+
+    unsigned int col = 0;
+
+    for ( ; col + 16 <= width; col += 16 ) {
+      const __m128i y8 = _mm_loadu_si128( reinterpret_cast<const __m128i *>( Y + col ) );
+      const __m128i u8 = _mm_loadl_epi64( reinterpret_cast<const __m128i *>( U + col / 2 ) );
+      const __m128i v8 = _mm_loadl_epi64( reinterpret_cast<const __m128i *>( V + col / 2 ) );
+
+      /* widen to 16 bits, remove the offsets, scale to Q6 */
+      const __m128i y_lo = _mm_slli_epi16( _mm_sub_epi16( _mm_unpacklo_epi8( y8, zero ), luma_offset ), 6 );
+      const __m128i y_hi = _mm_slli_epi16( _mm_sub_epi16( _mm_unpackhi_epi8( y8, zero ), luma_offset ), 6 );
+      const __m128i u16 = _mm_slli_epi16( _mm_sub_epi16( _mm_unpacklo_epi8( u8, zero ), chroma_offset ), 6 );
+      const __m128i v16 = _mm_slli_epi16( _mm_sub_epi16( _mm_unpacklo_epi8( v8, zero ), chroma_offset ), 6 );
+
+      /* each chroma sample covers two horizontally adjacent pixels */
+      __m128i b_lo, g_lo, r_lo, b_hi, g_hi, r_hi;
+      bgr_16( y_lo, _mm_unpacklo_epi16( u16, u16 ), _mm_unpacklo_epi16( v16, v16 ), b_lo, g_lo, r_lo );
+      bgr_16( y_hi, _mm_unpackhi_epi16( u16, u16 ), _mm_unpackhi_epi16( v16, v16 ), b_hi, g_hi, r_hi );
+
+      const __m128i b = _mm_packus_epi16( b_lo, b_hi );
+      const __m128i g = _mm_packus_epi16( g_lo, g_hi );
+      const __m128i r = _mm_packus_epi16( r_lo, r_hi );
+
+      /* interleave into B G R X */
+      const __m128i bg_lo = _mm_unpacklo_epi8( b, g ), bg_hi = _mm_unpackhi_epi8( b, g );
+      const __m128i rx_lo = _mm_unpacklo_epi8( r, opaque ), rx_hi = _mm_unpackhi_epi8( r, opaque );
+
+      __m128i * dest = reinterpret_cast<__m128i *>( out + 4 * col );
+      _mm_storeu_si128( dest, _mm_unpacklo_epi16( bg_lo, rx_lo ) );
+      _mm_storeu_si128( dest + 1, _mm_unpackhi_epi16( bg_lo, rx_lo ) );
+      _mm_storeu_si128( dest + 2, _mm_unpacklo_epi16( bg_hi, rx_hi ) );
+      _mm_storeu_si128( dest + 3, _mm_unpackhi_epi16( bg_hi, rx_hi ) );
+    }
+
+    for ( ; col < width; col++ ) {
+      const unsigned int chroma_col = min( col / 2, last_chroma_col );
+      bgrx_pixel( Y[ col ], U[ chroma_col ], V[ chroma_col ], out + 4 * col );
+    }
+  }
+}
@@ -0,0 +1,27 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef COLOR_CONVERT_HH
+#define COLOR_CONVERT_HH
+
+/* Y'CbCr (BT.601, limited range) to RGB on the CPU */
+
+#include <cstdint>
+#include <vector>
+
+#include "raster.hh"
+
+/* Reference conversion of the raster's display rectangle to RGBA rows,
+   top row first. Uses the same coefficients and the same chroma sampling
+   positions (bilinear, clamped at the edges) as VideoDisplay's shader at
+   1:1 scale, so a read-back frame should match it to within rounding. */
+void ycbcr_to_rgba_reference( const BaseRaster & raster, std::vector<uint8_t> & rgba );
+
+/* Converts rows [begin_row, end_row) of the display rectangle to 32-bit
+   BGRX (the X server's native 24-bit-depth layout) at `bgrx`, `stride`
+   bytes per row. Each chroma sample covers its 2x2 block of luma. 16
+   pixels at a time with SSE2, in 3-bit fixed point; within 1 of the
+   exact conversion. Disjoint row ranges may run on separate threads. */
+void i420_to_bgrx( const BaseRaster & raster, uint8_t * bgrx, const size_t stride,
+                   const unsigned int begin_row, const unsigned int end_row );
+
+#endif /* COLOR_CONVERT_HH */
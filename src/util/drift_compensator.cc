@@ -0,0 +1,66 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "drift_compensator.hh"
+
+using namespace std;
+
+DriftCompensator::DriftCompensator( const double window, const double settle,
+                                    const double max_correction_ppm )
+  : window_( window ), settle_( settle ), max_correction_( max_correction_ppm )
+{
+  if ( window <= 0 or settle <= 0 or max_correction_ppm < 0 ) {
+    throw invalid_argument( "DriftCompensator: invalid parameters" );
+  }
+}
+
+double DriftCompensator::update( const int64_t now, const int64_t latency )
+{
+  if ( origin_ == 0 ) {
+    origin_ = last_ = now;
+  }
+
+  const double elapsed = ( now - last_ ) / 1e6;
+  last_ = now;
+
+  /* Fit the latency as it would have been without any correction (each
+     ppm applied for a second took a microsecond off it), so the slope is
+     the clocks' own drift rather than what is left of it. */
+  const double correction = correction_ppm();
+  applied_us_ += correction * elapsed;
+
+  const double x = ( now - origin_ ) / 1e6;
+  const double y = latency + applied_us_;
+  const double decay = exp( -elapsed / window_ );
+
+  weight_ = weight_ * decay + 1;
+  sum_x_ = sum_x_ * decay + x;
+  sum_y_ = sum_y_ * decay + y;
+  sum_xx_ = sum_xx_ * decay + x * x;
+  sum_xy_ = sum_xy_ * decay + x * y;
+
+  const double denominator = weight_ * sum_xx_ - sum_x_ * sum_x_;
+  if ( x < window_ or denominator <= 0 ) {
+    return correction;
+  }
+
+  const double drift = ( weight_ * sum_xy_ - sum_x_ * sum_y_ ) / denominator;
+  const double fitted = ( sum_y_ - drift * sum_x_ ) / weight_ + drift * x - applied_us_;
+
+  if ( not have_target_ ) {
+    target_ = fitted;
+    have_target_ = true;
+  }
+
+  const double error = fitted - target_;
+  const double next = max( -max_correction_, min( max_correction_, drift + error / settle_ ) );
+
+  drift_ppm_.store( drift, memory_order_relaxed );
+  error_us_.store( error, memory_order_relaxed );
+  correction_ppm_.store( next, memory_order_relaxed );
+
+  return next;
+}
@@ -0,0 +1,53 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef DRIFT_COMPENSATOR_HH
+#define DRIFT_COMPENSATOR_HH
+
+#include <atomic>
+#include <cstdint>
+
+/* Keeps a latency that should be constant from creeping when two
+   clocks disagree, by trimming the rate of one of them.
+
+   Each update() is a reading of the latency (in microseconds) at some
+   CLOCK_MONOTONIC time. An exponentially weighted least-squares line
+   through the readings gives the drift, as the slope in ppm (us of
+   latency gained per second), and the current latency, free of the
+   readings' jitter. The target is the latency reached after the first
+   window; from then on the correction is the drift plus whatever rate
+   removes the remaining error within `settle` seconds, clamped.
+
+   A positive correction means the consumer should go that much faster.
+   The results are atomics, so other threads can log them. */
+class DriftCompensator
+{
+private:
+  double window_, settle_, max_correction_;
+
+  /* the fit's weighted sums, with x in seconds since the first reading and y in us */
+  int64_t origin_ { 0 }, last_ { 0 };
+  double weight_ { 0 }, sum_x_ { 0 }, sum_y_ { 0 }, sum_xx_ { 0 }, sum_xy_ { 0 };
+
+  /* how much latency the corrections so far have removed, in us */
+  double applied_us_ { 0 };
+
+  bool have_target_ { false };
+  double target_ { 0 };
+
+  std::atomic<double> drift_ppm_ { 0 };
+  std::atomic<double> error_us_ { 0 };
+  std::atomic<double> correction_ppm_ { 0 };
+
+public:
+  DriftCompensator( const double window = 10, const double settle = 30,
+                    const double max_correction_ppm = 1000 );
+
+  /* returns the correction to apply, in ppm */
+  double update( const int64_t now, const int64_t latency );
+
+  double drift_ppm( void ) const { return drift_ppm_.load( std::memory_order_relaxed ); }
+  double error_us( void ) const { return error_us_.load( std::memory_order_relaxed ); }
+  double correction_ppm( void ) const { return correction_ppm_.load( std::memory_order_relaxed ); }
+};
+
+#endif /* DRIFT_COMPENSATOR_HH */
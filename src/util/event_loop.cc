@@ -0,0 +1,103 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <sys/eventfd.h>
+
+#include "event_loop.hh"
+#include "exception.hh"
+
+using namespace std;
+
+static constexpr int MAX_EVENTS = 16;
+
+EventLoop::EventLoop()
+  : epoll_fd_( SystemCall( "epoll_create1", epoll_create1( EPOLL_CLOEXEC ) ) ),
+    wakeup_fd_( SystemCall( "eventfd", eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ) ) )
+{
+  epoll_event event {};
+  event.events = EPOLLIN;
+  event.data.fd = wakeup_fd_.fd_num();
+  SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_ADD, wakeup_fd_.fd_num(), &event ) );
+}
+
+void EventLoop::add( FileDescriptor & fd, const Direction direction, const Callback & callback )
+{
+  if ( callbacks_.count( fd.fd_num() ) ) {
+    throw runtime_error( "EventLoop: descriptor already registered" );
+  }
+
+  epoll_event event {};
+  event.events = direction;
+  event.data.fd = fd.fd_num();
+  SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_ADD, fd.fd_num(), &event ) );
+
+  callbacks_.emplace( fd.fd_num(), callback );
+}
+
+void EventLoop::remove( FileDescriptor & fd )
+{
+  if ( callbacks_.erase( fd.fd_num() ) ) {
+    SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_DEL, fd.fd_num(), nullptr ) );
+  }
+}
+
+bool EventLoop::run_once( const int timeout_ms )
+{
+  if ( stopped_ ) {
+    return false;
+  }
+
+  epoll_event events[ MAX_EVENTS ];
+  const int count = epoll_wait( epoll_fd_.fd_num(), events, MAX_EVENTS, timeout_ms );
+
+  if ( count < 0 ) {
+    if ( errno == EINTR ) {
+      return true;
+    }
+    throw unix_error( "epoll_wait" );
+  }
+
+  wakeups_.fetch_add( 1, memory_order_relaxed );
+
+  for ( int i = 0; i < count and not stopped_; i++ ) {
+    const int fd_num = events[ i ].data.fd;
+
+    if ( fd_num == wakeup_fd_.fd_num() ) {
+      stopped_ = true;
+      break;
+    }
+
+    /* an earlier callback in this round may have removed it */
+    const auto callback = callbacks_.find( fd_num );
+    if ( callback == callbacks_.end() ) {
+      continue;
+    }
+
+    /* errors and hangups go to the callback too, which will find out by reading */
+    switch ( callback->second() ) {
+    case Result::Continue:
+      break;
+
+    case Result::Cancel:
+      SystemCall( "epoll_ctl", epoll_ctl( epoll_fd_.fd_num(), EPOLL_CTL_DEL, fd_num, nullptr ) );
+      callbacks_.erase( callback );
+      break;
+
+    case Result::Exit:
+      stopped_ = true;
+      break;
+    }
+  }
+
+  return not stopped_;
+}
+
+void EventLoop::run( void )
+{
+  while ( run_once() ) {}
+}
+
+void EventLoop::stop( void )
+{
+  const uint64_t one = 1;
+  SystemCall( "write to eventfd", ::write( wakeup_fd_.fd_num(), &one, sizeof( one ) ) );
+}
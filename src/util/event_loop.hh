@@ -0,0 +1,68 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef EVENT_LOOP_HH
+#define EVENT_LOOP_HH
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <unordered_map>
+#include <sys/epoll.h>
+
+#include "file_descriptor.hh"
+
+/* Readiness loop on epoll, for the devices and timers one thread can
+   serve without blocking on any of them. A callback is registered per
+   FileDescriptor and runs on the thread in run() whenever the descriptor
+   is ready; readiness is level-triggered, so a callback that leaves data
+   behind simply runs again on the next round. SignalFD and TimerFD
+   descriptors fit as they are, and stop() wakes the loop from any
+   thread through an eventfd.
+
+   A callback ends its own registration by returning Cancel (calling
+   remove() on itself would destroy it while it runs), and ends the loop
+   by returning Exit. */
+
+class EventLoop
+{
+public:
+  enum class Result { Continue, Cancel, Exit };
+  typedef std::function<Result( void )> Callback;
+
+  enum Direction : uint32_t { In = EPOLLIN, Out = EPOLLOUT };
+
+private:
+  FileDescriptor epoll_fd_;
+  FileDescriptor wakeup_fd_;
+
+  std::unordered_map<int, Callback> callbacks_ {};
+
+  std::atomic<bool> stopped_ { false };
+  std::atomic<uint64_t> wakeups_ { 0 };
+
+public:
+  EventLoop();
+
+  /* one registration per descriptor; the descriptor must outlive it */
+  void add( FileDescriptor & fd, const Direction direction, const Callback & callback );
+  void remove( FileDescriptor & fd );
+
+  /* waits up to `timeout_ms` (forever if negative) and runs the callback
+     of every ready descriptor; false once stopped */
+  bool run_once( const int timeout_ms = -1 );
+
+  /* runs callbacks until one returns Exit or stop() is called */
+  void run( void );
+
+  /* thread-safe */
+  void stop( void );
+
+  /* returns from epoll_wait, for telling how often the loop's thread was woken */
+  uint64_t wakeups( void ) const { return wakeups_.load( std::memory_order_relaxed ); }
+
+  /* forbid copying and moving; callbacks usually capture the loop */
+  EventLoop( const EventLoop & other ) = delete;
+  EventLoop & operator=( const EventLoop & other ) = delete;
+};
+
+#endif /* EVENT_LOOP_HH */
@@ -0,0 +1,38 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef FUTEX_HH
+#define FUTEX_HH
+
+/* blocking on a 32-bit atomic word with the Linux futex syscall */
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "exception.hh"
+
+static_assert( sizeof( std::atomic<uint32_t> ) == sizeof( uint32_t ),
+               "futex word must be a plain 32-bit integer" );
+
+/* sleeps while `word` still holds `expected`; spurious wakeups are possible */
+inline void futex_wait( std::atomic<uint32_t> & word, const uint32_t expected,
+                        const timespec * timeout = nullptr )
+{
+  if ( syscall( SYS_futex, reinterpret_cast<uint32_t *>( &word ), FUTEX_WAIT_PRIVATE,
+                expected, timeout, nullptr, 0 ) < 0
+       and errno != EAGAIN and errno != EINTR and errno != ETIMEDOUT ) {
+    throw unix_error( "futex wait" );
+  }
+}
+
+inline void futex_wake( std::atomic<uint32_t> & word, const int count = 1 )
+{
+  SystemCall( "futex wake", syscall( SYS_futex, reinterpret_cast<uint32_t *>( &word ),
+                                     FUTEX_WAKE_PRIVATE, count, nullptr, nullptr, 0 ) );
+}
+
+#endif /* FUTEX_HH */
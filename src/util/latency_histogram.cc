@@ -0,0 +1,47 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <algorithm>
+#include <cmath>
+
+#include "latency_histogram.hh"
+
+using namespace std;
+
+constexpr unsigned int LatencyHistogram::BUCKETS;
+
+uint64_t LatencyHistogram::upper_bound( const unsigned int index )
+{
+  if ( index < 4 ) {
+    return index;
+  }
+
+  const unsigned int shift = index / 4 - 1;
+  return ( ( 4 + index % 4 + 1 ) << shift ) - 1;
+}
+
+uint64_t LatencyHistogram::percentile( const double fraction ) const
+{
+  const uint64_t total = count();
+  if ( total == 0 ) {
+    return 0;
+  }
+
+  const uint64_t rank = std::max<uint64_t>( 1, ceil( fraction * total ) );
+  uint64_t seen = 0;
+
+  for ( unsigned int index = 0; index < BUCKETS; index++ ) {
+    seen += counts_[ index ].load( memory_order_relaxed );
+    if ( seen >= rank ) {
+      /* the bucket's bound may be past anything actually seen */
+      return min( upper_bound( index ), max() );
+    }
+  }
+
+  return max();
+}
+
+string LatencyHistogram::report( void ) const
+{
+  return "p50 " + to_string( percentile( 0.5 ) ) + ", p99 " + to_string( percentile( 0.99 ) )
+    + ", max " + to_string( max() ) + " us (" + to_string( count() ) + ")";
+}
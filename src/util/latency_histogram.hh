@@ -0,0 +1,67 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef LATENCY_HISTOGRAM_HH
+#define LATENCY_HISTOGRAM_HH
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+/* Latencies in microseconds, counted in buckets four to an octave (so a
+   percentile is good to within 19%), for one thread to record() into
+   while another reads percentiles out. Negative latencies count as 0. */
+
+class LatencyHistogram
+{
+public:
+  static constexpr unsigned int BUCKETS = 160;
+
+private:
+  std::array<std::atomic<uint64_t>, BUCKETS> counts_ {};
+  std::atomic<uint64_t> count_ { 0 };
+  std::atomic<uint64_t> max_ { 0 };
+
+  /* 0-3 exactly, then the top three significant bits */
+  static unsigned int bucket( const uint64_t us )
+  {
+    if ( us < 4 ) {
+      return us;
+    }
+
+    const unsigned int msb = 63 - __builtin_clzll( us );
+    const unsigned int index = 4 * ( msb - 1 ) + ( ( us >> ( msb - 2 ) ) & 3 );
+    return index < BUCKETS ? index : BUCKETS - 1;
+  }
+
+  /* the largest latency bucket `index` counts */
+  static uint64_t upper_bound( const unsigned int index );
+
+public:
+  void record( const int64_t us )
+  {
+    const uint64_t value = us > 0 ? us : 0;
+
+    counts_[ bucket( value ) ].fetch_add( 1, std::memory_order_relaxed );
+    count_.fetch_add( 1, std::memory_order_relaxed );
+    if ( value > max_.load( std::memory_order_relaxed ) ) {
+      max_.store( value, std::memory_order_relaxed );
+    }
+  }
+
+  uint64_t count( void ) const { return count_.load( std::memory_order_relaxed ); }
+  uint64_t max( void ) const { return max_.load( std::memory_order_relaxed ); }
+
+  /* upper bound on the latency `fraction` (0 to 1) of the samples are within */
+  uint64_t percentile( const double fraction ) const;
+
+  /* "p50 a, p99 b, max c us (n)" */
+  std::string report( void ) const;
+
+  LatencyHistogram() {}
+
+  LatencyHistogram( const LatencyHistogram & other ) = delete;
+  LatencyHistogram & operator=( const LatencyHistogram & other ) = delete;
+};
+
+#endif /* LATENCY_HISTOGRAM_HH */
@@ -0,0 +1,128 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef MAILBOX_HH
+#define MAILBOX_HH
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+
+#include "futex.hh"
+#include "timestamp.hh"
+
+/* Triple-buffered "latest value" mailbox for one producer and one consumer.
+
+   The producer fills back() and publish()es it; the consumer takes the
+   newest published slot with acquire_latest() and reads it through
+   front(). The third slot sits in the middle, so neither side ever waits
+   for the other. A value published while the previous one was still
+   unread replaces it, and is counted as dropped. Each slot carries the
+   time it was published, which travels with it to the consumer. */
+
+template <class T>
+class Mailbox
+{
+private:
+  static constexpr uint32_t SLOT_MASK = 3;
+  static constexpr uint32_t FRESH = 4;
+
+  std::vector<T> slots_;
+  std::array<int64_t, 3> published_us_ {};
+
+  /* slot index in the middle, with FRESH set if it has not been read */
+  alignas( 64 ) std::atomic<uint32_t> middle_ { 1 };
+
+  /* bumped on every publish (and interrupt), used as the futex word */
+  std::atomic<uint32_t> sequence_ { 0 };
+  std::atomic<uint32_t> consumer_waiting_ { 0 };
+  std::atomic<uint64_t> dropped_ { 0 };
+
+  /* producer-owned */
+  alignas( 64 ) uint32_t back_ { 0 };
+
+  /* consumer-owned */
+  alignas( 64 ) uint32_t front_ { 2 };
+
+  bool fresh( void ) const { return middle_.load( std::memory_order_acquire ) & FRESH; }
+
+public:
+  template <typename... Targs>
+  Mailbox( Targs&&... Fargs )
+    : slots_()
+  {
+    slots_.reserve( 3 );
+    for ( size_t i = 0; i < 3; i++ ) {
+      slots_.emplace_back( Fargs... );
+    }
+  }
+
+  /* producer side */
+  T & back( void ) { return slots_[ back_ ]; }
+
+  void publish( void )
+  {
+    published_us_[ back_ ] = monotonic_timestamp_us();
+    const uint32_t previous = middle_.exchange( back_ | FRESH, std::memory_order_acq_rel );
+    if ( previous & FRESH ) {
+      dropped_.fetch_add( 1, std::memory_order_relaxed );
+    }
+    back_ = previous & SLOT_MASK;
+
+    sequence_.fetch_add( 1 );
+    if ( consumer_waiting_.load() ) {
+      futex_wake( sequence_ );
+    }
+  }
+
+  /* consumer side: swaps in the newest value, if there is one the consumer hasn't seen */
+  bool acquire_latest( void )
+  {
+    if ( not fresh() ) {
+      return false;
+    }
+
+    /* only the consumer clears FRESH, so the slot we get back is fresh */
+    front_ = middle_.exchange( front_, std::memory_order_acq_rel ) & SLOT_MASK;
+    return true;
+  }
+
+  const T & front( void ) const { return slots_[ front_ ]; }
+
+  /* CLOCK_MONOTONIC microseconds when front() was published */
+  int64_t front_published_us( void ) const { return published_us_[ front_ ]; }
+
+  /* sleeps until a new value is published, interrupt() is called or the
+     timeout expires; returns whether a new value is waiting */
+  bool wait( const timespec * timeout = nullptr )
+  {
+    const uint32_t sequence = sequence_.load();
+    if ( fresh() ) {
+      return true;
+    }
+
+    consumer_waiting_.store( 1 );
+    if ( sequence_.load() == sequence ) {
+      futex_wait( sequence_, sequence, timeout );
+    }
+    consumer_waiting_.store( 0, std::memory_order_relaxed );
+
+    return fresh();
+  }
+
+  /* wakes a consumer blocked in wait() without publishing anything */
+  void interrupt( void )
+  {
+    sequence_.fetch_add( 1 );
+    futex_wake( sequence_ );
+  }
+
+  uint64_t dropped( void ) const { return dropped_.load( std::memory_order_relaxed ); }
+
+  /* forbid copying and moving; both sides hold references into slots_ */
+  Mailbox( const Mailbox & other ) = delete;
+  Mailbox & operator=( const Mailbox & other ) = delete;
+};
+
+#endif /* MAILBOX_HH */
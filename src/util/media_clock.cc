@@ -0,0 +1,102 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include "media_clock.hh"
+#include "futex.hh"
+#include "timestamp.hh"
+
+using namespace std;
+
+void MediaClock::update( const int64_t media_time, const int64_t wall_time )
+{
+  sequence_.fetch_add( 1, memory_order_acq_rel );
+  anchor_media_.store( media_time, memory_order_relaxed );
+  anchor_wall_.store( wall_time, memory_order_relaxed );
+  running_.store( true, memory_order_release );
+
+  /* sequentially consistent, so either a waiter sees the new sequence or we see it waiting */
+  sequence_.fetch_add( 1 );
+
+  if ( waiters_.load() ) {
+    futex_wake( sequence_, INT32_MAX );
+  }
+}
+
+void MediaClock::update( const int64_t media_time )
+{
+  update( media_time, monotonic_timestamp_us() );
+}
+
+void MediaClock::load_anchor( int64_t & media, int64_t & wall ) const
+{
+  while ( true ) {
+    const uint32_t before = sequence_.load( memory_order_acquire );
+    media = anchor_media_.load( memory_order_relaxed );
+    wall = anchor_wall_.load( memory_order_relaxed );
+    atomic_thread_fence( memory_order_acquire );
+
+    if ( not ( before & 1 ) and sequence_.load( memory_order_relaxed ) == before ) {
+      return;
+    }
+  }
+}
+
+int64_t MediaClock::media_time( const int64_t wall_time ) const
+{
+  int64_t media, wall;
+  load_anchor( media, wall );
+  return media + ( wall_time - wall );
+}
+
+int64_t MediaClock::media_time( void ) const
+{
+  return media_time( monotonic_timestamp_us() );
+}
+
+int64_t MediaClock::wall_time( const int64_t media_time ) const
+{
+  int64_t media, wall;
+  load_anchor( media, wall );
+  return wall + ( media_time - media );
+}
+
+bool MediaClock::wait_until( const int64_t media_time, int64_t * lateness )
+{
+  while ( not interrupted_.load( memory_order_acquire ) ) {
+    const uint32_t sequence = sequence_.load();
+    const int64_t now = monotonic_timestamp_us();
+
+    timespec timeout;
+    const timespec * timeout_ptr = nullptr;
+
+    if ( running() ) {
+      const int64_t remaining = wall_time( media_time ) - now;
+
+      if ( remaining <= 0 ) {
+        if ( lateness ) {
+          *lateness = -remaining;
+        }
+        return true;
+      }
+
+      timeout.tv_sec = remaining / 1000000;
+      timeout.tv_nsec = ( remaining % 1000000 ) * 1000;
+      timeout_ptr = &timeout;
+    }
+
+    /* a new anchor moves the deadline, so it ends the sleep early */
+    waiters_.fetch_add( 1 );
+    if ( sequence_.load() == sequence and not interrupted_.load() ) {
+      futex_wait( sequence_, sequence, timeout_ptr );
+    }
+    waiters_.fetch_sub( 1, memory_order_relaxed );
+  }
+
+  return false;
+}
+
+void MediaClock::interrupt( void )
+{
+  interrupted_.store( true, memory_order_release );
+  sequence_.fetch_add( 2 );
+  futex_wake( sequence_, INT32_MAX );
+}
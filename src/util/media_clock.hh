@@ -0,0 +1,65 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef MEDIA_CLOCK_HH
+#define MEDIA_CLOCK_HH
+
+#include <atomic>
+#include <cstdint>
+
+/* Media time shared between the streams of one presentation.
+
+   Media time is in the capture-timestamp domain (CLOCK_MONOTONIC
+   microseconds at which a sample or frame was captured), so "the clock
+   reads t" means the content captured at t is being presented now. One
+   thread, normally the audio output, anchors the clock to what the
+   device is playing; between anchors it runs at the rate of the local
+   monotonic clock. Other streams block in wait_until() for their
+   presentation time, sleeping on a futex that every anchor wakes so a
+   corrected clock is honored right away.
+
+   Anchors are published through a sequence lock, so readers never
+   block the writer. */
+
+class MediaClock
+{
+private:
+  /* odd while an anchor is being written; also the futex word */
+  std::atomic<uint32_t> sequence_ { 0 };
+  std::atomic<uint32_t> waiters_ { 0 };
+
+  std::atomic<int64_t> anchor_media_ { 0 };
+  std::atomic<int64_t> anchor_wall_ { 0 };
+  std::atomic<bool> running_ { false };
+  std::atomic<bool> interrupted_ { false };
+
+  void load_anchor( int64_t & media, int64_t & wall ) const;
+
+public:
+  MediaClock() {}
+
+  /* writer side: content captured at `media_time` is being presented at `wall_time` */
+  void update( const int64_t media_time, const int64_t wall_time );
+  void update( const int64_t media_time );
+
+  /* false until the first update */
+  bool running( void ) const { return running_.load( std::memory_order_acquire ); }
+
+  int64_t media_time( const int64_t wall_time ) const;
+  int64_t media_time( void ) const;
+  int64_t wall_time( const int64_t media_time ) const;
+
+  /* Blocks until the clock reaches `media_time` (waiting for the first
+     update if need be). Returns false if interrupted, and otherwise how
+     far past `media_time` the clock already was, in microseconds, through
+     `lateness` if given. */
+  bool wait_until( const int64_t media_time, int64_t * lateness = nullptr );
+
+  /* wakes every waiter and makes further waits return false at once */
+  void interrupt( void );
+
+  /* forbid copying and moving; waiters sleep on sequence_ */
+  MediaClock( const MediaClock & other ) = delete;
+  MediaClock & operator=( const MediaClock & other ) = delete;
+};
+
+#endif /* MEDIA_CLOCK_HH */
@@ -4,6 +4,7 @@
 #define MMAP_REGION_HH
 
 #include <cstdint>
+#include <sys/types.h>
 
 class MMap_Region
 {
@@ -12,7 +13,8 @@ private:
   size_t length_;
 
 public:
-  MMap_Region( const size_t length, const int prot, const int flags, const int fd );
+  MMap_Region( const size_t length, const int prot, const int flags, const int fd,
+               const off_t offset = 0 );
 
   ~MMap_Region();
 
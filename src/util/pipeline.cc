@@ -0,0 +1,131 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <ctime>
+#include <sstream>
+
+#include "pipeline.hh"
+#include "exception.hh"
+
+using namespace std;
+
+static int64_t monotonic_ns( void )
+{
+  timespec now;
+  SystemCall( "clock_gettime", clock_gettime( CLOCK_MONOTONIC, &now ) );
+  return int64_t( now.tv_sec ) * 1000000000 + now.tv_nsec;
+}
+
+string to_string( const OverflowPolicy policy )
+{
+  switch ( policy ) {
+  case OverflowPolicy::Block: return "block";
+  case OverflowPolicy::DropOldest: return "drop-oldest";
+  case OverflowPolicy::DropNewest: return "drop-newest";
+  }
+
+  throw runtime_error( "unknown overflow policy" );
+}
+
+OverflowPolicy overflow_policy( const string & name )
+{
+  for ( const auto policy : { OverflowPolicy::Block, OverflowPolicy::DropOldest, OverflowPolicy::DropNewest } ) {
+    if ( name == to_string( policy ) ) {
+      return policy;
+    }
+  }
+
+  throw runtime_error( "unknown overflow policy: " + name + " (block, drop-oldest or drop-newest)" );
+}
+
+Stage::ServiceTimer::ServiceTimer( Stage & stage )
+  : stage_( stage ), start_( monotonic_ns() )
+{}
+
+Stage::ServiceTimer::~ServiceTimer()
+{
+  stage_.account( monotonic_ns() - start_ );
+}
+
+Stage::Stage( const string & name, const Body & body, const int cpu )
+  : name_( name ), cpu_( cpu < 0 ? cpu : allowed_cpu( cpu ) ),
+    thread_( [this, body]()
+             {
+               while ( start_.load() == Starting ) {
+                 futex_wait( start_, Starting );
+               }
+               if ( start_.load() == Run ) {
+                 body( *this );
+               }
+             } )
+{
+  /* a thread that fails to pin is joined before the exception leaves, as it must be */
+  try {
+    if ( cpu_ >= 0 ) {
+      pin_thread( thread_, cpu_ );
+    }
+  } catch ( ... ) {
+    release( Abort );
+    thread_.join();
+    throw;
+  }
+
+  release( Run );
+}
+
+void Stage::release( const Start start )
+{
+  start_.store( start );
+  futex_wake( start_ );
+}
+
+Stage::~Stage()
+{
+  if ( thread_.joinable() ) {
+    thread_.join();
+  }
+}
+
+void Stage::join( void )
+{
+  thread_.join();
+}
+
+bool Stage::set_fifo_priority( const int priority )
+{
+  if ( not ::set_fifo_priority( thread_, priority ) ) {
+    return false;
+  }
+
+  priority_ = priority;
+  return true;
+}
+
+void Stage::account( const int64_t ns )
+{
+  items_.fetch_add( 1, memory_order_relaxed );
+  busy_ns_.fetch_add( ns, memory_order_relaxed );
+
+  if ( uint64_t( ns ) > max_ns_.load( memory_order_relaxed ) ) {
+    max_ns_.store( ns, memory_order_relaxed );
+  }
+}
+
+double Stage::mean_service_ms( void ) const
+{
+  const uint64_t items = items_.load( memory_order_relaxed );
+  return items ? busy_ns_.load( memory_order_relaxed ) / 1e6 / items : 0;
+}
+
+string Stage::report( void ) const
+{
+  ostringstream out;
+  out << name_ << ":\t" << items() << " items\tservice:\t" << mean_service_ms()
+      << " ms (max " << max_service_ms() << ")";
+  if ( cpu_ >= 0 ) {
+    out << "\tcpu " << cpu_;
+  }
+  if ( priority_ ) {
+    out << "\tfifo " << priority_;
+  }
+  return out.str();
+}
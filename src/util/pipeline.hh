@@ -0,0 +1,402 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef PIPELINE_HH
+#define PIPELINE_HH
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "futex.hh"
+#include "spsc_queue.hh"
+#include "latency_histogram.hh"
+#include "realtime.hh"
+#include "timestamp.hh"
+
+/* Building blocks for a pipeline of stages, each on its own thread,
+   connected by bounded single-producer single-consumer edges. */
+
+/* what an edge does with a new item when it is full */
+enum class OverflowPolicy
+{
+  Block,       /* the producer waits for room */
+  DropOldest,  /* the oldest waiting item makes room */
+  DropNewest,  /* the new item is refused */
+};
+
+std::string to_string( const OverflowPolicy policy );
+
+/* "block", "drop-oldest" or "drop-newest" */
+OverflowPolicy overflow_policy( const std::string & name );
+
+/* An edge between two stages. Items are preallocated (from the
+   constructor's arguments) and are passed by pointer: the producer fills
+   the item acquire_write() lends it and commit_write()s it, and the
+   consumer gets it from wait_read() and hands it back with
+   release_read(). Up to `capacity` items wait in between; two more are
+   in the pool so that each side always has one in hand.
+
+   The waiting items are a ring of pointers, whose read counter both
+   sides may advance: the consumer to take an item and the producer,
+   under DropOldest, to take one back. Whichever compare-and-swap wins
+   owns the item, so an evicted item is never one the consumer is using,
+   and neither side ever blocks on the other under the drop policies.
+   An evicted item is passed to the drop handler, if there is one, on
+   the producer's thread before it is refilled.
+
+   Both sides sleep on one futex word, a sequence number that a commit
+   or take bumps when the other side is waiting, and that close() bumps
+   before waking everyone. close() therefore never waits for a sleeper
+   to run, which under SCHED_FIFO on a shared CPU it might never do.
+   Otherwise close() works as for SPSCQueue: the producer gets nullptr,
+   and the consumer drains what is waiting (ignoring any minimum
+   occupancy) before it gets nullptr too.
+
+   Each time the consumer has to sleep for an item, the edge records how
+   long after the commit that met its minimum occupancy the consumer was
+   running again: the scheduler's wakeup latency for its thread. */
+
+template <class T>
+class Edge
+{
+public:
+  typedef std::function<void( T & )> DropHandler;
+
+private:
+  const std::string name_;
+  const OverflowPolicy policy_;
+  const uint32_t capacity_;
+
+  std::vector<T> pool_ {};
+
+  /* items the consumer has released, for the producer to refill */
+  SPSCQueue<T *> free_;
+
+  std::vector<std::atomic<T *>> ring_;
+
+  alignas( 64 ) std::atomic<uint32_t> write_count_ { 0 };
+  std::atomic<uint32_t> producer_waiting_ { 0 };
+  T * writing_ { nullptr };
+
+  alignas( 64 ) std::atomic<uint32_t> read_count_ { 0 };
+  std::atomic<uint32_t> consumer_waiting_ { 0 };
+  T * reading_ { nullptr };
+
+  alignas( 64 ) std::atomic<bool> closed_ { false };
+  std::atomic<uint32_t> sequence_ { 0 };
+  DropHandler drop_handler_ {};
+
+  std::atomic<uint64_t> committed_ { 0 };
+  std::atomic<uint64_t> dropped_ { 0 };
+  std::atomic<uint32_t> max_depth_ { 0 };
+
+  /* the write count a sleeping consumer needs, and when the commit reaching it was made (0 until then) */
+  std::atomic<uint32_t> wake_target_ { 0 };
+  std::atomic<int64_t> wake_commit_us_ { 0 };
+  LatencyHistogram wakeup_latency_ {};
+
+  /* Blocks until `ready( other_count )` holds; false if closed first.
+     `slept` is set if it had to wait on the futex. The sequence number is
+     read before announcing the wait, so a bump by a commit, take or
+     close that this side's check missed makes the futex wait return. */
+  template <class Predicate>
+  bool wait_for( std::atomic<uint32_t> & other, std::atomic<uint32_t> & waiting,
+                 const Predicate & ready, bool & slept )
+  {
+    while ( not ready( other.load( std::memory_order_acquire ) ) ) {
+      if ( closed_.load( std::memory_order_acquire ) ) {
+        return false;
+      }
+
+      const uint32_t sequence = sequence_.load();
+      waiting.store( 1 );
+
+      if ( not ready( other.load() ) and not closed_.load() ) {
+        futex_wait( sequence_, sequence );
+        slept = true;
+      }
+
+      waiting.store( 0, std::memory_order_relaxed );
+    }
+
+    return true;
+  }
+
+  void wake_all( void )
+  {
+    sequence_.fetch_add( 1 );
+    futex_wake( sequence_, INT_MAX );
+  }
+
+  /* either side: takes the oldest waiting item, unless the other side got it first */
+  T * take( const uint32_t read )
+  {
+    T * item = ring_[ read % capacity_ ].load( std::memory_order_acquire );
+    uint32_t expected = read;
+
+    if ( not read_count_.compare_exchange_strong( expected, read + 1 ) ) {
+      return nullptr;
+    }
+
+    if ( producer_waiting_.load() ) {
+      wake_all();
+    }
+    return item;
+  }
+
+public:
+  template <typename... Targs>
+  Edge( const std::string & name, const OverflowPolicy policy, const size_t capacity, Targs&&... Fargs )
+    : name_( name ), policy_( policy ), capacity_( capacity ),
+      free_( capacity + 2 ), ring_( capacity )
+  {
+    if ( capacity == 0 or capacity > UINT32_MAX / 4 ) {
+      throw std::invalid_argument( "Edge: invalid capacity" );
+    }
+
+    pool_.reserve( capacity + 2 );
+    for ( size_t i = 0; i < capacity + 2; i++ ) {
+      pool_.emplace_back( Fargs... );
+      *free_.try_acquire_write() = &pool_.back();
+      free_.commit_write();
+    }
+  }
+
+  /* called on the producer's thread with each item DropOldest evicts, e.g. to release what it holds */
+  void set_drop_handler( const DropHandler & handler ) { drop_handler_ = handler; }
+
+  /* producer side: an item to fill, or nullptr if the edge is closed or
+     (under DropNewest) full, in which case the item is dropped */
+  T * acquire_write( void )
+  {
+    if ( closed() ) {
+      return nullptr;
+    }
+
+    const uint32_t written = write_count_.load( std::memory_order_relaxed );
+    const auto has_room = [&]( const uint32_t read ) { return written - read < capacity_; };
+    bool slept = false;
+
+    switch ( policy_ ) {
+    case OverflowPolicy::Block:
+      if ( not wait_for( read_count_, producer_waiting_, has_room, slept ) ) {
+        return nullptr;
+      }
+      break;
+
+    case OverflowPolicy::DropNewest:
+      if ( not has_room( read_count_.load( std::memory_order_acquire ) ) ) {
+        dropped_.fetch_add( 1, std::memory_order_relaxed );
+        return nullptr;
+      }
+      break;
+
+    case OverflowPolicy::DropOldest:
+      for ( uint32_t read; not has_room( read = read_count_.load( std::memory_order_acquire ) ); ) {
+        if ( T * oldest = take( read ) ) {
+          dropped_.fetch_add( 1, std::memory_order_relaxed );
+          if ( drop_handler_ ) {
+            drop_handler_( *oldest );
+          }
+          return writing_ = oldest;
+        }
+      }
+      break;
+    }
+
+    /* with fewer than `capacity` waiting and at most one being read, the pool has one to spare */
+    T * const * item = free_.try_acquire_read();
+    if ( not item ) {
+      throw std::logic_error( "Edge " + name_ + ": pool exhausted" );
+    }
+    writing_ = *item;
+    free_.release_read();
+    return writing_;
+  }
+
+  void commit_write( void )
+  {
+    const uint32_t written = write_count_.load( std::memory_order_relaxed );
+    ring_[ written % capacity_ ].store( writing_, std::memory_order_release );
+
+    /* stamped before the count is published, so the consumer sees it once it sees the item */
+    if ( consumer_waiting_.load() and int32_t( written + 1 - wake_target_.load() ) >= 0 ) {
+      int64_t unstamped = 0;
+      wake_commit_us_.compare_exchange_strong( unstamped, monotonic_timestamp_us() );
+    }
+    write_count_.store( written + 1, std::memory_order_release );
+    writing_ = nullptr;
+
+    committed_.fetch_add( 1, std::memory_order_relaxed );
+    const uint32_t depth = depth_now();
+    if ( depth > max_depth_.load( std::memory_order_relaxed ) ) {
+      max_depth_.store( depth, std::memory_order_relaxed );
+    }
+
+    if ( consumer_waiting_.load() ) {
+      wake_all();
+    }
+  }
+
+  /* consumer side: blocks until `min_occupancy` items are waiting and
+     returns the oldest; once closed, drains what is left, then nullptr */
+  T * wait_read( const size_t min_occupancy = 1 )
+  {
+    while ( true ) {
+      const uint32_t read = read_count_.load( std::memory_order_acquire );
+      wake_commit_us_.store( 0 );
+      wake_target_.store( read + min_occupancy );
+      bool slept = false;
+      const bool ready = wait_for( write_count_, consumer_waiting_,
+                                   [&]( const uint32_t written ) { return written - read >= min_occupancy; },
+                                   slept );
+
+      /* the producer may have evicted items since `read` was loaded */
+      const uint32_t current = read_count_.load( std::memory_order_acquire );
+      if ( write_count_.load( std::memory_order_acquire ) == current ) {
+        if ( not ready ) {
+          return nullptr;
+        }
+        continue;
+      }
+
+      if ( ( reading_ = take( current ) ) ) {
+        /* woken by the commit that met the minimum, not by close() */
+        const int64_t woken_by = wake_commit_us_.load();
+        if ( slept and ready and woken_by ) {
+          wakeup_latency_.record( monotonic_timestamp_us() - woken_by );
+        }
+        return reading_;
+      }
+    }
+  }
+
+  void release_read( void )
+  {
+    *free_.try_acquire_write() = reading_;
+    free_.commit_write();
+    reading_ = nullptr;
+  }
+
+  /* either side, or a third thread; wakes both sides without waiting for them */
+  void close( void )
+  {
+    closed_.store( true );
+    wake_all();
+  }
+
+  bool closed( void ) const { return closed_.load( std::memory_order_acquire ); }
+
+  const std::string & name( void ) const { return name_; }
+  OverflowPolicy policy( void ) const { return policy_; }
+  size_t capacity( void ) const { return capacity_; }
+
+  uint32_t depth_now( void ) const
+  {
+    return write_count_.load( std::memory_order_acquire ) - read_count_.load( std::memory_order_acquire );
+  }
+
+  uint32_t max_depth( void ) const { return max_depth_.load( std::memory_order_relaxed ); }
+  uint64_t committed( void ) const { return committed_.load( std::memory_order_relaxed ); }
+  uint64_t dropped( void ) const { return dropped_.load( std::memory_order_relaxed ); }
+
+  /* of the consumer's thread, each time it slept waiting for an item */
+  const LatencyHistogram & wakeup_latency( void ) const { return wakeup_latency_; }
+
+  /* items offered by the producer: an item DropNewest refuses was never
+     committed, while one DropOldest evicts was */
+  uint64_t offered( void ) const
+  {
+    return policy_ == OverflowPolicy::DropNewest ? committed() + dropped() : committed();
+  }
+
+  /* "name: depth d/capacity (max m), dropped n/offered (policy)" */
+  std::string report( void ) const
+  {
+    return name_ + ":\t" + std::to_string( depth_now() ) + "/" + std::to_string( capacity_ )
+      + " (max " + std::to_string( max_depth() ) + ")\tdropped:\t" + std::to_string( dropped() )
+      + "/" + std::to_string( offered() ) + "\t" + to_string( policy_ );
+  }
+
+  /* forbid copying and moving; both sides hold pointers into pool_ */
+  Edge( const Edge & other ) = delete;
+  Edge & operator=( const Edge & other ) = delete;
+};
+
+/* A pipeline stage: `body` runs once on a thread of the stage's own,
+   optionally pinned to a CPU before `body` starts, and usually loops
+   until its input edge closes. Wrapping the work on each item in a ServiceTimer counts the
+   item and its service time, so the time spent waiting on the edges
+   is left out. */
+class Stage
+{
+public:
+  typedef std::function<void( Stage & )> Body;
+
+  class ServiceTimer
+  {
+  private:
+    Stage & stage_;
+    const int64_t start_;
+
+  public:
+    ServiceTimer( Stage & stage );
+    ~ServiceTimer();
+
+    ServiceTimer( const ServiceTimer & other ) = delete;
+    ServiceTimer & operator=( const ServiceTimer & other ) = delete;
+  };
+
+private:
+  const std::string name_;
+  const int cpu_;
+  std::atomic<int> priority_ { 0 };
+
+  std::atomic<uint64_t> items_ { 0 };
+  std::atomic<uint64_t> busy_ns_ { 0 };
+  std::atomic<uint64_t> max_ns_ { 0 };
+
+  /* holds the thread back from `body` until it is pinned: Starting, then Run or Abort */
+  enum Start : uint32_t { Starting, Run, Abort };
+  std::atomic<uint32_t> start_ { Starting };
+
+  std::thread thread_;
+
+  void release( const Start start );
+
+  void account( const int64_t ns );
+
+public:
+  /* `cpu` < 0 leaves the thread wherever the scheduler puts it */
+  Stage( const std::string & name, const Body & body, const int cpu = -1 );
+
+  /* joins, if join() has not */
+  ~Stage();
+
+  void join( void );
+
+  /* see set_fifo_priority() in realtime.hh */
+  bool set_fifo_priority( const int priority );
+
+  const std::string & name( void ) const { return name_; }
+  int cpu( void ) const { return cpu_; }
+  int fifo_priority( void ) const { return priority_.load( std::memory_order_relaxed ); }
+
+  uint64_t items( void ) const { return items_.load( std::memory_order_relaxed ); }
+  double mean_service_ms( void ) const;
+  double max_service_ms( void ) const { return max_ns_.load( std::memory_order_relaxed ) / 1e6; }
+
+  /* "name: n items, mean x ms, max y ms" */
+  std::string report( void ) const;
+
+  /* forbid copying and moving; the thread holds `this` */
+  Stage( const Stage & other ) = delete;
+  Stage & operator=( const Stage & other ) = delete;
+};
+
+#endif /* PIPELINE_HH */
@@ -0,0 +1,117 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "plane_ops.hh"
+
+static constexpr uint64_t PRIME1 = 0x9E3779B185EBCA87ULL;
+static constexpr uint64_t PRIME2 = 0xC2B2AE3D27D4EB4FULL;
+static constexpr uint64_t PRIME3 = 0x165667B19E3779F9ULL;
+
+static inline uint64_t rotl( const uint64_t x, const int r )
+{
+  return ( x << r ) | ( x >> ( 64 - r ) );
+}
+
+static inline uint64_t load64( const uint8_t * p )
+{
+  uint64_t v;
+  memcpy( &v, p, sizeof( v ) );
+  return v;
+}
+
+static inline uint64_t hash_round( uint64_t acc, const uint64_t input )
+{
+  acc += input * PRIME2;
+  acc = rotl( acc, 31 );
+  return acc * PRIME1;
+}
+
+/* xxh64-style: four independent lanes of 8 bytes, so the multiplies pipeline */
+uint64_t hash_bytes( const uint8_t * data, const size_t length, const uint64_t seed )
+{
+  const uint8_t * p = data;
+  const uint8_t * const end = data + length;
+
+  uint64_t h;
+
+  if ( length >= 32 ) {
+    uint64_t v1 = seed + PRIME1 + PRIME2;
+    uint64_t v2 = seed + PRIME2;
+    uint64_t v3 = seed;
+    uint64_t v4 = seed - PRIME1;
+
+    for ( ; p + 32 <= end; p += 32 ) {
+      v1 = hash_round( v1, load64( p ) );
+      v2 = hash_round( v2, load64( p + 8 ) );
+      v3 = hash_round( v3, load64( p + 16 ) );
+      v4 = hash_round( v4, load64( p + 24 ) );
+    }
+
+    h = rotl( v1, 1 ) + rotl( v2, 7 ) + rotl( v3, 12 ) + rotl( v4, 18 );
+  } else {
+    h = seed + PRIME3;
+  }
+
+  h += length;
+
+  for ( ; p + 8 <= end; p += 8 ) {
+    h ^= hash_round( 0, load64( p ) );
+    h = rotl( h, 27 ) * PRIME1 + PRIME3;
+  }
+
+  for ( ; p < end; p++ ) {
+    h ^= *p * PRIME3;
+    h = rotl( h, 11 ) * PRIME1;
+  }
+
+  h ^= h >> 33;
+  h *= PRIME2;
+  h ^= h >> 29;
+  h *= PRIME3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+uint64_t sad_bytes( const uint8_t * a, const uint8_t * b, const size_t length )
+{
+  size_t i = 0;
+  uint64_t sum = 0;
+
+#ifdef __SSE2__
+  __m128i acc = _mm_setzero_si128();
+
+  for ( ; i + 16 <= length; i += 16 ) {
+    const __m128i va = _mm_loadu_si128( reinterpret_cast<const __m128i *>( a + i ) );
+    const __m128i vb = _mm_loadu_si128( reinterpret_cast<const __m128i *>( b + i ) );
+    acc = _mm_add_epi64( acc, _mm_sad_epu8( va, vb ) );
+  }
+
+  sum = _mm_cvtsi128_si64( acc ) + _mm_cvtsi128_si64( _mm_unpackhi_epi64( acc, acc ) );
+#endif
+
+  for ( ; i < length; i++ ) {
+    sum += a[ i ] > b[ i ] ? a[ i ] - b[ i ] : b[ i ] - a[ i ];
+  }
+
+  return sum;
+}
+
+uint64_t sad_block( const uint8_t * a, const size_t a_stride,
+                    const uint8_t * b, const size_t b_stride,
+                    const size_t width, const size_t height,
+                    const uint64_t limit )
+{
+  uint64_t sum = 0;
+
+  for ( size_t row = 0; row < height and sum <= limit; row++ ) {
+    sum += sad_bytes( a + row * a_stride, b + row * b_stride, width );
+  }
+
+  return sum;
+}
@@ -0,0 +1,23 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef PLANE_OPS_HH
+#define PLANE_OPS_HH
+
+/* word-at-a-time kernels over rows of 8-bit samples */
+
+#include <cstddef>
+#include <cstdint>
+
+/* 64-bit non-cryptographic hash; chain rows by passing the previous result as seed */
+uint64_t hash_bytes( const uint8_t * data, const size_t length, const uint64_t seed = 0 );
+
+/* sum of absolute differences between two rows */
+uint64_t sad_bytes( const uint8_t * a, const uint8_t * b, const size_t length );
+
+/* sum of absolute differences over a block of rows; returns as soon as the sum exceeds limit */
+uint64_t sad_block( const uint8_t * a, const size_t a_stride,
+                    const uint8_t * b, const size_t b_stride,
+                    const size_t width, const size_t height,
+                    const uint64_t limit = UINT64_MAX );
+
+#endif /* PLANE_OPS_HH */
@@ -1,17 +1,21 @@
 /* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
 
-#include <boost/functional/hash.hpp>
+#include <cmath>
 #include <cstdio>
 
 #include "exception.hh"
 #include "raster.hh"
+#include "plane_ops.hh"
 
 using namespace std;
 
 BaseRaster::BaseRaster( const uint16_t display_width, const uint16_t display_height,
-  const uint16_t width, const uint16_t height)
+  const uint16_t width, const uint16_t height, const RowAlignment & row_alignment )
   : display_width_( display_width ), display_height_( display_height ),
-    width_( width ), height_( height )
+    width_( width ), height_( height ),
+    Y_( width_, height_, row_alignment ),
+    U_( width_ / 2, height_ / 2, row_alignment ),
+    V_( width_ / 2, height_ / 2, row_alignment )
 {
   if ( display_width_ > width_ ) {
     throw Invalid( "display_width is greater than width." );
@@ -24,15 +28,132 @@ BaseRaster::BaseRaster( const uint16_t display_width, const uint16_t display_hei
 
 size_t BaseRaster::raw_hash( void ) const
 {
-  size_t hash_val = 0;
+  uint64_t hash_val = 0;
 
-  boost::hash_range( hash_val, Y_.begin(), Y_.end() );
-  boost::hash_range( hash_val, U_.begin(), U_.end() );
-  boost::hash_range( hash_val, V_.begin(), V_.end() );
+  /* row by row, in place: this runs on every frame the degrader sees */
+  auto hash_plane = [&]( const TwoD<uint8_t> & plane, const unsigned int width, const unsigned int height )
+    {
+      for ( unsigned int row = 0; row < height; row++ ) {
+        hash_val = hash_bytes( &plane.at( 0, row ), width, hash_val );
+      }
+    };
+
+  hash_plane( Y_, display_width(), display_height() );
+  hash_plane( U_, chroma_display_width(), chroma_display_height() );
+  hash_plane( V_, chroma_display_width(), chroma_display_height() );
 
   return hash_val;
 }
 
+uint64_t BaseRaster::sad( const BaseRaster & other, const uint64_t limit ) const
+{
+  if ( display_width_ != other.display_width_ or display_height_ != other.display_height_ ) {
+    throw Invalid( "cannot compare rasters of different dimensions." );
+  }
+
+  uint64_t total = 0;
+
+  auto sad_plane = [&]( const TwoD<uint8_t> & a, const TwoD<uint8_t> & b,
+                        const unsigned int width, const unsigned int height )
+    {
+      for ( unsigned int row = 0; row < height and total <= limit; row++ ) {
+        total += sad_bytes( &a.at( 0, row ), &b.at( 0, row ), width );
+      }
+    };
+
+  sad_plane( Y_, other.Y_, display_width(), display_height() );
+  sad_plane( U_, other.U_, chroma_display_width(), chroma_display_height() );
+  sad_plane( V_, other.V_, chroma_display_width(), chroma_display_height() );
+
+  return total;
+}
+
+/* x264's ssim_end1, applied to the sums over one 8x8 window */
+static double ssim_window( const uint64_t s1, const uint64_t s2,
+                           const uint64_t ss, const uint64_t s12 )
+{
+  static const double ssim_c1 = .01 * .01 * 255 * 255 * 64;
+  static const double ssim_c2 = .03 * .03 * 255 * 255 * 64 * 63;
+
+  const double fs1 = s1, fs2 = s2;
+  const double vars = ss * 64.0 - fs1 * fs1 - fs2 * fs2;
+  const double covar = s12 * 64.0 - fs1 * fs2;
+
+  return ( 2 * fs1 * fs2 + ssim_c1 ) * ( 2 * covar + ssim_c2 )
+    / ( ( fs1 * fs1 + fs2 * fs2 + ssim_c1 ) * ( vars + ssim_c2 ) );
+}
+
+double BaseRaster::quality( const BaseRaster & other ) const
+{
+  if ( display_width_ != other.display_width_ or display_height_ != other.display_height_ ) {
+    throw Invalid( "cannot compare rasters of different dimensions." );
+  }
+
+  /* like x264, luma only, over 8x8 windows overlapping by 4 pixels */
+  double total = 0;
+  unsigned int windows = 0;
+
+  for ( unsigned int y = 0; y + 8 <= display_height_; y += 4 ) {
+    for ( unsigned int x = 0; x + 8 <= display_width_; x += 4 ) {
+      uint64_t s1 = 0, s2 = 0, ss = 0, s12 = 0;
+
+      for ( unsigned int row = y; row < y + 8; row++ ) {
+        const uint8_t * a = &Y_.at( x, row );
+        const uint8_t * b = &other.Y_.at( x, row );
+
+        for ( unsigned int i = 0; i < 8; i++ ) {
+          s1 += a[ i ];
+          s2 += b[ i ];
+          ss += a[ i ] * a[ i ] + b[ i ] * b[ i ];
+          s12 += a[ i ] * b[ i ];
+        }
+      }
+
+      total += ssim_window( s1, s2, ss, s12 );
+      windows++;
+    }
+  }
+
+  return windows ? total / windows : 1.0;
+}
+
+double BaseRaster::psnr( const BaseRaster & other ) const
+{
+  if ( display_width_ != other.display_width_ or display_height_ != other.display_height_ ) {
+    throw Invalid( "cannot compare rasters of different dimensions." );
+  }
+
+  uint64_t squared_error = 0;
+  uint64_t samples = 0;
+
+  auto accumulate = [&]( const TwoD<uint8_t> & a, const TwoD<uint8_t> & b,
+                         const unsigned int width, const unsigned int height )
+    {
+      for ( unsigned int row = 0; row < height; row++ ) {
+        const uint8_t * pa = &a.at( 0, row );
+        const uint8_t * pb = &b.at( 0, row );
+
+        for ( unsigned int column = 0; column < width; column++ ) {
+          const int diff = pa[ column ] - pb[ column ];
+          squared_error += diff * diff;
+        }
+      }
+
+      samples += width * height;
+    };
+
+  accumulate( Y_, other.Y_, display_width(), display_height() );
+  accumulate( U_, other.U_, chroma_display_width(), chroma_display_height() );
+  accumulate( V_, other.V_, chroma_display_width(), chroma_display_height() );
+
+  if ( squared_error == 0 ) {
+    return 100.0;
+  }
+
+  const double mse = double( squared_error ) / samples;
+  return min( 100.0, 10 * log10( 255.0 * 255.0 / mse ) );
+}
+
 bool BaseRaster::operator==( const BaseRaster & other ) const
 {
   return (Y_ == other.Y_) and (U_ == other.U_) and (V_ == other.V_);
@@ -48,6 +169,7 @@ void BaseRaster::copy_from( const BaseRaster & other )
   Y_.copy_from( other.Y_ );
   U_.copy_from( other.U_ );
   V_.copy_from( other.V_ );
+  capture_timestamp_ = other.capture_timestamp_;
 }
 
 vector<Chunk> BaseRaster::display_rectangle_as_planar() const
@@ -80,53 +202,3 @@ void BaseRaster::dump( FILE * file ) const
     }
   }
 }
-
-
-BaseRasterQueue::BaseRasterQueue(const size_t capacity,
-                                  const uint16_t display_width,
-                                  const uint16_t display_height,
-                                  const uint16_t width,
-                                  const uint16_t height ) :
-  _capacity(capacity),
-  _occupancy(0),
-  back_idx(0),
-  front_idx(0),
-  capacity(_capacity),
-  occupancy(_occupancy),
-  array()
-{
-  
-  for(size_t i = 0; i < capacity; i++){
-    BaseRaster b{display_width, display_height, width, height};
-    array.emplace_back(std::move(b));
-  }
-}
-  
-BaseRasterQueue::~BaseRasterQueue()
-{}
-
-BaseRaster& BaseRasterQueue::front() {
-  return array.at(front_idx);
-}
-
-void BaseRasterQueue::pop_front() {
-  if(occupancy > 0){
-    front_idx = (front_idx + 1) % capacity;
-    --_occupancy;
-  }
-  else{
-    throw runtime_error("Queue is empty!");
-  }
-}
-
-BaseRaster& BaseRasterQueue::back() {
-  if(occupancy < capacity){
-    BaseRaster &b = array.at(back_idx);
-    back_idx = (back_idx + 1) % capacity;
-    ++_occupancy;
-    return b;
-  }
-  else{
-    throw runtime_error("Queue is full!");
-  }
-}  
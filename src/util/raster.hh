@@ -3,17 +3,38 @@
 #ifndef RASTER_HH
 #define RASTER_HH
 
+#include <cstdint>
 #include <vector>
 
 #include "2d.hh"
 #include "safe_array.hh"
 #include "chunk.hh"
+#include "spsc_queue.hh"
+
+/* Row layout for pixel planes: each row starts on an `alignment`-byte
+   boundary (at most 64, the alignment of the storage itself) and has at
+   least `padding` bytes of slack past the visible width. */
+struct RowAlignment
+{
+  unsigned int alignment;
+  unsigned int padding;
+};
+
+static constexpr RowAlignment DEFAULT_ROW_ALIGNMENT { 64, 0 };
+
+inline unsigned int aligned_stride( const unsigned int width,
+                                    const RowAlignment & layout = DEFAULT_ROW_ALIGNMENT )
+{
+  assert( layout.alignment > 0 and 64 % layout.alignment == 0 );
+  return ( width + layout.padding + layout.alignment - 1 ) / layout.alignment * layout.alignment;
+}
 
 /* For an array of pixels, context and separate construction not necessary */
 template<>
 template< typename... Targs >
 TwoDStorage<uint8_t>::TwoDStorage( const unsigned int width, const unsigned int height, Targs&&... Fargs )
-  : width_( width ), height_( height ), storage_( width * height, Fargs... )
+  : width_( width ), height_( height ), stride_( aligned_stride( width, Fargs... ) ),
+    storage_( stride_ * height )
 {
   assert( width > 0 );
   assert( height > 0 );
@@ -25,15 +46,15 @@ protected:
   uint16_t display_width_, display_height_;
   uint16_t width_, height_;
 
-  TwoD< uint8_t > Y_ { width_, height_ },
-    U_ { width_ / 2, height_ / 2 },
-    V_ { width_ / 2, height_ / 2 };
+  TwoD< uint8_t > Y_, U_, V_;
 
-  size_t raw_hash( void ) const;
+  /* CLOCK_MONOTONIC microseconds at which the frame was captured, 0 if unknown */
+  int64_t capture_timestamp_ { 0 };
 
 public:
   BaseRaster( const uint16_t display_width, const uint16_t display_height,
-    const uint16_t width, const uint16_t height );
+    const uint16_t width, const uint16_t height,
+    const RowAlignment & row_alignment = DEFAULT_ROW_ALIGNMENT );
 
   TwoD< uint8_t > & Y( void ) { return Y_; }
   TwoD< uint8_t > & U( void ) { return U_; }
@@ -48,45 +69,44 @@ public:
   uint16_t display_width( void ) const { return display_width_; }
   uint16_t display_height( void ) const { return display_height_; }
 
+  int64_t capture_timestamp( void ) const { return capture_timestamp_; }
+  void set_capture_timestamp( const int64_t timestamp ) { capture_timestamp_ = timestamp; }
+
   uint16_t chroma_display_width() const { return (1 + display_width_) / 2; }
   uint16_t chroma_display_height() const { return (1 + display_height_) / 2; }
 
   // SSIM as determined by libx264
   double quality( const BaseRaster & other ) const;
 
+  // PSNR over all three planes, capped at 100 dB for identical rasters
+  double psnr( const BaseRaster & other ) const;
+
+  size_t raw_hash( void ) const;
+
+  // sum of absolute differences over all three planes; stops counting once above limit
+  uint64_t sad( const BaseRaster & other, const uint64_t limit = UINT64_MAX ) const;
+
   bool operator==( const BaseRaster & other ) const;
   bool operator!=( const BaseRaster & other ) const;
 
+  /* copies the pixels and the capture timestamp */
   void copy_from( const BaseRaster & other );
 
   std::vector<Chunk> display_rectangle_as_planar() const;
   void dump( FILE * file ) const; /* only used for debugging */
 };
 
-class BaseRasterQueue {
-private:
-  const size_t _capacity;
-  size_t _occupancy;
-  size_t front_idx;
-  size_t back_idx;
-
-  std::vector<BaseRaster> array;
-  
+/* delay line of preallocated rasters between a capture and a play thread */
+class BaseRasterQueue : public SPSCQueue<BaseRaster>
+{
 public:
-  const size_t &capacity;
-  const size_t &occupancy;
-  
-  BaseRasterQueue(const size_t queue_length,
-                  const uint16_t display_width,
-                  const uint16_t display_height,
-                  const uint16_t width,
-                  const uint16_t height );
-  ~BaseRasterQueue();
-
-  BaseRaster& front();
-  void pop_front();
-
-  BaseRaster& back();
+  BaseRasterQueue( const size_t queue_length,
+                   const uint16_t display_width,
+                   const uint16_t display_height,
+                   const uint16_t width,
+                   const uint16_t height )
+    : SPSCQueue<BaseRaster>( queue_length, display_width, display_height, width, height )
+  {}
 };
 
 #endif /* RASTER_HH */
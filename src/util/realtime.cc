@@ -0,0 +1,82 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <malloc.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+
+#include "realtime.hh"
+#include "exception.hh"
+
+using namespace std;
+
+int allowed_cpu( const int cpu )
+{
+  cpu_set_t allowed;
+  SystemCall( "sched_getaffinity", sched_getaffinity( 0, sizeof( allowed ), &allowed ) );
+
+  if ( cpu < 0 or cpu >= CPU_SETSIZE or not CPU_ISSET( cpu, &allowed ) ) {
+    throw runtime_error( "CPU " + to_string( cpu ) + " is not available" );
+  }
+
+  return cpu;
+}
+
+void pin_thread( thread & thread, const int cpu )
+{
+  allowed_cpu( cpu );
+
+  cpu_set_t cpus;
+  CPU_ZERO( &cpus );
+  CPU_SET( cpu, &cpus );
+
+  /* returns the error rather than setting errno */
+  const int error = pthread_setaffinity_np( thread.native_handle(), sizeof( cpus ), &cpus );
+  if ( error ) {
+    throw unix_error( "pinning thread to CPU " + to_string( cpu ), error );
+  }
+}
+
+bool set_fifo_priority( thread & thread, const int priority )
+{
+  if ( priority < sched_get_priority_min( SCHED_FIFO ) or priority > sched_get_priority_max( SCHED_FIFO ) ) {
+    throw runtime_error( "invalid SCHED_FIFO priority " + to_string( priority ) );
+  }
+
+  sched_param param {};
+  param.sched_priority = priority;
+
+  const int error = pthread_setschedparam( thread.native_handle(), SCHED_FIFO, &param );
+  if ( error == EPERM ) {
+    return false;
+  } else if ( error ) {
+    throw unix_error( "pthread_setschedparam", error );
+  }
+
+  return true;
+}
+
+bool lock_memory( void )
+{
+  rlimit limit;
+  SystemCall( "getrlimit", getrlimit( RLIMIT_MEMLOCK, &limit ) );
+
+  if ( geteuid() != 0 and limit.rlim_cur != RLIM_INFINITY ) {
+    return false;
+  }
+
+  if ( mlockall( MCL_CURRENT | MCL_FUTURE ) < 0 ) {
+    if ( errno == EPERM or errno == ENOMEM ) {
+      return false;
+    }
+    throw unix_error( "mlockall" );
+  }
+
+  /* keep freed memory in the heap, and serve large blocks from it too */
+  mallopt( M_TRIM_THRESHOLD, -1 );
+  mallopt( M_MMAP_MAX, 0 );
+
+  return true;
+}
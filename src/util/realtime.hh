@@ -0,0 +1,36 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef REALTIME_HH
+#define REALTIME_HH
+
+#include <thread>
+
+/* Scheduling and memory controls for latency-critical threads. Pinning
+   asks for something the process can always have, so it throws when it
+   cannot be done; SCHED_FIFO and locked memory need privileges a user
+   may not have, so those return false when refused and leave things as
+   they were. */
+
+/* throws unless this process may run on `cpu`, which it returns */
+int allowed_cpu( const int cpu );
+
+/* restricts a thread to one CPU; throws if the CPU is not available */
+void pin_thread( std::thread & thread, const int cpu );
+
+/* moves a thread into SCHED_FIFO at `priority` (1 to 99); false if not
+   permitted (neither CAP_SYS_NICE nor enough RLIMIT_RTPRIO) */
+bool set_fifo_priority( std::thread & thread, const int priority );
+
+/* Locks every page the process has, and every page it maps from now on,
+   into memory, populating each as it is mapped, so that buffers are
+   faulted in when they are allocated rather than on first use. malloc
+   is told to keep what is freed instead of returning it to the kernel,
+   so a buffer a codec frees and reallocates every frame is not faulted
+   in again each time.
+
+   Refused (false) unless the process is privileged or RLIMIT_MEMLOCK is
+   unlimited: under a finite limit, a later allocation that would take
+   locked memory past it fails, which is worse than not locking. */
+bool lock_memory( void );
+
+#endif /* REALTIME_HH */
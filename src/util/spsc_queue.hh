@@ -0,0 +1,199 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef SPSC_QUEUE_HH
+#define SPSC_QUEUE_HH
+
+#include <atomic>
+#include <climits>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include "futex.hh"
+
+/* Bounded single-producer/single-consumer queue of preallocated slots.
+
+   The producer fills a slot in place between acquire_write() and
+   commit_write(); the consumer reads it between acquire_read() and
+   release_read(), so neither side ever observes a half-written element.
+   The indices are free-running counters on separate cache lines. The
+   blocking calls sleep on a shared sequence number with a futex, which a
+   commit or release bumps (and wakes) only when the other side is
+   actually asleep, and close() bumps once without waiting for anyone.
+
+   close() ends the stream: blocked and future writers get nothing, and
+   readers get what is left (ignoring any minimum occupancy) before they
+   too get nothing. */
+
+template <class T>
+class SPSCQueue
+{
+private:
+  std::vector<T> slots_;
+  const uint32_t capacity_;
+
+  /* producer-owned */
+  alignas( 64 ) std::atomic<uint32_t> write_count_ { 0 };
+  size_t write_slot_ { 0 };
+  std::atomic<uint32_t> producer_waiting_ { 0 };
+
+  /* consumer-owned */
+  alignas( 64 ) std::atomic<uint32_t> read_count_ { 0 };
+  size_t read_slot_ { 0 };
+  std::atomic<uint32_t> consumer_waiting_ { 0 };
+
+  alignas( 64 ) std::atomic<bool> closed_ { false };
+  std::atomic<uint32_t> sequence_ { 0 };
+
+  void wake_all( void )
+  {
+    sequence_.fetch_add( 1 );
+    futex_wake( sequence_, INT_MAX );
+  }
+
+  /* blocks until `ready( other_count )` holds; returns false if the queue
+     was closed first */
+  template <class Predicate>
+  bool wait_for( std::atomic<uint32_t> & other, std::atomic<uint32_t> & waiting,
+                 const Predicate & ready )
+  {
+    while ( not ready( other.load( std::memory_order_acquire ) ) ) {
+      if ( closed_.load( std::memory_order_acquire ) ) {
+        return false;
+      }
+
+      const uint32_t sequence = sequence_.load();
+      waiting.store( 1 );
+
+      /* re-check after announcing, so a concurrent commit or close either
+         sees the flag (and bumps the sequence we read) or we see its update */
+      if ( not ready( other.load() ) and not closed_.load() ) {
+        futex_wait( sequence_, sequence );
+      }
+
+      waiting.store( 0, std::memory_order_relaxed );
+    }
+
+    return true;
+  }
+
+public:
+  template <typename... Targs>
+  SPSCQueue( const size_t capacity, Targs&&... Fargs )
+    : slots_(), capacity_( capacity )
+  {
+    if ( capacity == 0 or capacity > UINT32_MAX / 2 ) {
+      throw std::invalid_argument( "SPSCQueue: invalid capacity" );
+    }
+
+    slots_.reserve( capacity );
+    for ( size_t i = 0; i < capacity; i++ ) {
+      slots_.emplace_back( Fargs... );
+    }
+  }
+
+  size_t capacity( void ) const { return capacity_; }
+
+  size_t occupancy( void ) const
+  {
+    return write_count_.load( std::memory_order_acquire ) - read_count_.load( std::memory_order_acquire );
+  }
+
+  /* producer side */
+  T * try_acquire_write( void )
+  {
+    const uint32_t written = write_count_.load( std::memory_order_relaxed );
+    if ( closed() or written - read_count_.load( std::memory_order_acquire ) >= capacity_ ) {
+      return nullptr;
+    }
+    return &slots_[ write_slot_ ];
+  }
+
+  /* blocks for a free slot; nullptr once the queue is closed */
+  T * wait_write( void )
+  {
+    const uint32_t written = write_count_.load( std::memory_order_relaxed );
+    if ( closed() or not wait_for( read_count_, producer_waiting_,
+                                   [&]( const uint32_t read ) { return written - read < capacity_; } ) ) {
+      return nullptr;
+    }
+    return &slots_[ write_slot_ ];
+  }
+
+  T & acquire_write( void )
+  {
+    T * slot = wait_write();
+    if ( not slot ) {
+      throw std::runtime_error( "SPSCQueue: write to closed queue" );
+    }
+    return *slot;
+  }
+
+  void commit_write( void )
+  {
+    write_slot_ = ( write_slot_ + 1 ) % capacity_;
+    write_count_.fetch_add( 1 );
+
+    if ( consumer_waiting_.load() ) {
+      wake_all();
+    }
+  }
+
+  /* consumer side; min_occupancy > 1 turns the queue into a delay line */
+  T * try_acquire_read( const size_t min_occupancy = 1 )
+  {
+    const uint32_t read = read_count_.load( std::memory_order_relaxed );
+    if ( write_count_.load( std::memory_order_acquire ) - read < min_occupancy ) {
+      return nullptr;
+    }
+    return &slots_[ read_slot_ ];
+  }
+
+  /* blocks for an element; once the queue is closed, drains it and then returns nullptr */
+  T * wait_read( const size_t min_occupancy = 1 )
+  {
+    const uint32_t read = read_count_.load( std::memory_order_relaxed );
+    if ( not wait_for( write_count_, consumer_waiting_,
+                       [&]( const uint32_t written ) { return written - read >= min_occupancy; } ) ) {
+      /* closed: whatever was committed before is still there */
+      if ( write_count_.load( std::memory_order_acquire ) == read ) {
+        return nullptr;
+      }
+    }
+    return &slots_[ read_slot_ ];
+  }
+
+  T & acquire_read( const size_t min_occupancy = 1 )
+  {
+    T * slot = wait_read( min_occupancy );
+    if ( not slot ) {
+      throw std::runtime_error( "SPSCQueue: read from closed and empty queue" );
+    }
+    return *slot;
+  }
+
+  void release_read( void )
+  {
+    read_slot_ = ( read_slot_ + 1 ) % capacity_;
+    read_count_.fetch_add( 1 );
+
+    if ( producer_waiting_.load() ) {
+      wake_all();
+    }
+  }
+
+  /* either side, or a third thread; wakes both sides without waiting for them */
+  void close( void )
+  {
+    closed_.store( true );
+    wake_all();
+  }
+
+  bool closed( void ) const { return closed_.load( std::memory_order_acquire ); }
+
+  /* forbid copying and moving; the other side holds references into slots_ */
+  SPSCQueue( const SPSCQueue & other ) = delete;
+  SPSCQueue & operator=( const SPSCQueue & other ) = delete;
+};
+
+#endif /* SPSC_QUEUE_HH */
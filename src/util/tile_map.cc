@@ -0,0 +1,110 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <algorithm>
+#include <cstring>
+
+#include "tile_map.hh"
+#include "exception.hh"
+#include "plane_ops.hh"
+
+using namespace std;
+
+/* min() binds it by reference, so C++14 needs it defined once */
+constexpr unsigned int TileChangeMap::TILE_SIZE;
+
+/* a tile's rectangle within one plane, clipped to it */
+struct PlaneTile
+{
+  unsigned int x, y, width, height;
+
+  PlaneTile( const TwoD<uint8_t> & plane, const unsigned int tile_size,
+             const unsigned int column, const unsigned int row )
+    : x( column * tile_size ), y( row * tile_size ),
+      width( min( tile_size, plane.width() - min( x, plane.width() ) ) ),
+      height( min( tile_size, plane.height() - min( y, plane.height() ) ) )
+  {}
+};
+
+TileChangeMap::TileChangeMap( const uint16_t width, const uint16_t height )
+  : reference_( width, height, width, height ),
+    columns_( ( width + TILE_SIZE - 1 ) / TILE_SIZE ),
+    rows_( ( height + TILE_SIZE - 1 ) / TILE_SIZE ),
+    dirty_( columns_ * rows_, true )
+{}
+
+bool TileChangeMap::tile_changed( const BaseRaster & raster, const unsigned int column,
+                                  const unsigned int row ) const
+{
+  uint64_t sad = 0;
+
+  for ( unsigned int plane = 0; plane < 3 and sad <= threshold_; plane++ ) {
+    const TwoD<uint8_t> & mine = plane == 0 ? raster.Y() : plane == 1 ? raster.U() : raster.V();
+    const TwoD<uint8_t> & theirs = plane == 0 ? reference_.Y() : plane == 1 ? reference_.U() : reference_.V();
+    const PlaneTile tile { mine, plane == 0 ? TILE_SIZE : TILE_SIZE / 2, column, row };
+
+    if ( tile.width == 0 or tile.height == 0 ) {
+      continue;
+    }
+
+    sad += sad_block( &mine.at( tile.x, tile.y ), mine.stride(),
+                      &theirs.at( tile.x, tile.y ), theirs.stride(),
+                      tile.width, tile.height, threshold_ - sad );
+  }
+
+  return sad > threshold_;
+}
+
+void TileChangeMap::copy_tile( const BaseRaster & raster, const unsigned int column,
+                               const unsigned int row )
+{
+  for ( unsigned int plane = 0; plane < 3; plane++ ) {
+    const TwoD<uint8_t> & source = plane == 0 ? raster.Y() : plane == 1 ? raster.U() : raster.V();
+    TwoD<uint8_t> & target = plane == 0 ? reference_.Y() : plane == 1 ? reference_.U() : reference_.V();
+    const PlaneTile tile { source, plane == 0 ? TILE_SIZE : TILE_SIZE / 2, column, row };
+
+    for ( unsigned int y = tile.y; y < tile.y + tile.height; y++ ) {
+      memcpy( &target.at( tile.x, y ), &source.at( tile.x, y ), tile.width );
+    }
+  }
+}
+
+size_t TileChangeMap::update( const BaseRaster & raster )
+{
+  if ( raster.width() != reference_.width() or raster.height() != reference_.height() ) {
+    throw Invalid( "raster dimensions do not match tile map" );
+  }
+
+  dirty_regions_.clear();
+  dirty_count_ = 0;
+
+  for ( unsigned int row = 0; row < rows_; row++ ) {
+    for ( unsigned int column = 0; column < columns_; column++ ) {
+      const bool dirty = not valid_ or tile_changed( raster, column, row );
+      dirty_[ row * columns_ + column ] = dirty;
+
+      if ( not dirty ) {
+        continue;
+      }
+
+      dirty_count_++;
+      copy_tile( raster, column, row );
+
+      /* extend the run to the left, if there is one */
+      const unsigned int x = column * TILE_SIZE;
+      const unsigned int width = min( TILE_SIZE, unsigned( raster.width() ) - x );
+
+      if ( column > 0 and dirty_[ row * columns_ + column - 1 ] ) {
+        dirty_regions_.back().width += width;
+      } else {
+        const unsigned int y = row * TILE_SIZE;
+        dirty_regions_.push_back( { x, y, width, min( TILE_SIZE, unsigned( raster.height() ) - y ) } );
+      }
+    }
+  }
+
+  tiles_checked_ += dirty_.size();
+  tiles_clean_ += dirty_.size() - dirty_count_;
+  valid_ = true;
+
+  return dirty_count_;
+}
@@ -0,0 +1,70 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef TILE_MAP_HH
+#define TILE_MAP_HH
+
+#include <cstdint>
+#include <vector>
+
+#include "raster.hh"
+
+/* Which 64x64 luma tiles (with their 32x32 chroma tiles) of a stream of
+   4:2:0 rasters changed. Each update() compares the raster against a
+   reference copy of everything reported so far, tile by tile, with an
+   early-out SAD; tiles within the threshold are clean, and dirty tiles
+   are copied into the reference. Comparing against what was reported,
+   rather than against the previous raster, keeps slow drift below the
+   threshold from accumulating in the consumer. */
+class TileChangeMap
+{
+public:
+  static constexpr unsigned int TILE_SIZE = 64;
+
+  /* a run of dirty tiles, in luma pixels, clipped to the raster */
+  struct Region
+  {
+    unsigned int x, y, width, height;
+  };
+
+private:
+  BaseRaster reference_;
+  unsigned int columns_, rows_;
+  uint64_t threshold_ { 0 };
+  bool valid_ { false };
+
+  std::vector<bool> dirty_;
+  std::vector<Region> dirty_regions_ {};
+  size_t dirty_count_ { 0 };
+
+  uint64_t tiles_checked_ { 0 };
+  uint64_t tiles_clean_ { 0 };
+
+  bool tile_changed( const BaseRaster & raster, const unsigned int column, const unsigned int row ) const;
+  void copy_tile( const BaseRaster & raster, const unsigned int column, const unsigned int row );
+
+public:
+  TileChangeMap( const uint16_t width, const uint16_t height );
+
+  /* largest SAD over a tile's three planes that still counts as unchanged; 0 means identical */
+  void set_threshold( const uint64_t threshold ) { threshold_ = threshold; }
+
+  /* the next update() reports every tile as dirty */
+  void invalidate( void ) { valid_ = false; }
+
+  /* returns the number of dirty tiles */
+  size_t update( const BaseRaster & raster );
+
+  unsigned int columns( void ) const { return columns_; }
+  unsigned int rows( void ) const { return rows_; }
+  size_t tile_count( void ) const { return dirty_.size(); }
+
+  /* results of the last update() */
+  bool dirty( const unsigned int column, const unsigned int row ) const { return dirty_[ row * columns_ + column ]; }
+  size_t dirty_count( void ) const { return dirty_count_; }
+  const std::vector<Region> & dirty_regions( void ) const { return dirty_regions_; }
+
+  /* fraction of tiles found clean, over all updates */
+  double hit_rate( void ) const { return tiles_checked_ ? double( tiles_clean_ ) / tiles_checked_ : 0; }
+};
+
+#endif /* TILE_MAP_HH */
@@ -0,0 +1,69 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include "timerfd.hh"
+#include "timestamp.hh"
+#include "exception.hh"
+
+using namespace std;
+
+static timespec to_timespec( const int64_t us )
+{
+  return { time_t( us / 1000000 ), long( us % 1000000 ) * 1000 };
+}
+
+TimerFD::TimerFD()
+  : fd_( SystemCall( "timerfd_create", timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC ) ) )
+{}
+
+void TimerFD::set( const int64_t value_us, const int64_t interval_us, const int flags )
+{
+  const itimerspec spec { to_timespec( interval_us ), to_timespec( value_us ) };
+  SystemCall( "timerfd_settime", timerfd_settime( fd_.fd_num(), flags, &spec, nullptr ) );
+}
+
+void TimerFD::arm_at( const int64_t monotonic_us )
+{
+  /* an all-zero value would disarm instead */
+  set( monotonic_us > 0 ? monotonic_us : 1, 0, TFD_TIMER_ABSTIME );
+}
+
+void TimerFD::arm_periodic( const int64_t interval_us )
+{
+  if ( interval_us <= 0 ) {
+    throw runtime_error( "TimerFD: interval must be positive" );
+  }
+
+  set( interval_us, interval_us, 0 );
+}
+
+void TimerFD::disarm( void )
+{
+  set( 0, 0, 0 );
+}
+
+uint64_t TimerFD::read_expirations( void )
+{
+  uint64_t expirations = 0;
+
+  while ( true ) {
+    const ssize_t ret = ::read( fd_.fd_num(), &expirations, sizeof( expirations ) );
+
+    if ( ret == sizeof( expirations ) ) {
+      return expirations;
+    } else if ( ret >= 0 ) {
+      throw runtime_error( "timerfd read size mismatch" );
+    } else if ( errno != EINTR ) {
+      throw unix_error( "read from timerfd" );
+    }
+  }
+}
+
+void TimerFD::wait_until( const int64_t monotonic_us )
+{
+  if ( monotonic_us <= monotonic_timestamp_us() ) {
+    return;
+  }
+
+  arm_at( monotonic_us );
+  read_expirations();
+}
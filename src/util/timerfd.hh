@@ -0,0 +1,41 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef TIMERFD_HH
+#define TIMERFD_HH
+
+#include <cstdint>
+#include <sys/timerfd.h>
+
+#include "file_descriptor.hh"
+
+/* a CLOCK_MONOTONIC timerfd, with times in microseconds as elsewhere
+   (see timestamp.hh); readable whenever the timer has expired, so it
+   can be slept on directly or polled alongside other descriptors */
+class TimerFD
+{
+private:
+  FileDescriptor fd_;
+
+  void set( const int64_t value_us, const int64_t interval_us, const int flags );
+
+public:
+  TimerFD();
+
+  FileDescriptor & fd( void ) { return fd_; }
+
+  /* fires once, at an absolute CLOCK_MONOTONIC time */
+  void arm_at( const int64_t monotonic_us );
+
+  /* fires every `interval_us`, starting one interval from now */
+  void arm_periodic( const int64_t interval_us );
+
+  void disarm( void );
+
+  /* blocks until the timer fires; returns the expirations since the last read */
+  uint64_t read_expirations( void );
+
+  /* sleeps until an absolute CLOCK_MONOTONIC time; returns at once if it has passed */
+  void wait_until( const int64_t monotonic_us );
+};
+
+#endif /* TIMERFD_HH */
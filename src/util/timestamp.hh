@@ -0,0 +1,27 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef TIMESTAMP_HH
+#define TIMESTAMP_HH
+
+/* CLOCK_MONOTONIC in microseconds: the clock V4L2 stamps buffers with
+   and X Present reports UST in, so the two can be compared directly */
+
+#include <cstdint>
+#include <ctime>
+#include <sys/time.h>
+
+#include "exception.hh"
+
+inline int64_t timestamp_us( const timeval & tv )
+{
+  return int64_t( tv.tv_sec ) * 1000000 + tv.tv_usec;
+}
+
+inline int64_t monotonic_timestamp_us( void )
+{
+  timespec ts;
+  SystemCall( "clock_gettime", clock_gettime( CLOCK_MONOTONIC, &ts ) );
+  return int64_t( ts.tv_sec ) * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif /* TIMESTAMP_HH */
@@ -0,0 +1,78 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <climits>
+
+#include "worker_pool.hh"
+#include "futex.hh"
+
+using namespace std;
+
+WorkerPool::WorkerPool( const size_t threads )
+{
+  for ( size_t band = 1; band < max<size_t>( threads, 1 ); band++ ) {
+    threads_.emplace_back( [this, band]() { work( band ); } );
+  }
+}
+
+WorkerPool::~WorkerPool()
+{
+  stop_ = true;
+  generation_.fetch_add( 1 );
+  futex_wake( generation_, INT_MAX );
+
+  for ( auto & thread : threads_ ) {
+    thread.join();
+  }
+}
+
+void WorkerPool::run_band( const size_t band ) const
+{
+  const size_t begin = count_ * band / size();
+  const size_t end = count_ * ( band + 1 ) / size();
+
+  if ( begin < end ) {
+    ( *job_ )( begin, end );
+  }
+}
+
+void WorkerPool::work( const size_t band )
+{
+  uint32_t seen = 0;
+
+  while ( true ) {
+    uint32_t generation;
+    while ( ( generation = generation_.load() ) == seen ) {
+      futex_wait( generation_, seen );
+    }
+    seen = generation;
+
+    if ( stop_ ) {
+      return;
+    }
+
+    run_band( band );
+
+    if ( pending_.fetch_sub( 1 ) == 1 ) {
+      futex_wake( pending_ );
+    }
+  }
+}
+
+void WorkerPool::parallel_for( const size_t count, const Job & job )
+{
+  job_ = &job;
+  count_ = count;
+
+  if ( not threads_.empty() ) {
+    pending_.store( threads_.size() );
+    generation_.fetch_add( 1 );
+    futex_wake( generation_, INT_MAX );
+  }
+
+  run_band( 0 );
+
+  uint32_t pending;
+  while ( ( pending = pending_.load() ) != 0 ) {
+    futex_wait( pending_, pending );
+  }
+}
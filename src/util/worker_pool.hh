@@ -0,0 +1,53 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef WORKER_POOL_HH
+#define WORKER_POOL_HH
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <vector>
+
+/* Fixed set of threads for data-parallel loops. parallel_for() splits
+   [0, count) into one contiguous band per thread, runs the first band on
+   the calling thread, and returns when all bands are done. Idle workers
+   sleep on a futex, so a pool costs nothing between calls. */
+
+class WorkerPool
+{
+public:
+  typedef std::function<void( const size_t begin, const size_t end )> Job;
+
+private:
+  std::vector<std::thread> threads_ {};
+
+  /* bumped to start a job; the workers sleep on it */
+  std::atomic<uint32_t> generation_ { 0 };
+
+  /* bands still running on workers; the caller sleeps on it */
+  std::atomic<uint32_t> pending_ { 0 };
+
+  std::atomic<bool> stop_ { false };
+
+  const Job * job_ { nullptr };
+  size_t count_ { 0 };
+
+  void run_band( const size_t band ) const;
+  void work( const size_t band );
+
+public:
+  /* `threads` counts the caller, so WorkerPool( 1 ) runs everything inline */
+  WorkerPool( const size_t threads = std::thread::hardware_concurrency() );
+  ~WorkerPool();
+
+  size_t size( void ) const { return threads_.size() + 1; }
+
+  void parallel_for( const size_t count, const Job & job );
+
+  /* forbid copying and moving; the workers hold `this` */
+  WorkerPool( const WorkerPool & other ) = delete;
+  WorkerPool & operator=( const WorkerPool & other ) = delete;
+};
+
+#endif /* WORKER_POOL_HH */
@@ -0,0 +1,301 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#include <cstdint>
+#include <sstream>
+
+#include "y4m.hh"
+#include "exception.hh"
+
+using namespace std;
+
+static const string Y4M_MAGIC = "YUV4MPEG2";
+static const string FRAME_MAGIC = "FRAME";
+static const string FRAME_LINE = FRAME_MAGIC + "\n";
+
+/* returns the offset of the next newline at or after `offset`, or the chunk size */
+static uint64_t find_newline( const Chunk & chunk, const uint64_t offset )
+{
+  if ( offset >= chunk.size() ) {
+    return chunk.size();
+  }
+
+  const void * found = memchr( chunk.buffer() + offset, '\n', chunk.size() - offset );
+  return found ? static_cast<const uint8_t *>( found ) - chunk.buffer() : chunk.size();
+}
+
+static pair<unsigned int, unsigned int> parse_ratio( const string & token )
+{
+  const size_t colon = token.find( ':' );
+  if ( colon == string::npos ) {
+    throw Invalid( "malformed Y4M ratio: " + token );
+  }
+
+  return make_pair( stoul( token.substr( 0, colon ) ), stoul( token.substr( colon + 1 ) ) );
+}
+
+Y4MHeader::Y4MHeader( const uint16_t width, const uint16_t height,
+                      const unsigned int fps_numerator, const unsigned int fps_denominator )
+  : width( width ), height( height ),
+    fps_numerator( fps_numerator ), fps_denominator( fps_denominator )
+{}
+
+/* rasters are at most 65535 samples on a side */
+static uint16_t parse_dimension( const string & value )
+{
+  const unsigned long dimension = stoul( value );
+  if ( dimension > UINT16_MAX ) {
+    throw Invalid( "Y4M frame dimension " + value + " is too large" );
+  }
+  return dimension;
+}
+
+Y4MHeader Y4MHeader::parse( const Chunk & line )
+{
+  istringstream tokens { line.to_string() };
+  string token;
+
+  if ( not ( tokens >> token ) or token != Y4M_MAGIC ) {
+    throw Invalid( "missing YUV4MPEG2 signature" );
+  }
+
+  Y4MHeader header;
+
+  while ( tokens >> token ) {
+    const string value = token.substr( 1 );
+
+    switch ( token[ 0 ] ) {
+    case 'W': header.width = parse_dimension( value ); break;
+    case 'H': header.height = parse_dimension( value ); break;
+    case 'I': header.interlacing = value.empty() ? 'p' : value[ 0 ]; break;
+    case 'C': header.colorspace = ( value == "420" ) ? "420jpeg" : value; break;
+
+    case 'F':
+      tie( header.fps_numerator, header.fps_denominator ) = parse_ratio( value );
+      break;
+
+    case 'A':
+      tie( header.aspect_numerator, header.aspect_denominator ) = parse_ratio( value );
+      break;
+
+    default: break; /* X comments and unknown tags are ignored */
+    }
+  }
+
+  if ( header.width == 0 or header.height == 0 ) {
+    throw Invalid( "Y4M header is missing frame dimensions" );
+  }
+
+  if ( header.fps_denominator == 0 ) {
+    throw Invalid( "Y4M header has a zero frame rate denominator" );
+  }
+
+  /* validates the colorspace */
+  header.chroma_width();
+
+  return header;
+}
+
+string Y4MHeader::to_string( void ) const
+{
+  ostringstream out;
+
+  out << Y4M_MAGIC << " W" << width << " H" << height
+      << " F" << fps_numerator << ":" << fps_denominator
+      << " I" << interlacing
+      << " A" << aspect_numerator << ":" << aspect_denominator
+      << " C" << colorspace << "\n";
+
+  return out.str();
+}
+
+bool Y4MHeader::is_420( void ) const
+{
+  return colorspace.compare( 0, 3, "420" ) == 0;
+}
+
+uint16_t Y4MHeader::chroma_width( void ) const
+{
+  if ( is_420() or colorspace == "422" ) {
+    return ( width + 1 ) / 2;
+  } else if ( colorspace == "444" ) {
+    return width;
+  } else if ( colorspace == "mono" ) {
+    return 0;
+  }
+
+  throw Unsupported( "Y4M colorspace " + colorspace );
+}
+
+uint16_t Y4MHeader::chroma_height( void ) const
+{
+  if ( is_420() ) {
+    return ( height + 1 ) / 2;
+  } else if ( colorspace == "422" or colorspace == "444" ) {
+    return height;
+  } else if ( colorspace == "mono" ) {
+    return 0;
+  }
+
+  throw Unsupported( "Y4M colorspace " + colorspace );
+}
+
+size_t Y4MHeader::frame_length( void ) const
+{
+  return size_t( width ) * height + 2 * size_t( chroma_width() ) * chroma_height();
+}
+
+void Y4MFrame::copy_to( BaseRaster & raster, const Y4MHeader & header ) const
+{
+  if ( not header.is_420() ) {
+    throw Unsupported( "only 4:2:0 Y4M frames can be copied into a raster" );
+  }
+
+  if ( raster.display_width() != header.width or raster.display_height() != header.height ) {
+    throw Invalid( "Y4M frame dimensions do not match raster" );
+  }
+
+  const uint16_t chroma_width = header.chroma_width();
+
+  for ( uint16_t row = 0; row < header.height; row++ ) {
+    memcpy( &raster.Y().at( 0, row ), Y.buffer() + row * header.width, header.width );
+  }
+
+  for ( uint16_t row = 0; row < header.chroma_height(); row++ ) {
+    memcpy( &raster.U().at( 0, row ), U.buffer() + row * chroma_width, chroma_width );
+    memcpy( &raster.V().at( 0, row ), V.buffer() + row * chroma_width, chroma_width );
+  }
+}
+
+Y4MWriter::Y4MWriter( const string & filename, const Y4MHeader & header )
+  : header_( header ),
+    file_( fopen( filename.c_str(), "wb" ), fclose )
+{
+  if ( file_.get() == nullptr ) {
+    throw unix_error( "fopen " + filename );
+  }
+
+  const string header_line = header_.to_string();
+  if ( 1 != fwrite( header_line.data(), header_line.size(), 1, file_.get() ) ) {
+    throw runtime_error( "fwrite returned short write" );
+  }
+}
+
+void Y4MWriter::write( const BaseRaster & raster )
+{
+  if ( raster.display_width() != header_.width or raster.display_height() != header_.height ) {
+    throw Invalid( "raster dimensions do not match Y4M header" );
+  }
+
+  if ( 1 != fwrite( FRAME_LINE.data(), FRAME_LINE.size(), 1, file_.get() ) ) {
+    throw runtime_error( "fwrite returned short write" );
+  }
+
+  raster.dump( file_.get() );
+  frame_count_++;
+}
+
+void Y4MWriter::flush( void )
+{
+  if ( fflush( file_.get() ) ) {
+    throw unix_error( "fflush" );
+  }
+}
+
+Y4MReader::Y4MReader( const string & filename )
+  : file_( filename )
+{
+  const Chunk & contents = file_.chunk();
+  const uint64_t header_end = find_newline( contents, 0 );
+
+  if ( header_end == contents.size() ) {
+    throw Invalid( "truncated Y4M header" );
+  }
+
+  header_ = Y4MHeader::parse( contents( 0, header_end ) );
+  scan_offset_ = header_end + 1;
+}
+
+/* parses the FRAME line at scan_offset_ and records where its data starts */
+bool Y4MReader::index_next_frame( void )
+{
+  if ( index_complete_ ) {
+    return false;
+  }
+
+  const Chunk & contents = file_.chunk();
+  const uint64_t line_end = find_newline( contents, scan_offset_ );
+  const uint64_t data_end = line_end + 1 + header_.frame_length();
+
+  if ( line_end == contents.size() or data_end > contents.size() ) {
+    /* a partially written trailing frame (e.g. an interrupted recording) is ignored */
+    index_complete_ = true;
+    return false;
+  }
+
+  if ( line_end - scan_offset_ < FRAME_MAGIC.size()
+       or memcmp( contents.buffer() + scan_offset_, FRAME_MAGIC.data(), FRAME_MAGIC.size() ) ) {
+    throw Invalid( "missing Y4M FRAME marker" );
+  }
+
+  frame_offsets_.push_back( line_end + 1 );
+  scan_offset_ = data_end;
+  return true;
+}
+
+bool Y4MReader::index_through( const size_t index )
+{
+  while ( frame_offsets_.size() <= index ) {
+    if ( not index_next_frame() ) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+size_t Y4MReader::frame_count( void )
+{
+  while ( index_next_frame() ) {}
+  return frame_offsets_.size();
+}
+
+Y4MFrame Y4MReader::frame( const size_t index )
+{
+  if ( not index_through( index ) ) {
+    throw out_of_range( "Y4M frame index out of range" );
+  }
+
+  const uint64_t luma_length = uint64_t( header_.width ) * header_.height;
+  const uint64_t chroma_length = uint64_t( header_.chroma_width() ) * header_.chroma_height();
+  const Chunk data = file_( frame_offsets_[ index ], header_.frame_length() );
+
+  return { data( 0, luma_length ),
+           data( luma_length, chroma_length ),
+           data( luma_length + chroma_length, chroma_length ) };
+}
+
+void Y4MReader::seek( const size_t index )
+{
+  next_frame_ = index;
+}
+
+Optional<Y4MFrame> Y4MReader::next_frame( void )
+{
+  if ( not index_through( next_frame_ ) ) {
+    return {};
+  }
+
+  return frame( next_frame_++ );
+}
+
+bool Y4MReader::read_frame( BaseRaster & raster )
+{
+  Optional<Y4MFrame> next = next_frame();
+
+  if ( not next.initialized() ) {
+    return false;
+  }
+
+  next.get().copy_to( raster, header_ );
+  return true;
+}
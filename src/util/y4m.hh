@@ -0,0 +1,109 @@
+/* -*-mode:c++; tab-width: 2; indent-tabs-mode: nil; c-basic-offset: 2 -*- */
+
+#ifndef Y4M_HH
+#define Y4M_HH
+
+/* YUV4MPEG2 container: header parsing, a streaming writer and a
+   memory-mapped reader with a lazily built frame index */
+
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "chunk.hh"
+#include "file.hh"
+#include "optional.hh"
+#include "raster.hh"
+
+struct Y4MHeader
+{
+  uint16_t width { 0 };
+  uint16_t height { 0 };
+  unsigned int fps_numerator { 30 };
+  unsigned int fps_denominator { 1 };
+  char interlacing { 'p' };
+  unsigned int aspect_numerator { 0 };
+  unsigned int aspect_denominator { 0 };
+  std::string colorspace { "420jpeg" };
+
+  Y4MHeader() {}
+  Y4MHeader( const uint16_t width, const uint16_t height,
+             const unsigned int fps_numerator, const unsigned int fps_denominator = 1 );
+
+  /* parses the header line (without the trailing newline) */
+  static Y4MHeader parse( const Chunk & line );
+  std::string to_string( void ) const;
+
+  /* plane geometry, derived from the colorspace tag */
+  uint16_t chroma_width( void ) const;
+  uint16_t chroma_height( void ) const;
+  bool is_420( void ) const;
+
+  /* size of the planar data following each FRAME line */
+  size_t frame_length( void ) const;
+};
+
+/* zero-copy view of one frame inside a Y4M file */
+struct Y4MFrame
+{
+  Chunk Y, U, V;
+
+  Y4MFrame( const Chunk & Y, const Chunk & U, const Chunk & V )
+    : Y( Y ), U( U ), V( V )
+  {}
+
+  void copy_to( BaseRaster & raster, const Y4MHeader & header ) const;
+};
+
+class Y4MWriter
+{
+private:
+  Y4MHeader header_;
+  std::unique_ptr<FILE, decltype( &fclose )> file_;
+  size_t frame_count_ { 0 };
+
+public:
+  Y4MWriter( const std::string & filename, const Y4MHeader & header );
+
+  void write( const BaseRaster & raster );
+  void flush( void );
+
+  const Y4MHeader & header( void ) const { return header_; }
+  size_t frame_count( void ) const { return frame_count_; }
+};
+
+class Y4MReader
+{
+private:
+  File file_;
+  Y4MHeader header_ {};
+
+  /* offset of each frame's planar data, extended on demand */
+  std::vector<uint64_t> frame_offsets_ {};
+  uint64_t scan_offset_ { 0 };
+  bool index_complete_ { false };
+
+  size_t next_frame_ { 0 };
+
+  bool index_next_frame( void );
+  bool index_through( const size_t index );
+
+public:
+  Y4MReader( const std::string & filename );
+
+  const Y4MHeader & header( void ) const { return header_; }
+
+  /* completes the index if it has not been built yet */
+  size_t frame_count( void );
+
+  /* random access */
+  Y4MFrame frame( const size_t index );
+  void seek( const size_t index );
+
+  /* streaming access from the current position */
+  Optional<Y4MFrame> next_frame( void );
+  bool read_frame( BaseRaster & raster );
+};
+
+#endif /* Y4M_HH */